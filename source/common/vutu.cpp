@@ -13,6 +13,7 @@
 #include "vutuView.h"
 #include "vutuProcessor.h"
 #include "vutuController.h"
+#include "vutuBatch.h"
 
 #include "MLSDLUtils.h"
 
@@ -59,6 +60,12 @@ void vutuAppLoop(SDL_Window* window, bool* done, Path controllerName)
 
 int main(int argc, char *argv[])
 {
+  // run a batch job without the GUI if one was requested
+  if(isBatchCommand(argc, argv))
+  {
+    return runBatchCommand(argc, argv);
+  }
+
   bool doneFlag{false};
   
   // read parameter descriptions into a list
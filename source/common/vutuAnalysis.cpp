@@ -0,0 +1,181 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuAnalysis.h"
+#include "vutuPartialsPipeline.h"
+
+// Loris includes
+#include "Analyzer.h"
+#include "PartialList.h"
+#include "loris.h"
+
+using namespace ml;
+
+AnalysisParams ml::getAnalysisParams(const ParameterTree& params)
+{
+  AnalysisParams p;
+  p.resolution = params.getRealFloatValue("resolution");
+  p.windowWidth = params.getRealFloatValue("window_width");
+  p.ampFloor = params.getRealFloatValue("amp_floor");
+  p.freqDrift = params.getRealFloatValue("freq_drift");
+  p.loCut = params.getRealFloatValue("lo_cut");
+  p.hiCut = params.getRealFloatValue("hi_cut");
+  p.noiseWidth = params.getRealFloatValue("noise_width");
+  p.simplify.cents = params.getRealFloatValue("simplify_cents");
+  p.simplify.dB = params.getRealFloatValue("simplify_db");
+  return p;
+}
+
+std::vector< double > ml::getAnalysisInput(const ml::Sample& sample, Interval interval)
+{
+  std::vector< double > vx;
+  auto totalFrames = getFrames(sample);
+  if(!totalFrames) return vx;
+
+  auto frameInterval = interval*float(totalFrames);
+  int framesInInterval = frameInterval.mX2 - frameInterval.mX1;
+  const float kFadeTime = 0.001f;
+  int fadeSamples = std::min(int(kFadeTime*sample.sampleRate), framesInInterval/2);
+
+  // make double-precision version of input
+  vx.resize(framesInInterval);
+  int srcStart = frameInterval.mX1;
+  for(int i=0; i<framesInInterval; ++i)
+  {
+    vx[i] = sample[srcStart + i];
+  }
+
+  // fade in
+  for(int i=0; i<fadeSamples; ++i)
+  {
+    double gain = (double)i / (double)fadeSamples;
+    vx[i] *= gain;
+  }
+
+  // fade out
+  for(int i=0; i<fadeSamples; ++i)
+  {
+    int i2 = framesInInterval - 1 - i;
+    double gain = (double)i / (double)fadeSamples;
+    vx[i2] *= gain;
+  }
+
+  return vx;
+}
+
+Loris::PartialList ml::analyzeWithLoris(const std::vector< double >& input, int sampleRate, const AnalysisParams& p, bool verbose)
+{
+  Loris::Analyzer analyzer(p.resolution, p.windowWidth);
+  analyzer.setFreqDrift(p.freqDrift);
+  analyzer.setAmpFloor(p.ampFloor);
+  analyzer.setFreqFloor(p.loCut);
+  analyzer.storeResidueBandwidth(p.noiseWidth);
+
+  //  if verbose, spew out the Analyzer state:
+  if(verbose)
+  {
+    std::cout << "* Loris Analyzer configuration:" << std::endl;
+    std::cout << "*\tfrequency resolution: " << analyzer.freqResolution() << " Hz\n";
+    std::cout << "*\tanalysis window width: " << analyzer.windowWidth() << " Hz\n";
+    std::cout << "*\tanalysis window sidelobe attenuation: "
+    << analyzer.sidelobeLevel() << " dB\n";
+    std::cout << "*\tspectral amplitude floor: " << analyzer.ampFloor() << " dB\n";
+    std::cout << "*\tminimum partial frequecy: " << analyzer.freqFloor() << " Hz\n";
+    std::cout << "*\thop time: " << 1000*analyzer.hopTime() << " ms\n";
+    std::cout << "*\tmaximum partial frequency drift: " << analyzer.freqDrift()
+    << " Hz\n";
+    std::cout << "*\tcrop time: " << 1000*analyzer.cropTime() << " ms\n";
+    std::cout << "*\tspectral residue bandwidth association region width: "
+    << analyzer.bwRegionWidth() << " Hz\n";
+    std::cout << std::endl;
+  }
+
+  Loris::PartialList partials;
+  if(input.size() > 0)
+  {
+    analyzer.analyze(input, sampleRate);
+    partials.splice(partials.end(), analyzer.partials());
+  }
+  return partials;
+}
+
+void ml::lorisToVutuPartials(const Loris::PartialList& lorisPartials, VutuPartialsData& vutuPartials)
+{
+  // make each partial in place with its storage reserved, so nothing is copied or regrown.
+  vutuPartials.partials.clear();
+  vutuPartials.partials.reserve(lorisPartials.size());
+  for (const auto& partial : lorisPartials) {
+    vutuPartials.partials.emplace_back();
+    VutuPartial& sp = vutuPartials.partials.back();
+    size_t nBreakpoints = partial.numBreakpoints();
+    for(auto pv : {&sp.time, &sp.freq, &sp.amp, &sp.bandwidth, &sp.phase})
+    {
+      pv->reserve(nBreakpoints);
+    }
+    for (auto it = partial.begin(); it != partial.end(); it++) {
+      sp.time.push_back(it.time());
+      sp.freq.push_back(it->frequency());
+      sp.amp.push_back(it->amplitude());
+      sp.bandwidth.push_back(it->bandwidth());
+      sp.phase.push_back(it->phase());
+    }
+  }
+
+  vutuPartials.type = Symbol(kVutuPartialsFileType);
+  vutuPartials.version = kVutuPartialsFileVersion;
+}
+
+void ml::vutuToLorisPartials(const VutuPartialsData& vutuPartials, Loris::PartialList& lorisPartials)
+{
+  lorisPartials.clear();
+
+  // fill each Loris partial in place in the list, instead of copying it in when done.
+  for (auto it = vutuPartials.partials.begin(); it != vutuPartials.partials.end(); it++) {
+    const VutuPartial& sp = *it;
+    lorisPartials.push_back(Loris::Partial());
+    Loris::Partial& lp = lorisPartials.back();
+
+    size_t nBreakpoints = sp.time.size();
+    for(int i=0; i<nBreakpoints; ++i)
+    {
+      Loris::Breakpoint b(sp.freq[i], sp.amp[i], sp.bandwidth[i], sp.phase[i]);
+      lp.insert(sp.time[i], b);
+    }
+  }
+}
+
+void ml::distillHarmonics(Loris::PartialList& lorisPartials, float fundamental)
+{
+  if(fundamental <= 0.f) return;
+
+  // a constant reference envelope for the first harmonic
+  LinearEnvelope* pRefFreq = createLinearEnvelope();
+  linearEnvelope_insertBreakpoint(pRefFreq, 0., fundamental);
+
+  channelize(&lorisPartials, pRefFreq, 1);
+  distill(&lorisPartials);
+
+  destroyLinearEnvelope(pRefFreq);
+}
+
+std::unique_ptr< VutuPartialsData > ml::makeVutuPartials(const Loris::PartialList& lorisPartials, const AnalysisParams& p, size_t maxThreads)
+{
+  auto vutuPartials = std::make_unique< VutuPartialsData >();
+  lorisToVutuPartials(lorisPartials, *vutuPartials);
+
+  // drop partials that go above the high cut, or are too short to play, in one pass.
+  PartialsPipeline().keepBand(Interval{0.f, p.hiCut}).keepMinBreakpoints(2).apply(*vutuPartials, maxThreads);
+
+  simplifyPartials(*vutuPartials, p.simplify, maxThreads);
+  calcStats(*vutuPartials);
+
+  // store analysis params used
+  vutuPartials->resolution = p.resolution;
+  vutuPartials->windowWidth = p.windowWidth;
+  vutuPartials->ampFloor = p.ampFloor;
+  vutuPartials->freqDrift = p.freqDrift;
+  vutuPartials->loCut = p.loCut;
+  vutuPartials->hiCut = p.hiCut;
+  return vutuPartials;
+}
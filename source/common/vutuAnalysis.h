@@ -0,0 +1,62 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "madronalib.h"
+#include "MLDSPSample.h"
+#include "MLParameters.h"
+
+#include "vutuPartials.h"
+#include "vutuSimplify.h"
+
+#include "PartialList.h"
+
+// analysis of samples into partials with the Loris Analyzer, and conversion
+// between Loris and Vutu partials.
+
+namespace ml
+{
+
+// the parameters that control an analysis.
+struct AnalysisParams
+{
+  float resolution{40};
+  float windowWidth{80};
+  float ampFloor{-60};
+  float freqDrift{40};
+  float loCut{20};
+  float hiCut{20000};
+  float noiseWidth{500};
+
+  // breakpoint simplification after analysis
+  SimplifyTolerances simplify;
+};
+
+// get analysis parameters from their current values in a parameter tree.
+AnalysisParams getAnalysisParams(const ParameterTree& params);
+
+// get a double-precision copy of the given interval of a mono sample, with short fades at each end.
+std::vector< double > getAnalysisInput(const ml::Sample& sample, Interval interval);
+
+// run the Loris Analyzer on the input and return the raw partials. Each call makes its own
+// Analyzer, so different analyses can run at the same time on different threads.
+Loris::PartialList analyzeWithLoris(const std::vector< double >& input, int sampleRate, const AnalysisParams& p, bool verbose = false);
+
+// convert between Loris and Vutu partials. The Vutu partials are the only ones kept; Loris
+// partials are only made for as long as a Loris operation needs them.
+void lorisToVutuPartials(const Loris::PartialList& lorisPartials, VutuPartialsData& vutuPartials);
+void vutuToLorisPartials(const VutuPartialsData& vutuPartials, Loris::PartialList& lorisPartials);
+
+// label each partial with the number of the harmonic of the fundamental it is closest to, then
+// distill the partials with each label into a single partial. Unlabeled partials are collated
+// into as few partials as possible.
+void distillHarmonics(Loris::PartialList& lorisPartials, float fundamental);
+
+// convert raw Loris partials to Vutu partials, apply the cutoffs in the analysis parameters,
+// simplify, calculate stats and store the parameters used. maxThreads limits the threads used for
+// simplifying, with 0 meaning all cores.
+std::unique_ptr< VutuPartialsData > makeVutuPartials(const Loris::PartialList& lorisPartials, const AnalysisParams& p, size_t maxThreads = 0);
+
+}
@@ -0,0 +1,938 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuBatch.h"
+
+#include <map>
+#include <random>
+#include <string>
+
+#include "madronalib.h"
+#include "MLParameters.h"
+
+#include "vutu.h"
+#include "vutuProcessor.h"
+#include "vutuAnalysis.h"
+#include "vutuSampleFiles.h"
+#include "vutuSweep.h"
+#include "vutuPitch.h"
+#include "vutuThreads.h"
+#include "vutuFFT.h"
+#include "vutuSynthesizer.h"
+#include "vutuSimplify.h"
+#include "vutuExport.h"
+#include "vutuPartialsPlayer.h"
+#include "vutuInstrument.h"
+#include "vutuMidiFile.h"
+#include "vutuResidual.h"
+#include "vutuStems.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuFrameMatrix.h"
+#include "vutuCompactPartials.h"
+#include "vutuIncrementalStats.h"
+
+#include <fstream>
+
+// Loris includes
+#include "Synthesizer.h"
+
+using namespace ml;
+
+namespace
+{
+
+constexpr float kMaxSourceSeconds{60};
+
+// a batch command line: vutu <command> <file>... [--option value]...
+// an option with no value is given the value "1".
+struct BatchArgs
+{
+  std::string command;
+  std::vector< std::string > files;
+  std::map< std::string, std::string > options;
+
+  bool has(const std::string& name) const { return options.find(name) != options.end(); }
+
+  float getFloat(const std::string& name, float defaultValue) const
+  {
+    auto it = options.find(name);
+    return (it != options.end()) ? std::stof(it->second) : defaultValue;
+  }
+
+  // get a comma-separated list of values.
+  std::vector< float > getFloatList(const std::string& name) const
+  {
+    std::vector< float > r;
+    auto it = options.find(name);
+    if(it == options.end()) return r;
+    size_t start = 0;
+    const std::string& s = it->second;
+    while(start < s.size())
+    {
+      size_t end = s.find(',', start);
+      if(end == std::string::npos) end = s.size();
+      r.push_back(std::stof(s.substr(start, end - start)));
+      start = end + 1;
+    }
+    return r;
+  }
+};
+
+BatchArgs parseBatchArgs(int argc, char *argv[])
+{
+  BatchArgs args;
+  args.command = argv[1];
+  for(int i=2; i<argc; ++i)
+  {
+    std::string arg(argv[i]);
+    if(arg.rfind("--", 0) == 0)
+    {
+      std::string name = arg.substr(2);
+      bool hasValue = (i + 1 < argc) && (std::string(argv[i + 1]).rfind("--", 0) != 0);
+      args.options[name] = hasValue ? argv[++i] : "1";
+    }
+    else
+    {
+      args.files.push_back(arg);
+    }
+  }
+  return args;
+}
+
+// make a parameter tree with the default values, then set any parameters given as options.
+void setupParams(const BatchArgs& args, ParameterTree& params)
+{
+  ParameterDescriptionList pdl;
+  readParameterDescriptions(pdl);
+  buildParameterTree(pdl, params);
+  setDefaults(params);
+
+  for(const char* name : {"resolution", "window_width", "amp_floor", "freq_drift", "lo_cut", "hi_cut", "noise_width", "simplify_cents", "simplify_db", "fundamental"})
+  {
+    auto values = args.getFloatList(name);
+    if(values.size() > 0)
+    {
+      params.setFromRealValue(name, values[0]);
+    }
+  }
+}
+
+bool loadSource(const std::string& path, ml::Sample& source)
+{
+  SampleFileInfo info;
+  if(!readMonoSampleFromFile(TextFragment(path.c_str()), source, kMaxSourceSeconds, info))
+  {
+    std::cout << "could not read " << path << "\n";
+    return false;
+  }
+  normalize(source);
+  std::cout << path << ": " << info.framesRead << " frames, sr = " << info.sampleRate << (info.truncated ? " (truncated)" : "") << "\n";
+  return true;
+}
+
+int runSweep(const BatchArgs& args)
+{
+  if(args.files.size() != 1)
+  {
+    std::cout << "usage: vutu sweep <source> [--<param> v1,v2,...] [--random n] [--seed n] [--threads n]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  ml::Sample source;
+  if(!loadSource(args.files[0], source)) return 1;
+  
+  // center the sweep on the resolution and window width suited to the source's pitch, unless given
+  if(!args.has("resolution") && !args.has("window_width"))
+  {
+    PitchEstimate estimate = estimateFundamental(source, Interval{0, 1}, Interval{22, 2200});
+    std::cout << "fundamental: " << estimate.frequency << " Hz (confidence " << estimate.confidence << ")\n";
+    if(estimate.confidence >= kMinPitchConfidence)
+    {
+      params.setFromRealValue("resolution", getResolutionForFundamental(estimate.frequency));
+      params.setFromRealValue("window_width", getWindowWidthForFundamental(estimate.frequency));
+    }
+  }
+
+  AnalysisParams base = getAnalysisParams(params);
+  std::vector< AnalysisParams > points;
+
+  std::vector< Path > sweptParams{"resolution", "window_width", "freq_drift", "amp_floor", "noise_width"};
+  size_t nRandom = args.getFloat("random", 0);
+  if(nRandom > 0)
+  {
+    // random search: pick normalized values uniformly, so log parameters are sampled evenly in log space.
+    std::mt19937 rng(args.getFloat("seed", 0));
+    std::uniform_real_distribution< float > unity(0.f, 1.f);
+    for(size_t i=0; i<nRandom; ++i)
+    {
+      for(auto name : sweptParams)
+      {
+        params.setFromNormalizedValue(name, unity(rng));
+      }
+      AnalysisParams p = getAnalysisParams(params);
+      p.loCut = base.loCut;
+      p.hiCut = base.hiCut;
+      points.push_back(p);
+    }
+  }
+  else
+  {
+    SweepGrid grid;
+    grid.resolution = args.getFloatList("resolution");
+    grid.windowWidth = args.getFloatList("window_width");
+    grid.freqDrift = args.getFloatList("freq_drift");
+    grid.ampFloor = args.getFloatList("amp_floor");
+    grid.noiseWidth = args.getFloatList("noise_width");
+
+    // with no lists of values given, sweep resolution and window width around their current values.
+    bool anyLists{false};
+    for(const auto& values : {grid.resolution, grid.windowWidth, grid.freqDrift, grid.ampFloor, grid.noiseWidth})
+    {
+      anyLists |= (values.size() > 1);
+    }
+    if(!anyLists)
+    {
+      grid.resolution.clear();
+      grid.windowWidth.clear();
+      for(float ratio : {0.5f, 0.71f, 1.0f, 1.41f, 2.0f})
+      {
+        grid.resolution.push_back(base.resolution*ratio);
+        grid.windowWidth.push_back(base.windowWidth*ratio);
+      }
+    }
+    points = makeSweepGridPoints(base, grid);
+  }
+
+  auto interval = Interval{0, 1};
+  auto input = getAnalysisInput(source, interval);
+  size_t maxThreads = args.getFloat("threads", 0);
+  std::cout << "sweeping " << points.size() << " points on " << getWorkerThreadCount(maxThreads) << " threads...\n";
+
+  auto startTime = high_resolution_clock::now();
+  auto results = runAnalysisSweep(input, source.sampleRate, points, maxThreads);
+  auto endTime = high_resolution_clock::now();
+
+  printSweepResults(results, std::cout);
+  std::cout << "total time: " << duration_cast<milliseconds>(endTime - startTime).count() << " ms\n";
+  return 0;
+}
+
+// time n calls of fn in microseconds per call.
+template< typename F >
+double timeCalls(size_t n, F fn)
+{
+  auto startTime = high_resolution_clock::now();
+  for(size_t i=0; i<n; ++i)
+  {
+    fn();
+  }
+  auto endTime = high_resolution_clock::now();
+  return duration_cast<nanoseconds>(endTime - startTime).count()/(1000.0*n);
+}
+
+// render nVectors of the partials with the real-time player, and return the player's counts
+// of vectors rendered and culled.
+std::pair< size_t, size_t > renderWithPlayer(const VutuPartialsData& partials, float sampleRate, bool culling, size_t maxVoices, size_t nVectors, std::vector< float >& out)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  PartialsPlayer player;
+  player.setPartials(&partials, sampleRate);
+  player.setCulling(culling, maxVoices);
+  player.start(0.);
+  out.assign(nVectors*N, 0.f);
+  for(size_t i=0; i<nVectors; ++i)
+  {
+    DSPVector v;
+    player.processVector(v);
+    store(v, out.data() + i*N);
+  }
+  return {player.getVectorsRendered(), player.getVectorsCulled()};
+}
+
+// compare the FFT backends, and time pitch estimation, analysis and synthesis of a source.
+int runBench(const BatchArgs& args)
+{
+  if(args.files.size() != 1)
+  {
+    std::cout << "usage: vutu bench <source> [--<param> value] [--repeats n] [--threads n] [--voices n] [--budget fraction]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  ml::Sample source;
+  if(!loadSource(args.files[0], source)) return 1;
+  size_t repeats = std::max(1.f, args.getFloat("repeats", 3));
+
+  std::cout << "FFT (us per transform):\n";
+  for(size_t size : {256, 1024, 4096, 16384})
+  {
+    std::cout << "  " << size << ":";
+    for(auto backend : {FFTBackend::kScalar, getDefaultFFTBackend()})
+    {
+      FFT fft(size, backend);
+      std::vector< float > input(size), re(size), im(size);
+      for(size_t i=0; i<size; ++i)
+      {
+        input[i] = source.data.size() ? source.data[i % source.data.size()] : 0.f;
+      }
+
+      // the transform is in place, so reload the input each time to keep the values finite.
+      size_t n = std::max(size_t(16), (size_t(1) << 22)/size);
+      double us = timeCalls(n, [&]()
+      {
+        std::copy(input.begin(), input.end(), re.begin());
+        std::fill(im.begin(), im.end(), 0.f);
+        fft.forward(re.data(), im.data());
+      });
+      std::cout << " " << getFFTBackendName(backend) << " " << us;
+    }
+    std::cout << "\n";
+  }
+
+  double pitchUs = timeCalls(repeats, [&](){ estimateFundamental(source, Interval{0, 1}, Interval{22, 2200}); });
+  std::cout << "pitch estimate: " << pitchUs/1000.0 << " ms\n";
+
+  AnalysisParams p = getAnalysisParams(params);
+  auto input = getAnalysisInput(source, Interval{0, 1});
+  size_t nPartials{0};
+  double analysisUs = timeCalls(repeats, [&](){ nPartials = analyzeWithLoris(input, source.sampleRate, p, false).size(); });
+  std::cout << "analysis: " << analysisUs/1000.0 << " ms, " << nPartials << " partials\n";
+
+  // compare synthesis with Loris and with vutu. Bandwidth is removed so that the outputs
+  // can be compared sample by sample.
+  auto partials = makeVutuPartials(analyzeWithLoris(input, source.sampleRate, p, false), p);
+  for(auto& partial : partials->partials)
+  {
+    std::fill(partial.bandwidth.begin(), partial.bandwidth.end(), 0.f);
+  }
+  Loris::PartialList lorisPartials;
+  vutuToLorisPartials(*partials, lorisPartials);
+
+  std::vector< double > lorisOutput;
+  double lorisUs = timeCalls(repeats, [&]()
+  {
+    lorisOutput.clear();
+    Loris::Synthesizer::Parameters lorisParams;
+    lorisParams.sampleRate = source.sampleRate;
+    Loris::Synthesizer synth(lorisParams, lorisOutput);
+    synth.setFadeTime(0.001f);
+    synth.synthesize(lorisPartials.begin(), lorisPartials.end());
+  });
+
+  constexpr size_t N = kFloatsPerDSPVector;
+  std::vector< float > vutuOutput;
+  SynthesisParams synthParams;
+  synthParams.sampleRate = source.sampleRate;
+  synthParams.engine = SynthesisEngine::kOscillators;
+  size_t maxThreads = args.getFloat("threads", 0);
+  double vutuUs = timeCalls(repeats, [&]()
+  {
+    vutuOutput.assign(((input.size() + N - 1)/N)*N, 0.f);
+    synthesizePartials(*partials, synthParams, vutuOutput, 1);
+  });
+
+  // the threaded render should be repeatable, so check two runs against each other.
+  std::vector< float > threadedOutput, threadedOutput2;
+  double threadedUs = timeCalls(repeats, [&]()
+  {
+    threadedOutput.assign(vutuOutput.size(), 0.f);
+    synthesizePartials(*partials, synthParams, threadedOutput, maxThreads);
+  });
+  threadedOutput2.assign(vutuOutput.size(), 0.f);
+  synthesizePartials(*partials, synthParams, threadedOutput2, maxThreads);
+  bool repeatable = (threadedOutput == threadedOutput2);
+
+  double signalPower{0}, errorPower{0};
+  for(size_t i=0; i<std::min(lorisOutput.size(), vutuOutput.size()); ++i)
+  {
+    double d = vutuOutput[i] - lorisOutput[i];
+    signalPower += lorisOutput[i]*lorisOutput[i];
+    errorPower += d*d;
+  }
+  std::cout << "synthesis: Loris " << lorisUs/1000.0 << " ms, vutu " << vutuUs/1000.0 << " ms, ";
+  std::cout << "difference " << 10.0*log10(std::max(errorPower, 1e-30)/std::max(signalPower, 1e-30)) << " dB\n";
+  std::cout << "threaded synthesis: " << threadedUs/1000.0 << " ms on " << getWorkerThreadCount(maxThreads) << " threads, ";
+  std::cout << (repeatable ? "repeatable" : "NOT repeatable") << "\n";
+
+  // compare the spectral engine with the oscillator bank.
+  SynthesisParams spectralParams = synthParams;
+  spectralParams.engine = SynthesisEngine::kSpectral;
+  std::vector< float > spectralOutput;
+  double spectralUs = timeCalls(repeats, [&]()
+  {
+    spectralOutput.assign(vutuOutput.size(), 0.f);
+    synthesizePartials(*partials, spectralParams, spectralOutput, maxThreads);
+  });
+  double oscPower{0}, spectralErrorPower{0};
+  for(size_t i=0; i<vutuOutput.size(); ++i)
+  {
+    double d = spectralOutput[i] - vutuOutput[i];
+    oscPower += vutuOutput[i]*vutuOutput[i];
+    spectralErrorPower += d*d;
+  }
+  std::cout << "spectral synthesis: " << spectralUs/1000.0 << " ms, difference " << 10.0*log10(std::max(spectralErrorPower, 1e-30)/std::max(oscPower, 1e-30)) << " dB, ";
+  std::cout << partials->stats.maxActivePartials << " max. active partials, auto engine: " << getSynthesisEngineName(getSynthesisEngine(*partials, SynthesisParams())) << "\n";
+
+  // compare real-time playback with and without culling of masked partials.
+  size_t nVectors = vutuOutput.size()/N;
+  size_t maxVoices = args.getFloat("voices", 0);
+  std::vector< float > fullOutput, culledOutput;
+  std::pair< size_t, size_t > fullCounts, culledCounts;
+  double fullUs = timeCalls(repeats, [&](){ fullCounts = renderWithPlayer(*partials, source.sampleRate, false, 0, nVectors, fullOutput); });
+  double culledUs = timeCalls(repeats, [&](){ culledCounts = renderWithPlayer(*partials, source.sampleRate, true, maxVoices, nVectors, culledOutput); });
+  double fullPower{0}, cullErrorPower{0};
+  for(size_t i=0; i<fullOutput.size(); ++i)
+  {
+    double d = culledOutput[i] - fullOutput[i];
+    fullPower += fullOutput[i]*fullOutput[i];
+    cullErrorPower += d*d;
+  }
+  size_t totalVectors = culledCounts.first + culledCounts.second;
+  std::cout << "playback: " << fullUs/1000.0 << " ms, culled " << culledUs/1000.0 << " ms";
+  if(maxVoices) std::cout << " (max " << maxVoices << " voices)";
+  std::cout << ", " << (totalVectors ? 100.0*culledCounts.second/totalVectors : 0.0) << "% of partial vectors culled, ";
+  std::cout << "error " << 10.0*log10(std::max(cullErrorPower, 1e-30)/std::max(fullPower, 1e-30)) << " dB\n";
+
+  // time making the frame matrix and playing it.
+  std::shared_ptr< const FrameMatrix > pFrames;
+  double framesUs = timeCalls(repeats, [&](){ pFrames = makeFrameMatrix(*partials, kDefaultFrameHop, maxThreads); });
+  FrameMatrixPlayer framePlayer;
+  framePlayer.setFrameMatrix(pFrames, source.sampleRate);
+  double framePlayUs = timeCalls(repeats, [&]()
+  {
+    framePlayer.start(0.);
+    for(size_t i=0; i<nVectors; ++i)
+    {
+      DSPVector v;
+      framePlayer.processVector(v);
+    }
+  });
+  std::cout << "frame matrix: made in " << framesUs/1000.0 << " ms, " << pFrames->nFrames << " frames of " << pFrames->nVoices << " voices, ";
+  std::cout << pFrames->getBytes()/1024 << " KiB; playback " << framePlayUs/1000.0 << " ms\n";
+
+  // compare the memory used by compact partials, and their synthesis with the full partials.
+  size_t fullBytes{0};
+  for(const auto& partial : partials->partials)
+  {
+    fullBytes += partial.time.size()*5*sizeof(float);
+  }
+  CompactPartials compact, compactNoPhase;
+  double compactUs = timeCalls(repeats, [&](){ compact.compact(*partials, true, maxThreads); });
+  compactNoPhase.compact(*partials, false, maxThreads);
+  std::vector< float > compactOutput(vutuOutput.size(), 0.f);
+  synthesizePartials(compact, synthParams, compactOutput, maxThreads);
+  double compactErrorPower{0};
+  for(size_t i=0; i<vutuOutput.size(); ++i)
+  {
+    double d = compactOutput[i] - vutuOutput[i];
+    compactErrorPower += d*d;
+  }
+  std::cout << "compact partials: " << compact.getBytes()/1024 << " KiB, " << compactNoPhase.getBytes()/1024 << " KiB without phase, ";
+  std::cout << "full " << fullBytes/1024 << " KiB; made in " << compactUs/1000.0 << " ms, ";
+  std::cout << "synthesis difference " << 10.0*log10(std::max(compactErrorPower, 1e-30)/std::max(oscPower, 1e-30)) << " dB\n";
+
+  // edit a copy of the partials while keeping its stats with IncrementalStats, then check
+  // them against calcStats() on the edited partials. The edits cycle through removing a
+  // partial, trimming the last breakpoint from one, and adding a copy of one later in time.
+  VutuPartialsData edited;
+  copyPartialsInfo(*partials, edited);
+  edited.partials = partials->partials;
+  IncrementalStats incremental;
+  double incrementalBuildUs = timeCalls(1, [&](){ incremental.build(edited); });
+  std::mt19937 editRng(1);
+  size_t nEdits = std::min(edited.partials.size(), size_t(1024));
+  size_t editCount{0};
+  double editUs = timeCalls(std::max(nEdits, size_t(1)), [&]()
+  {
+    if(edited.partials.empty()) return;
+    size_t i = editRng() % edited.partials.size();
+    switch(editCount++ % 3)
+    {
+      case 0:
+        incremental.removePartial(edited, i);
+        break;
+      case 1:
+      {
+        VutuPartial trimmed = edited.partials[i];
+        if(trimmed.time.size() > 1)
+        {
+          for(auto pv : {&trimmed.time, &trimmed.freq, &trimmed.amp, &trimmed.bandwidth, &trimmed.phase})
+          {
+            pv->pop_back();
+          }
+        }
+        incremental.replacePartial(edited, i, std::move(trimmed));
+        break;
+      }
+      default:
+      {
+        VutuPartial later = edited.partials[i];
+        for(auto& t : later.time)
+        {
+          t += 0.1f;
+        }
+        incremental.addPartial(edited, std::move(later));
+        break;
+      }
+    }
+  });
+  PartialsStats incrementalStats = edited.stats;
+  calcStats(edited);
+  const PartialsStats& exactStats = edited.stats;
+  auto sameRange = [](Interval a, Interval b){ return (a.mX1 == b.mX1) && (a.mX2 == b.mX2); };
+  bool rangesMatch = sameRange(incrementalStats.timeRange, exactStats.timeRange) && sameRange(incrementalStats.ampRange, exactStats.ampRange) &&
+    sameRange(incrementalStats.bandwidthRange, exactStats.bandwidthRange) && sameRange(incrementalStats.freqRange, exactStats.freqRange);
+  bool summariesMatch = (incrementalStats.summaries.size() == exactStats.summaries.size());
+  for(size_t i=0; summariesMatch && (i<exactStats.summaries.size()); ++i)
+  {
+    summariesMatch = (incrementalStats.summaries.meanFreq[i] == exactStats.summaries.meanFreq[i]) &&
+      (incrementalStats.summaries.energy[i] == exactStats.summaries.energy[i]) &&
+      (incrementalStats.summaries.nBreakpoints[i] == exactStats.summaries.nBreakpoints[i]);
+  }
+  std::cout << "incremental stats: built in " << incrementalBuildUs/1000.0 << " ms, " << editUs << " us per edit over " << nEdits << " edits; ";
+  std::cout << "ranges " << (rangesMatch ? "match" : "DIFFER") << ", summaries " << (summariesMatch ? "match" : "DIFFER") << ", ";
+  std::cout << "max. active partials " << incrementalStats.maxActivePartials << " (calcStats " << exactStats.maxActivePartials << ")\n";
+
+  // find how many partials the player can run in the budget, and how long the analysis has
+  // more active partials than that.
+  float budget = args.getFloat("budget", 0.5f);
+  const auto& timeline = partials->stats.polyphony;
+  double usPerPartialSecond = fullUs/std::max(double(fullCounts.first)*N/source.sampleRate, 1e-9);
+  size_t partialsInBudget = size_t(budget*1e6/std::max(usPerPartialSecond, 1e-3));
+  float timeOver = timeline.getTimeAbove(partialsInBudget);
+  std::cout << "active partials: median " << timeline.median << ", 90% " << timeline.p90 << ", 99% " << timeline.p99;
+  std::cout << ", max " << partials->stats.maxActivePartials << "; " << partialsInBudget << " fit in " << budget*100.f << "% of one core";
+  if(timeOver > 0.f)
+  {
+    std::cout << ", over budget for " << timeOver << " s";
+  }
+  std::cout << "\n";
+
+  // time the instrument with a chord held for the length of the partials, and find how many
+  // note voices fit in the given fraction of one core.
+  constexpr size_t kBenchNotes{8};
+  PartialsInstrument instrument;
+  instrument.setPartials(partials.get(), source.sampleRate, kBenchNotes);
+  std::vector< NoteEvent > chord;
+  for(size_t i=0; i<kBenchNotes; ++i)
+  {
+    chord.push_back(NoteEvent{0., int(std::lround(instrument.getReferenceNote())) + int(i) - int(kBenchNotes/2), 1.f});
+  }
+  std::vector< float > instrumentOutput;
+  double instrumentUs = timeCalls(repeats, [&]()
+  {
+    instrumentOutput.assign(nVectors*N, 0.f);
+    renderNoteEvents(instrument, chord, instrumentOutput);
+    instrument.allNotesOff();
+  });
+  double usPerVoiceSecond = instrumentUs/(kBenchNotes*double(nVectors*N)/source.sampleRate);
+  std::cout << "instrument: " << usPerVoiceSecond/1000.0 << " ms per voice-second, ";
+  std::cout << size_t(budget*1e6/std::max(usPerVoiceSecond, 1e-3)) << " voices fit in " << budget*100.f << "% of one core\n";
+  return 0;
+}
+
+// read partials from a .utu file, or make them by analyzing a sound file.
+std::unique_ptr< VutuPartialsData > loadPartials(const std::string& inPath, const AnalysisParams& p)
+{
+  std::unique_ptr< VutuPartialsData > partials;
+  if(inPath.size() >= 4 && inPath.substr(inPath.size() - 4) == ".utu")
+  {
+    File partialsFile(Path(inPath.c_str()));
+    partials.reset(loadVutuPartialsFromFile(partialsFile));
+    if(!partials)
+    {
+      std::cout << "could not read " << inPath << "\n";
+      return nullptr;
+    }
+    simplifyPartials(*partials, p.simplify);
+    calcStats(*partials);
+  }
+  else
+  {
+    ml::Sample source;
+    if(!loadSource(inPath, source)) return nullptr;
+    auto input = getAnalysisInput(source, Interval{0, 1});
+    partials = makeVutuPartials(analyzeWithLoris(input, source.sampleRate, p, false), p);
+    partials->sourceDuration = float(getFrames(source))/source.sampleRate;
+  }
+  return partials;
+}
+
+// get the pipeline of partial operations given by the options. The filters test the partials
+// before the transforms are applied.
+PartialsPipeline makePipeline(const BatchArgs& args, const VutuPartialsData& partials)
+{
+  PartialsPipeline pipeline;
+  auto band = args.getFloatList("band");
+  if(band.size() == 2)
+  {
+    pipeline.keepBand(Interval{band[0], band[1]});
+  }
+  if(args.has("min_duration"))
+  {
+    pipeline.keepMinDuration(args.getFloat("min_duration", 0));
+  }
+  if(args.has("min_amp"))
+  {
+    pipeline.keepMinAmp(dBToAmp(args.getFloat("min_amp", -96)));
+  }
+  if(args.has("harmonics"))
+  {
+    pipeline.keepHarmonics(args.getFloat("fundamental", partials.fundamental));
+  }
+  pipeline.transpose(std::exp2(args.getFloat("transpose", 0)/12.f));
+  pipeline.scaleTime(args.getFloat("time_scale", 1));
+  pipeline.scaleAmp(dBToAmp(args.getFloat("gain", 0)));
+  return pipeline;
+}
+
+// render the partials from a .utu file, or from an analysis of a sound file, to a sound file.
+int runRender(const BatchArgs& args)
+{
+  if(args.files.size() != 2)
+  {
+    std::cout << "usage: vutu render <source or partials> <output.wav|.aiff> [--<param> value] [--bits 16|24|32] [--rate r] [--channels n] [--no_dither] [--no_normalize] [--compact]\n";
+    std::cout << "    [--band lo,hi] [--min_duration s] [--min_amp dB] [--harmonics] [--transpose semitones] [--time_scale r] [--gain dB]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  AnalysisParams p = getAnalysisParams(params);
+
+  auto partials = loadPartials(args.files[0], p);
+  if(!partials) return 1;
+
+  ExportParams exportParams;
+  TextFragment outPath(args.files[1].c_str());
+  exportParams.format.aiff = isAIFFPath(outPath);
+  exportParams.format.bitDepth = args.getFloat("bits", 24);
+  exportParams.format.sampleRate = args.getFloat("rate", kSampleRate);
+  exportParams.format.channels = args.getFloat("channels", 1);
+  exportParams.format.dither = !args.has("no_dither");
+  exportParams.normalize = !args.has("no_normalize");
+  exportParams.pipeline = makePipeline(args, *partials);
+  exportParams.duration = partials->sourceDuration*exportParams.pipeline.getTimeScale();
+
+  // with --compact, the partials are kept in their compact form while rendering, for
+  // analyses too long to hold in memory in full.
+  CompactPartials compact;
+  bool useCompact = args.has("compact");
+  size_t nPartials = partials->partials.size();
+  if(useCompact)
+  {
+    compact.compact(*partials, true);
+    partials.reset();
+    std::cout << "compact partials: " << compact.getBytes()/(1024*1024) << " MB\n";
+  }
+
+  std::cout << "rendering " << nPartials << " partials, " << exportParams.duration << " s...\n";
+  int prevPercent{-1};
+  auto progress = [&](float done)
+  {
+    int percent = done*100;
+    if(percent/10 != prevPercent/10)
+    {
+      std::cout << "  " << percent << "%\n";
+    }
+    prevPercent = percent;
+    return true;
+  };
+
+  auto startTime = high_resolution_clock::now();
+  auto result = useCompact ? exportPartialsToFile(compact, outPath, exportParams, progress) : exportPartialsToFile(*partials, outPath, exportParams, progress);
+  auto endTime = high_resolution_clock::now();
+  if(result != ExportResult::kOK)
+  {
+    std::cout << "could not write " << args.files[1] << "\n";
+    return 1;
+  }
+  std::cout << "wrote " << args.files[1] << " in " << duration_cast<milliseconds>(endTime - startTime).count() << " ms\n";
+  return 0;
+}
+
+
+// analyze a source, resynthesize it at the source rate, and print the SNR of the residual
+// overall and in each octave band. The residual can be written to a sound file.
+int runResidual(const BatchArgs& args)
+{
+  if(args.files.size() != 1)
+  {
+    std::cout << "usage: vutu residual <source> [--<param> value] [--out residual.wav|.aiff]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  AnalysisParams p = getAnalysisParams(params);
+  ml::Sample source;
+  if(!loadSource(args.files[0], source)) return 1;
+  auto input = getAnalysisInput(source, Interval{0, 1});
+  auto partials = makeVutuPartials(analyzeWithLoris(input, source.sampleRate, p, false), p);
+
+  constexpr size_t N = kFloatsPerDSPVector;
+  SynthesisParams synthParams;
+  synthParams.sampleRate = source.sampleRate;
+  std::vector< float > synth(((input.size() + N - 1)/N)*N);
+  synthesizePartials(*partials, synthParams, synth);
+  std::vector< float > sourceFloats(input.begin(), input.end());
+  ResidualStats stats = measureResidual(sourceFloats, synth, source.sampleRate);
+
+  std::cout << partials->partials.size() << " partials, SNR " << stats.snr << " dB, gain " << stats.gain << "\n";
+  for(const auto& b : stats.bands)
+  {
+    std::cout << "  " << b.freqRange.mX1 << " - " << b.freqRange.mX2 << " Hz: level " << b.level << " dB, SNR " << b.snr << " dB\n";
+  }
+
+  if(args.has("out"))
+  {
+    ml::Sample residual;
+    makeResidual(sourceFloats, synth, stats.gain, source.sampleRate, residual);
+    SoundFileFormat format;
+    TextFragment outPath(args.options.at("out").c_str());
+    format.aiff = isAIFFPath(outPath);
+    format.sampleRate = source.sampleRate;
+    if(!writeMonoSampleToFile(outPath, residual, format))
+    {
+      std::cout << "could not write " << args.options.at("out") << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// render stems of the partials in one pass, to the channels of one sound file or to one file
+// per stem. The stems are normalized together, so they still sum to the full render.
+int runStems(const BatchArgs& args)
+{
+  if(args.files.size() != 2)
+  {
+    std::cout << "usage: vutu stems <source or partials> <output.wav|.aiff> [--<param> value] [--bands f1,f2,...] [--separate] [--bits 16|24|32] [--rate r] [--no_dither] [--no_normalize]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  auto partials = loadPartials(args.files[0], getAnalysisParams(params));
+  if(!partials) return 1;
+
+  StemLayout layout;
+  auto bands = args.getFloatList("bands");
+  if(bands.size() > 0)
+  {
+    layout = makeBandStems(*partials, bands);
+  }
+  else
+  {
+    float fundamental = args.has("fundamental") ? params.getRealFloatValue("fundamental") : partials->fundamental;
+    layout = makeHarmonicStems(*partials, fundamental);
+  }
+
+  SoundFileFormat format;
+  std::string outPath = args.files[1];
+  format.aiff = isAIFFPath(TextFragment(outPath.c_str()));
+  format.bitDepth = args.getFloat("bits", 24);
+  format.sampleRate = args.getFloat("rate", kSampleRate);
+  format.dither = !args.has("no_dither");
+
+  constexpr size_t N = kFloatsPerDSPVector;
+  SynthesisParams synthParams;
+  synthParams.sampleRate = format.sampleRate;
+  size_t nFrames = size_t(partials->sourceDuration*format.sampleRate);
+  std::vector< std::vector< float > > stems(layout.size(), std::vector< float >(((nFrames + N - 1)/N)*N));
+
+  std::cout << "rendering " << partials->partials.size() << " partials to " << layout.size() << " stems...\n";
+  auto startTime = high_resolution_clock::now();
+  synthesizeStems(*partials, layout, synthParams, stems);
+  auto endTime = high_resolution_clock::now();
+
+  float peak{0.f};
+  for(const auto& stem : stems)
+  {
+    for(float x : stem)
+    {
+      peak = std::max(peak, std::fabs(x));
+    }
+  }
+  float scale = (!args.has("no_normalize") && (peak > 0.f)) ? 1.f/peak : 1.f;
+  for(auto& stem : stems)
+  {
+    for(float& x : stem)
+    {
+      x *= scale;
+    }
+  }
+
+  auto writeFile = [&](const std::string& path, const std::vector< const float* >& sources)
+  {
+    format.channels = sources.size();
+    SoundFileWriter writer;
+    bool ok = writer.open(TextFragment(path.c_str()), format) && writer.writeChannels(sources, nFrames);
+    std::cout << (ok ? "wrote " : "could not write ") << path << "\n";
+    return ok;
+  };
+
+  bool ok{true};
+  if(args.has("separate"))
+  {
+    auto dot = outPath.rfind('.');
+    std::string base = outPath.substr(0, dot);
+    std::string ext = (dot != std::string::npos) ? outPath.substr(dot) : ".wav";
+    for(size_t s=0; s<layout.size(); ++s)
+    {
+      ok &= writeFile(base + "-" + layout.names[s] + ext, {stems[s].data()});
+    }
+  }
+  else
+  {
+    std::vector< const float* > sources;
+    for(size_t s=0; s<layout.size(); ++s)
+    {
+      std::cout << "  channel " << s + 1 << ": " << layout.names[s] << "\n";
+      sources.push_back(stems[s].data());
+    }
+    ok = writeFile(outPath, sources);
+  }
+  std::cout << "rendered in " << duration_cast<milliseconds>(endTime - startTime).count() << " ms\n";
+  return ok ? 0 : 1;
+}
+
+// write the frame matrix of the partials to a file.
+int runFrames(const BatchArgs& args)
+{
+  if(args.files.size() != 2)
+  {
+    std::cout << "usage: vutu frames <source or partials> <output.vfm> [--<param> value] [--hop seconds]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  auto partials = loadPartials(args.files[0], getAnalysisParams(params));
+  if(!partials) return 1;
+
+  float hop = args.getFloat("hop", kDefaultFrameHop);
+  if(!(hop > 0.f))
+  {
+    std::cout << "hop must be positive\n";
+    return 1;
+  }
+  auto startTime = high_resolution_clock::now();
+  auto pFrames = makeFrameMatrix(*partials, hop);
+  auto endTime = high_resolution_clock::now();
+
+  std::ofstream out(args.files[1], std::ios::binary);
+  if(!out || !writeFrameMatrix(*pFrames, out))
+  {
+    std::cout << "could not write " << args.files[1] << "\n";
+    return 1;
+  }
+  std::cout << "wrote " << args.files[1] << ": " << pFrames->nFrames << " frames of " << pFrames->nVoices << " voices from ";
+  std::cout << partials->partials.size() << " partials, made in " << duration_cast<milliseconds>(endTime - startTime).count() << " ms\n";
+  return 0;
+}
+
+// play the partials as an instrument with the notes of a MIDI file, and write the result to
+// a sound file.
+int runPlay(const BatchArgs& args)
+{
+  if(args.files.size() != 3)
+  {
+    std::cout << "usage: vutu play <source or partials> <notes.mid> <output.wav|.aiff> [--<param> value] [--voices n] [--bits 16|24|32] [--rate r] [--no_dither] [--no_normalize]\n";
+    return 1;
+  }
+
+  ParameterTree params;
+  setupParams(args, params);
+  auto partials = loadPartials(args.files[0], getAnalysisParams(params));
+  if(!partials) return 1;
+
+  std::vector< NoteEvent > events;
+  if(!readNoteEventsFromMidiFile(TextFragment(args.files[1].c_str()), events))
+  {
+    std::cout << "could not read " << args.files[1] << "\n";
+    return 1;
+  }
+
+  SoundFileFormat format;
+  TextFragment outPath(args.files[2].c_str());
+  format.aiff = isAIFFPath(outPath);
+  format.bitDepth = args.getFloat("bits", 24);
+  format.sampleRate = args.getFloat("rate", kSampleRate);
+  format.dither = !args.has("no_dither");
+
+  PartialsInstrument instrument;
+  instrument.setPartials(partials.get(), format.sampleRate, args.getFloat("voices", PartialsInstrument::kDefaultVoices));
+
+  // leave time for the last note to play all of the partials.
+  constexpr size_t N = kFloatsPerDSPVector;
+  double duration = (events.size() ? events.back().time : 0.) + partials->stats.timeRange.mX2 + 0.1;
+  size_t nVectors = size_t(std::ceil(duration*format.sampleRate/N));
+  std::cout << "playing " << events.size() << " note events on " << partials->partials.size() << " partials, reference note " << instrument.getReferenceNote() << "\n";
+
+  ml::Sample output;
+  output.sampleRate = format.sampleRate;
+  output.data.assign(nVectors*N, 0.f);
+  auto startTime = high_resolution_clock::now();
+  renderNoteEvents(instrument, events, output.data);
+  auto endTime = high_resolution_clock::now();
+  if(!args.has("no_normalize"))
+  {
+    normalize(output);
+  }
+
+  if(!writeMonoSampleToFile(outPath, output, format))
+  {
+    std::cout << "could not write " << args.files[2] << "\n";
+    return 1;
+  }
+  std::cout << "wrote " << args.files[2] << ", " << duration << " s rendered in " << duration_cast<milliseconds>(endTime - startTime).count() << " ms\n";
+  return 0;
+}
+
+}
+
+bool ml::isBatchCommand(int argc, char *argv[])
+{
+  if(argc < 2) return false;
+  std::string command(argv[1]);
+  return (command == "sweep") || (command == "bench") || (command == "render") || (command == "play") || (command == "residual") || (command == "stems") || (command == "frames");
+}
+
+int ml::runBatchCommand(int argc, char *argv[])
+{
+  BatchArgs args = parseBatchArgs(argc, argv);
+  if(args.command == "sweep")
+  {
+    return runSweep(args);
+  }
+  else if(args.command == "bench")
+  {
+    return runBench(args);
+  }
+  else if(args.command == "render")
+  {
+    return runRender(args);
+  }
+  else if(args.command == "play")
+  {
+    return runPlay(args);
+  }
+  else if(args.command == "residual")
+  {
+    return runResidual(args);
+  }
+  else if(args.command == "stems")
+  {
+    return runStems(args);
+  }
+  else if(args.command == "frames")
+  {
+    return runFrames(args);
+  }
+  return 1;
+}
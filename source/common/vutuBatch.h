@@ -0,0 +1,18 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+// command-line batch jobs, run without the GUI.
+
+namespace ml
+{
+
+// return true if the command line asks for a batch job.
+bool isBatchCommand(int argc, char *argv[]);
+
+// run the batch job on the command line and return the process exit code.
+int runBatchCommand(int argc, char *argv[]);
+
+}
@@ -0,0 +1,444 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuCompactPartials.h"
+#include "vutuThreads.h"
+#include "vutuSpectralSynthesis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr float kCompactMinDb{-192.f};
+constexpr float kCompactAmpStepsPerDb{256.f};
+constexpr float kCompactMinFreq{4.f};
+constexpr float kCompactFreqStepsPerOctave{4.f*1200.f};
+constexpr uint32_t kMaxTimeDelta{0xFFFF};
+constexpr double kTwoPi{6.283185307179586};
+
+// partials per job when compacting or expanding in parallel.
+constexpr size_t kCompactPartialsPerJob{256};
+
+// DSPVectors of output rendered at once.
+constexpr size_t kCompactBlockVectors{4096};
+
+inline uint16_t quantize(float x)
+{
+  return uint16_t(clamp(std::lround(x), 0L, 65535L));
+}
+
+inline uint16_t ampToCode(float amp)
+{
+  if(!(amp > 0.f)) return 0;
+  float steps = (20.f*log10f(amp) - kCompactMinDb)*kCompactAmpStepsPerDb;
+  return std::max(quantize(steps), uint16_t(1));
+}
+
+inline float codeToAmp(uint16_t code)
+{
+  if(!code) return 0.f;
+  return std::pow(10.f, (code/kCompactAmpStepsPerDb + kCompactMinDb)/20.f);
+}
+
+inline uint16_t freqToCode(float freq)
+{
+  if(!(freq > 0.f)) return 0;
+  float steps = std::log2(std::max(freq, kCompactMinFreq)/kCompactMinFreq)*kCompactFreqStepsPerOctave;
+  return std::max(quantize(steps + 1.f), uint16_t(1));
+}
+
+inline float codeToFreq(uint16_t code)
+{
+  if(!code) return 0.f;
+  return kCompactMinFreq*std::exp2((code - 1)/kCompactFreqStepsPerOctave);
+}
+
+inline uint16_t phaseToCode(float phase)
+{
+  double cycles = phase/kTwoPi;
+  cycles -= std::floor(cycles);
+  return uint16_t(uint32_t(std::lround(cycles*65536.)) & 0xFFFF);
+}
+
+// phases are returned in [-pi, pi), as Loris keeps them.
+inline float codeToPhase(uint16_t code)
+{
+  double cycles = code/65536.;
+  if(cycles >= 0.5) cycles -= 1.;
+  return float(cycles*kTwoPi);
+}
+
+inline uint32_t timeToTick(float t)
+{
+  return uint32_t(std::max(std::llround(t/kCompactTimeTick), 0LL));
+}
+
+// get the number of ticks from each breakpoint of p to the next, at least 1 so that times
+// stay increasing.
+void getTimeDeltas(const VutuPartial& p, std::vector< uint32_t >& deltas)
+{
+  deltas.clear();
+  uint32_t prevTick = p.time.size() ? timeToTick(p.time[0]) : 0;
+  for(size_t j=1; j<p.time.size(); ++j)
+  {
+    uint32_t tick = std::max(timeToTick(p.time[j]), prevTick + 1);
+    deltas.push_back(tick - prevTick);
+    prevTick = tick;
+  }
+}
+
+// get the number of breakpoints stored for the deltas, including any added to split gaps
+// too long for one delta.
+size_t getStoredBreakpoints(const std::vector< uint32_t >& deltas)
+{
+  size_t n = deltas.size() + 1;
+  for(uint32_t d : deltas)
+  {
+    n += (d - 1)/kMaxTimeDelta;
+  }
+  return n;
+}
+
+}
+
+uint16_t ml::floatToHalf(float x)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &x, 4);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t absBits = bits & 0x7FFFFFFF;
+
+  // NaN and infinity
+  if(absBits >= 0x7F800000) return sign | 0x7C00 | ((absBits > 0x7F800000) ? 0x200 : 0);
+
+  // too large becomes infinity
+  if(absBits >= 0x477FF000) return sign | 0x7C00;
+
+  // subnormal halves, including zero
+  if(absBits < 0x38800000)
+  {
+    float a;
+    std::memcpy(&a, &absBits, 4);
+    return sign | uint16_t(std::nearbyint(a*16777216.f));
+  }
+
+  // normal halves, rounding the dropped mantissa bits to nearest even
+  uint32_t h = ((absBits - 0x38000000) >> 13);
+  uint32_t rest = absBits & 0x1FFF;
+  if((rest > 0x1000) || ((rest == 0x1000) && (h & 1))) h++;
+  return sign | uint16_t(h);
+}
+
+float ml::halfToFloat(uint16_t h)
+{
+  uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1F;
+  uint32_t mantissa = h & 0x3FF;
+  uint32_t bits;
+  if(exponent == 0)
+  {
+    float a = mantissa*(1.f/16777216.f);
+    std::memcpy(&bits, &a, 4);
+    bits |= sign;
+  }
+  else if(exponent == 0x1F)
+  {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  }
+  else
+  {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float x;
+  std::memcpy(&x, &bits, 4);
+  return x;
+}
+
+void CompactPartials::compact(const VutuPartialsData& partialsData, bool keepPhase, size_t maxThreads)
+{
+  const auto& d = partialsData;
+  _info = VutuPartialsData();
+  copyPartialsInfo(d, _info);
+  _info.stats.timeRange = d.stats.timeRange;
+  _info.stats.ampRange = d.stats.ampRange;
+  _info.stats.bandwidthRange = d.stats.bandwidthRange;
+  _info.stats.freqRange = d.stats.freqRange;
+  _info.stats.nPartials = d.stats.nPartials;
+  _info.stats.maxActivePartials = d.stats.maxActivePartials;
+  _info.stats.maxActiveTime = d.stats.maxActiveTime;
+
+  // count the breakpoints of each partial, then store them at their offsets.
+  const size_t nPartials = d.partials.size();
+  const size_t nJobs = (nPartials + kCompactPartialsPerJob - 1)/kCompactPartialsPerJob;
+  _partialStart.assign(nPartials + 1, 0);
+  parallelFor(nJobs, [&](size_t job)
+  {
+    std::vector< uint32_t > deltas;
+    size_t end = std::min(nPartials, (job + 1)*kCompactPartialsPerJob);
+    for(size_t i=job*kCompactPartialsPerJob; i<end; ++i)
+    {
+      const VutuPartial& p = d.partials[i];
+      getTimeDeltas(p, deltas);
+      _partialStart[i + 1] = p.time.size() ? uint32_t(getStoredBreakpoints(deltas)) : 0;
+    }
+  }, maxThreads);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    _partialStart[i + 1] += _partialStart[i];
+  }
+
+  const size_t nBreakpoints = _partialStart[nPartials];
+  _startTick.assign(nPartials, 0);
+  _timeDelta.assign(nBreakpoints, 0);
+  _amp.assign(nBreakpoints, 0);
+  _freq.assign(nBreakpoints, 0);
+  _bandwidth.assign(nBreakpoints, 0);
+  _phase.assign(keepPhase ? nBreakpoints : 0, 0);
+  _timeDelta.shrink_to_fit();
+  _amp.shrink_to_fit();
+  _freq.shrink_to_fit();
+  _bandwidth.shrink_to_fit();
+  _phase.shrink_to_fit();
+
+  parallelFor(nJobs, [&](size_t job)
+  {
+    std::vector< uint32_t > deltas;
+    size_t end = std::min(nPartials, (job + 1)*kCompactPartialsPerJob);
+    for(size_t i=job*kCompactPartialsPerJob; i<end; ++i)
+    {
+      const VutuPartial& p = d.partials[i];
+      if(!p.time.size()) continue;
+      getTimeDeltas(p, deltas);
+      _startTick[i] = timeToTick(p.time[0]);
+
+      size_t k = _partialStart[i];
+      auto store = [&](uint32_t delta, float amp, float freq, float bandwidth, float phase)
+      {
+        _timeDelta[k] = uint16_t(delta);
+        _amp[k] = ampToCode(amp);
+        _freq[k] = freqToCode(freq);
+        _bandwidth[k] = floatToHalf(bandwidth);
+        if(keepPhase) _phase[k] = phaseToCode(phase);
+        k++;
+      };
+      store(0, p.amp[0], p.freq[0], p.bandwidth[0], p.phase[0]);
+      for(size_t j=1; j<p.time.size(); ++j)
+      {
+        // split gaps too long for one delta with interpolated breakpoints.
+        uint32_t delta = deltas[j - 1];
+        for(uint32_t t=kMaxTimeDelta; t<delta; t+=kMaxTimeDelta)
+        {
+          float x = float(t)/delta;
+          store(kMaxTimeDelta, lerp(p.amp[j - 1], p.amp[j], x), lerp(p.freq[j - 1], p.freq[j], x),
+                lerp(p.bandwidth[j - 1], p.bandwidth[j], x), p.phase[j - 1]);
+        }
+        store((delta - 1) % kMaxTimeDelta + 1, p.amp[j], p.freq[j], p.bandwidth[j], p.phase[j]);
+      }
+    }
+  }, maxThreads);
+}
+
+size_t CompactPartials::getBytes() const
+{
+  size_t shorts = _timeDelta.size() + _amp.size() + _freq.size() + _bandwidth.size() + _phase.size();
+  return shorts*sizeof(uint16_t) + (_partialStart.size() + _startTick.size())*sizeof(uint32_t);
+}
+
+void CompactPartials::getPartial(size_t i, VutuPartial& p) const
+{
+  const size_t k0 = _partialStart[i];
+  const size_t n = _partialStart[i + 1] - k0;
+  for(auto pv : {&p.time, &p.amp, &p.freq, &p.bandwidth, &p.phase})
+  {
+    pv->resize(n);
+  }
+
+  uint64_t tick = _startTick[i];
+  for(size_t j=0; j<n; ++j)
+  {
+    size_t k = k0 + j;
+    tick += _timeDelta[k];
+    p.time[j] = float(tick*kCompactTimeTick);
+    p.amp[j] = codeToAmp(_amp[k]);
+    p.freq[j] = codeToFreq(_freq[k]);
+    p.bandwidth[j] = halfToFloat(_bandwidth[k]);
+  }
+
+  if(hasPhase())
+  {
+    for(size_t j=0; j<n; ++j)
+    {
+      p.phase[j] = codeToPhase(_phase[k0 + j]);
+    }
+  }
+  else
+  {
+    // the frequency is linear between breakpoints, so the trapezoid rule gives the phase.
+    double cycles{0};
+    for(size_t j=0; j<n; ++j)
+    {
+      if(j > 0)
+      {
+        cycles += 0.5*(double(p.freq[j - 1]) + double(p.freq[j]))*(double(p.time[j]) - double(p.time[j - 1]));
+        cycles -= std::floor(cycles);
+      }
+      p.phase[j] = float(((cycles >= 0.5) ? cycles - 1. : cycles)*kTwoPi);
+    }
+  }
+}
+
+Interval CompactPartials::getTimeRange(size_t i) const
+{
+  // a partial with no breakpoints has the empty range that calcStats() starts from.
+  if(_partialStart[i] == _partialStart[i + 1]) return Interval{std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
+
+  uint64_t tick = _startTick[i];
+  uint64_t startTick = tick + _timeDelta[_partialStart[i]];
+  for(size_t k=_partialStart[i]; k<_partialStart[i + 1]; ++k)
+  {
+    tick += _timeDelta[k];
+  }
+  return Interval{float(startTick*kCompactTimeTick), float(tick*kCompactTimeTick)};
+}
+
+void CompactPartials::expand(VutuPartialsData& out, size_t maxThreads) const
+{
+  out = _info;
+  const size_t nPartials = size();
+  out.partials.resize(nPartials);
+  const size_t nJobs = (nPartials + kCompactPartialsPerJob - 1)/kCompactPartialsPerJob;
+  parallelFor(nJobs, [&](size_t job)
+  {
+    size_t end = std::min(nPartials, (job + 1)*kCompactPartialsPerJob);
+    for(size_t i=job*kCompactPartialsPerJob; i<end; ++i)
+    {
+      getPartial(i, out.partials[i]);
+    }
+  }, maxThreads);
+  calcStats(out);
+}
+
+void ml::synthesizePartials(const CompactPartials& partials, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads)
+{
+  synthesizePartials(partials, params, PartialsPipeline(), 0, out, maxThreads);
+}
+
+void ml::synthesizePartials(const CompactPartials& partials, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads)
+{
+  CompactPartialsRenderer renderer(partials, params, pipeline, maxThreads);
+  renderer.render(startVector, out);
+}
+
+CompactPartialsRenderer::CompactPartialsRenderer(const CompactPartials& partials, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t maxThreads) :
+  _partials(partials), _params(params), _maxThreads(maxThreads)
+{
+  const size_t nPartials = partials.size();
+
+  // choose the engine for the whole set, not for each block.
+  _params.engine = getSynthesisEngine(partials.getInfo(), params);
+  _block.stats.maxActivePartials = partials.getInfo().stats.maxActivePartials;
+
+  // the time each partial sounds in the output, with its fades. Partials the filters drop
+  // get an empty extent, so the filters are tested once for each partial, not for each block.
+  const float timeScale = pipeline.getTimeScale();
+  const Interval kNoExtent{std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
+  _extents.resize(nPartials);
+  parallelForChunks(nPartials, getWorkerThreadCount(maxThreads), [&](size_t, size_t begin, size_t end)
+  {
+    VutuPartial p;
+    for(size_t i=begin; i<end; ++i)
+    {
+      Interval r = partials.getTimeRange(i);
+      if(r.mX1 > r.mX2)
+      {
+        _extents[i] = kNoExtent;
+        continue;
+      }
+      if(pipeline.hasFilters())
+      {
+        partials.getPartial(i, p);
+        if(!pipeline.keeps(p))
+        {
+          _extents[i] = kNoExtent;
+          continue;
+        }
+      }
+      _extents[i] = Interval{r.mX1*timeScale - params.fadeTime, r.mX2*timeScale + params.fadeTime};
+    }
+  });
+  _transforms = PartialsPipeline().transpose(pipeline.getFreqRatio()).scaleTime(timeScale).scaleAmp(pipeline.getGain());
+
+  _startOrder.resize(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    _startOrder[i] = i;
+  }
+  std::sort(_startOrder.begin(), _startOrder.end(), [&](size_t a, size_t b)
+  {
+    return _extents[a].mX1 < _extents[b].mX1;
+  });
+
+  // the spectral frames that reach into a block of output are up to one hop outside it. A
+  // tick is added for the rounding of breakpoint times.
+  _margin = double(kSpectralHopSize)/params.sampleRate + kCompactTimeTick*timeScale;
+}
+
+void CompactPartialsRenderer::render(size_t startVector, std::vector< float >& out)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  const size_t nPartials = _partials.size();
+  const size_t nVectors = out.size()/N;
+
+  // going back in time, start again from the first partial.
+  if(startVector < _nextVector)
+  {
+    _sounding.clear();
+    _nextToStart = 0;
+  }
+  _nextVector = startVector + nVectors;
+
+  for(size_t v0=0; v0<nVectors; v0+=kCompactBlockVectors)
+  {
+    size_t v1 = std::min(nVectors, v0 + kCompactBlockVectors);
+    double t0 = double((startVector + v0)*N)/_params.sampleRate - _margin;
+    double t1 = double((startVector + v1)*N)/_params.sampleRate + _margin;
+
+    // update the partials sounding in the block.
+    _sounding.erase(std::remove_if(_sounding.begin(), _sounding.end(), [&](size_t i)
+    {
+      return _extents[i].mX2 < t0;
+    }), _sounding.end());
+    for(; (_nextToStart < nPartials) && (_extents[_startOrder[_nextToStart]].mX1 <= t1); ++_nextToStart)
+    {
+      size_t i = _startOrder[_nextToStart];
+      if((_extents[i].mX1 <= _extents[i].mX2) && (_extents[i].mX2 >= t0))
+      {
+        _sounding.push_back(i);
+      }
+    }
+    if(_sounding.empty()) continue;
+
+    _block.partials.resize(_sounding.size());
+    parallelForChunks(_sounding.size(), getWorkerThreadCount(_maxThreads), [&](size_t, size_t begin, size_t end)
+    {
+      for(size_t j=begin; j<end; ++j)
+      {
+        _partials.getPartial(_sounding[j], _block.partials[j]);
+      }
+    });
+
+    _blockOut.assign((v1 - v0)*N, 0.f);
+    synthesizePartials(_block, _params, _transforms, startVector + v0, _blockOut, _maxThreads);
+    float* pOut = out.data() + v0*N;
+    for(size_t j=0; j<_blockOut.size(); ++j)
+    {
+      pOut[j] += _blockOut[j];
+    }
+  }
+}
@@ -0,0 +1,120 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <vector>
+
+#include "vutuPartials.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuSynthesizer.h"
+
+// partials stored in 16 bits per value, for keeping very long analyses in memory. Each
+// breakpoint is 8 bytes, or 10 with phase, instead of the 20 bytes of a VutuPartial:
+//
+// - time is the number of ticks of kCompactTimeTick since the last breakpoint.
+// - amp is in steps of 1/256 dB from -192 dB, with 0 for silence.
+// - freq is in quarter cents from 4 Hz, with 0 for 0 Hz.
+// - bandwidth is a half-precision float.
+// - phase is a fraction of a cycle. It can be dropped, and is then made again by
+//   integrating the frequency from 0 at the start of each partial.
+//
+// Breakpoints further apart than a 16-bit time delta have breakpoints added between them.
+// Partials are read back one at a time into a VutuPartial, so only the partials in use need
+// to be expanded.
+
+namespace ml
+{
+
+constexpr double kCompactTimeTick{1./8000.};
+
+// convert between float and half-precision float, rounding to the nearest.
+uint16_t floatToHalf(float x);
+float halfToFloat(uint16_t h);
+
+class CompactPartials
+{
+public:
+  // store the partials, keeping their phases if keepPhase is true. The scalar stats and
+  // analysis parameters are kept too. If maxThreads is 0, all hardware threads are used.
+  void compact(const VutuPartialsData& partialsData, bool keepPhase, size_t maxThreads = 0);
+
+  size_t size() const { return _partialStart.size() ? _partialStart.size() - 1 : 0; }
+  size_t getBreakpoints() const { return _amp.size(); }
+  bool hasPhase() const { return !_phase.empty(); }
+
+  // memory used by the breakpoints and per-partial offsets.
+  size_t getBytes() const;
+
+  // the partials data without partials, with the stats of the whole set but no per-partial stats.
+  const VutuPartialsData& getInfo() const { return _info; }
+
+  // read partial i back into p, reusing p's storage.
+  void getPartial(size_t i, VutuPartial& p) const;
+
+  // get the times of the first and last breakpoints of partial i, or an empty range if it
+  // has no breakpoints.
+  Interval getTimeRange(size_t i) const;
+
+  // read all of the partials back into out, and calculate their stats.
+  void expand(VutuPartialsData& out, size_t maxThreads = 0) const;
+
+private:
+  VutuPartialsData _info;
+
+  // the first breakpoint of each partial, and the end of the last.
+  std::vector< uint32_t > _partialStart;
+
+  // the time of each partial's first breakpoint in ticks.
+  std::vector< uint32_t > _startTick;
+
+  std::vector< uint16_t > _timeDelta;
+  std::vector< uint16_t > _amp;
+  std::vector< uint16_t > _freq;
+  std::vector< uint16_t > _bandwidth;
+  std::vector< uint16_t > _phase;
+};
+
+// render the compact partials and add them to out, as synthesizePartials() does. The output
+// is rendered a block of time at a time, expanding only the partials that sound in each
+// block, so the whole set is never expanded at once.
+void synthesizePartials(const CompactPartials& partials, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads = 0);
+
+// render the compact partials as above, with out starting at DSPVector startVector of the
+// output, and played through the pipeline as synthesizePartials() does for full partials.
+void synthesizePartials(const CompactPartials& partials, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads = 0);
+
+// renders compact partials through a pipeline over many calls, for exports and other
+// renders done a block at a time. The filters are tested and the partials sorted by start
+// time once, when the renderer is made. The partials must outlive the renderer.
+class CompactPartialsRenderer
+{
+public:
+  CompactPartialsRenderer(const CompactPartials& partials, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t maxThreads = 0);
+
+  // render the partials and add them to out, starting at DSPVector startVector of the
+  // output. Calls that move forward in time are fastest.
+  void render(size_t startVector, std::vector< float >& out);
+
+private:
+  const CompactPartials& _partials;
+  SynthesisParams _params;
+  PartialsPipeline _transforms;
+  size_t _maxThreads;
+  double _margin{0};
+
+  // the time each partial sounds in the output, and the partials in order of start time.
+  std::vector< Interval > _extents;
+  std::vector< size_t > _startOrder;
+
+  // the partials sounding at the end of the last render.
+  std::vector< size_t > _sounding;
+  size_t _nextToStart{0};
+  size_t _nextVector{0};
+
+  VutuPartialsData _block;
+  std::vector< float > _blockOut;
+};
+
+}
@@ -15,6 +15,13 @@
 
 #include "MLSerialization.h"
 #include "vutuPartials.h"
+#include "vutuAnalysis.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuSampleFiles.h"
+#include "vutuPitch.h"
+#include "vutuSynthesizer.h"
+#include "vutuExport.h"
+#include "vutuResidual.h"
 
 #include "mlvg.h"
 //#include "miniz.h"
@@ -22,47 +29,9 @@
 // Loris includes
 #include "loris.h"
 #include "PartialList.h"
-#include "Synthesizer.h"
 
 using namespace ml;
 
-void _lorisToVutuPartials(const Loris::PartialList* pLoris, VutuPartialsData* pSumu)
-{
-  pSumu->partials.clear();
-  for (const auto& partial : *pLoris) {
-    VutuPartial sp;
-    for (auto it = partial.begin(); it != partial.end(); it++) {
-      sp.time.push_back(it.time());
-      sp.freq.push_back(it->frequency());
-      sp.amp.push_back(it->amplitude());
-      sp.bandwidth.push_back(it->bandwidth());
-      sp.phase.push_back(it->phase());
-    }
-    pSumu->partials.push_back(sp);
-  }
-  
-  pSumu->type = Symbol(kVutuPartialsFileType);
-  pSumu->version = kVutuPartialsFileVersion;
-}
-
-void _sumuToLorisPartials(const VutuPartialsData* pSumu, Loris::PartialList* pLoris)
-{
-  pLoris->clear();
-    
-  for (auto it = pSumu->partials.begin(); it != pSumu->partials.end(); it++) {
-    const VutuPartial& sp = *it;
-    Loris::Partial lp;
-
-    size_t nBreakpoints = sp.time.size();
-    for(int i=0; i<nBreakpoints; ++i)
-    {
-      Loris::Breakpoint b(sp.freq[i], sp.amp[i], sp.bandwidth[i], sp.phase[i]);
-      lp.insert(sp.time[i], b);
-    }
-    pLoris->push_back(lp);
-  }
-}
-
 //-----------------------------------------------------------------------------
 // VutuController implementation
 
@@ -74,6 +43,16 @@ VutuController::VutuController(TextFragment appName, const ParameterDescriptionL
 
 VutuController::~VutuController()
 {
+  // stop any export in progress
+  if(_pCancelExport)
+  {
+    *_pCancelExport = true;
+  }
+  if(_exportThread.joinable())
+  {
+    _exportThread.join();
+  }
+
   // don't stop the master Timers-- there may be other plugin instances using it!
   // std::cout << "VutuController: BYE!\n";
 
@@ -84,13 +63,21 @@ void VutuController::setButtonEnableStates()
   sendMessageToActor(_viewName, {"widget/play_source/set_prop/enabled", usable(&_sourceSample)});
   sendMessageToActor(_viewName, {"widget/analyze/set_prop/enabled", usable(&_sourceSample)});
   
-  Loris::PartialList* pLorisPartials = _lorisPartials.get();
-  bool partialsOK = pLorisPartials && (pLorisPartials->size() > 0);
+  VutuPartialsData* pPartials = _vutuPartials.get();
+  bool partialsOK = pPartials && (pPartials->partials.size() > 0);
   sendMessageToActor(_viewName, {"widget/synthesize/set_prop/enabled", partialsOK});
   sendMessageToActor(_viewName, {"widget/export/set_prop/enabled", partialsOK});
+  sendMessageToActor(_viewName, {"widget/distill/set_prop/enabled", partialsOK});
   
-  sendMessageToActor(_viewName, {"widget/play_synth/set_prop/enabled", getSize(_synthesizedSample) > 0});
-  sendMessageToActor(_viewName, {"widget/export_synth/set_prop/enabled", getSize(_synthesizedSample) > 0});
+  // the processor synthesizes the partials in real time for playback.
+  sendMessageToActor(_viewName, {"widget/play_synth/set_prop/enabled", partialsOK});
+  sendMessageToActor(_viewName, {"widget/export_synth/set_prop/enabled", partialsOK});
+  sendMessageToActor(_viewName, {"widget/play_residual/set_prop/enabled", usable(&_residualSample)});
+
+  // the current partials can be set as the morph target, or the target cleared.
+  bool hasTarget = (_morphTarget.get() != nullptr);
+  sendMessageToActor(_viewName, {"widget/morph_target/set_prop/enabled", partialsOK || hasTarget});
+  sendMessageToActor(_viewName, {"widget/morph_target/set_prop/text", TextFragment(hasTarget ? "clear target" : "set target")});
 }
 
 void VutuController::_debug()
@@ -117,65 +104,105 @@ void VutuController::broadcastSourceSample()
 void VutuController::_clearPartialsData()
 {
   // clear data
-  _vutuPartials = std::make_unique< VutuPartialsData >();
-  _lorisPartials = std::make_unique< Loris::PartialList >();
+  _vutuPartials = std::make_shared< VutuPartialsData >();
 }
 
 void VutuController::broadcastPartialsData()
 {
-  // send Partials to View and Processor
+  // send Partials to View and Processor. The Processor takes ownership of a new shared
+  // pointer, so the partials live as long as it plays them.
   VutuPartialsData* pPartials = _vutuPartials.get();
   Value partialsPtrValue(&pPartials, sizeof(VutuPartialsData*));
-  sendMessageToActor(_processorName, {"do/set_partials_data", partialsPtrValue});
+  auto pShared = new std::shared_ptr< const VutuPartialsData >(_vutuPartials);
+  sendMessageToActor(_processorName, {"do/set_partials_data", Value(&pShared, sizeof(pShared))});
   sendMessageToActor(_viewName, {"do/set_partials_data", partialsPtrValue});
 
+  // the morph starts from the current partials, so it changes with them.
+  broadcastMorphData();
+}
+
+void VutuController::broadcastMorphData()
+{
+  // match the partials to the target once here, so the processor only interpolates.
+  // the Processor shares the morph, so releasing the old one here doesn't free it while it plays.
+  _morph.reset();
+  VutuPartialsData* pPartials = _vutuPartials.get();
+  if(pPartials && (pPartials->partials.size() > 0) && _morphTarget && (_morphTarget->partials.size() > 0))
+  {
+    _morph = std::make_shared< const PartialsMorph >(*pPartials, *_morphTarget);
+    TextFragment morphText("morph: ", textUtils::naturalNumberToText(_morph->getMatchedCount()), " of ", textUtils::naturalNumberToText(pPartials->partials.size()), " partials matched to target");
+    std::cout << "VutuController: " << morphText << "\n";
+    _printToConsole(morphText);
+  }
+
+  // send the morph to the Processor, or null to play the partials alone. The Processor takes
+  // ownership of a new shared pointer.
+  auto pShared = new std::shared_ptr< const PartialsMorph >(_morph);
+  sendMessageToActor(_processorName, {"do/set_morph_data", Value(&pShared, sizeof(pShared))});
 }
 
 void VutuController::_clearSynthesizedSample()
 {
   clear(_synthesizedSample);
+  clear(_residualSample);
 }
 
 void VutuController::broadcastSynthesizedSample()
 {
-  // send synthesized audio to View and Processor
+  // send synthesized audio to View. The Processor plays the partials directly.
   ml::Sample* pSample = &_synthesizedSample;
   Value samplePtrValue(&pSample, sizeof(ml::Sample*));
-  sendMessageToActor(_processorName, {"do/set_synth_data", samplePtrValue});
   sendMessageToActor(_viewName, {"do/set_synth_data", samplePtrValue});
-}
 
+  // the Processor plays the residual like the source. The View shows it while it plays.
+  ml::Sample* pResidual = &_residualSample;
+  Value residualPtrValue(&pResidual, sizeof(ml::Sample*));
+  sendMessageToActor(_processorName, {"do/set_residual_data", residualPtrValue});
+}
 
-int VutuController::saveSampleToWavFile(const Sample& sample, Path wavPath)
+void VutuController::exportPartials(Path savePath)
 {
-  int OK{ false };
-  std::cout << "saveSampleToWavFile: " << wavPath << "\n";
-  
-  SNDFILE* sndfile;
-  SF_INFO* sf_info;
+  if(_exportThread.joinable())
+  {
+    _exportThread.join();
+  }
 
-  
-  sf_info = (SF_INFO *) malloc(sizeof(SF_INFO));
-  sf_info->samplerate = sample.sampleRate;
-  sf_info->channels = 1;
-  sf_info->format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-  
-  sndfile = sf_open(pathToText(wavPath).getText(), SFM_WRITE, sf_info);
+  // the export shares the current partials, which are never changed once made.
+  std::shared_ptr< const VutuPartialsData > pPartials = _vutuPartials;
+  Interval analysisInterval = params.getRealValue("analysis_interval").getIntervalValue();
 
-  // write samples
-  // mono only, for now!
-  size_t frames = getFrames(_synthesizedSample);
-  auto writeResult = sf_writef_float(sndfile, getFramePtr(_synthesizedSample), frames);
-  if(writeResult == frames)
+  ExportParams exportParams;
+  _exportPath = pathToText(savePath);
+  exportParams.format.aiff = isAIFFPath(_exportPath);
+  exportParams.format.sampleRate = kSampleRate;
+  exportParams.format.bitDepth = 24;
+  exportParams.duration = pPartials->sourceDuration*(analysisInterval.mX2 - analysisInterval.mX1);
+
+  _pCancelExport = std::make_shared< std::atomic< bool > >(false);
+  _exportRunning = true;
+  sendMessageToActor(_viewName, {"widget/export_synth/set_prop/text", TextFragment("cancel")});
+
+  // progress and the result are sent back to the controller to show.
+  Path controllerName = getInstanceName();
+  auto pCancel = _pCancelExport;
+  TextFragment pathText = _exportPath;
+  _exportThread = std::thread([pPartials, pCancel, controllerName, pathText, exportParams]()
   {
-    OK = true;
-  }
-  
-  /* Close sound file and return */
-  sf_close(sndfile);
+    int prevPercent{-1};
+    auto progress = [&](float p)
+    {
+      int percent = p*100;
+      if(percent != prevPercent)
+      {
+        prevPercent = percent;
+        sendMessageToActor(controllerName, {"do/export_progress", float(percent)});
+      }
+      return !*pCancel;
+    };
 
-  
-  return OK;
+    ExportResult result = exportPartialsToFile(*pPartials, pathText, exportParams, progress);
+    sendMessageToActor(controllerName, {"do/export_done", float(result)});
+  });
 }
 
 int VutuController::loadSampleFromPath(Path samplePath)
@@ -186,49 +213,28 @@ int VutuController::loadSampleFromPath(Path samplePath)
   {
     // load the file
     auto filePathText = fileToLoad.getFullPathAsText();
-    SF_INFO fileInfo{};
-    sf_count_t framesRead{0};
-    float* pData{nullptr};
-
-    auto fText = filePathText.getText();
     std::cout << "file as text: " << filePathText.getText() << "\n";
 
-    SNDFILE* file = sf_open(filePathText.getText(), SFM_READ, &fileInfo);
-    if(file)
-    {
-      //  auto p2 = file.getFullPath();
-      //  std::cout << "loadSampleFromPath: file fullPath: " << p2 << " (length " << p2.getSize() << ")\n";
-
+    constexpr float kMaxSeconds = 60;
+    _printToConsole(TextFragment("loading ", filePathText, "..."));
 
-
-      constexpr size_t kMaxSeconds = 60;
-      size_t kMaxFrames = kMaxSeconds*fileInfo.samplerate;
-      size_t framesToRead = std::min(size_t(fileInfo.frames), kMaxFrames);
-      _printToConsole(TextFragment("loading ", filePathText, "..."));
-      
-      auto pData = resize(_sourceSample, framesToRead, fileInfo.channels);
-      
-      //_sourceSample.data.resize(samplesToRead);
-      //pData = _sourceSample.data.data();
-      
-      _sourceSample.sampleRate = fileInfo.samplerate;
-      
+    SampleFileInfo fileInfo;
+    clear(_sourceAtSynthRate);
+    bool readOK = readMonoSampleFromFile(filePathText, _sourceSample, kMaxSeconds, fileInfo);
+    if(fileInfo.sampleRate)
+    {
       std::cout << "  file sr: " << _sourceSample.sampleRate << "\n";
-      
-      if(pData)
-      {
-        framesRead = sf_readf_float(file, pData, static_cast<sf_count_t>(framesToRead));
-      }
-      
+
       TextFragment readStatus;
-      if(framesRead != framesToRead)
+      if(!readOK)
       {
         readStatus = "file read failed!";
       }
       else
       {
         float sr = _sourceSample.sampleRate;
-        TextFragment truncatedMsg = (framesToRead == kMaxFrames) ? "(truncated)" : "";
+        size_t framesRead = fileInfo.framesRead;
+        TextFragment truncatedMsg = fileInfo.truncated ? "(truncated)" : "";
         TextFragment framesMsg (textUtils::naturalNumberToText(framesRead), " frames read ");
         TextFragment secondsMsg ("(", textUtils::floatNumberToText((framesRead + 0.f)/sr, 2), " seconds) ");
         TextFragment sampleRate(" sr = ", textUtils::naturalNumberToText(_sourceSample.sampleRate));
@@ -238,21 +244,9 @@ int VutuController::loadSampleFromPath(Path samplePath)
       }
       
       _printToConsole(readStatus);
-      sf_close(file);
     }
     
     sourceFileLoaded = fileToLoad;
-
-    // deinterleave in place to extract first channel if needed
-    if(usable(&_sourceSample) && _sourceSample.channels > 1)
-    {
-      
-      for(int i=0; i < framesRead; ++i)
-      {
-        _sourceSample[i] = _sourceSample[i*_sourceSample.channels];
-      }
-      resize(_sourceSample, framesRead, 1);
-    }
     
     normalize(_sourceSample);
 
@@ -287,6 +281,35 @@ void VutuController::setAnalysisParamsFromPartials()
 
 }
 
+// estimate the fundamental of the source in the analysis interval. If the estimate is
+// good, set the fundamental and the resolution and window width that suit it.
+void VutuController::setAnalysisParamsFromSourcePitch()
+{
+  const Interval kFundamentalRange{22, 2200};
+  
+  auto interval = params.getRealValue("analysis_interval").getIntervalValue();
+  PitchEstimate estimate = estimateFundamental(_sourceSample, interval, kFundamentalRange);
+  
+  TextFragment fileName = sourceFileLoaded.getShortName();
+  TextFragment pitchText(" fundamental: ", floatToText(estimate.frequency), " Hz (confidence ", floatToText(estimate.confidence), ")");
+  if(estimate.confidence >= kMinPitchConfidence)
+  {
+    float f0 = estimate.frequency;
+    params.setFromRealValue("fundamental", f0);
+    params.setFromRealValue("resolution", getResolutionForFundamental(f0));
+    params.setFromRealValue("window_width", getWindowWidthForFundamental(f0));
+    for(auto paramName : {"fundamental", "resolution", "window_width"})
+    {
+      broadcastParam(paramName, 0);
+    }
+    _printToConsole(TextFragment(fileName, ":", pitchText));
+  }
+  else
+  {
+    _printToConsole(TextFragment(fileName, ": no clear", pitchText));
+  }
+}
+
 int VutuController::loadPartialsFromPath(Path partialsPath)
 {
   int OK{ false };
@@ -295,9 +318,13 @@ int VutuController::loadPartialsFromPath(Path partialsPath)
   {
     if(VutuPartialsData* newPartials = loadVutuPartialsFromFile(fileToLoad))
     {
-      // transfer ownership of new partials to _vutuPartials and delete previous
-      _vutuPartials = std::unique_ptr<VutuPartialsData>(newPartials);
+      // transfer ownership of new partials to _vutuPartials and release previous
+      _vutuPartials = std::shared_ptr<VutuPartialsData>(newPartials);
       OK = true;
+      
+      // simplify with the current tolerances
+      simplifyPartials(*_vutuPartials, getAnalysisParams(params).simplify);
+      calcStats(*_vutuPartials);
     }
     
     showAnalysisInfo();
@@ -362,184 +389,129 @@ int VutuController::analyzeSample()
 {
   int status{ false };
   
-  auto totalFrames = getFrames(_sourceSample);
-  if(!totalFrames) return status;
+  if(!getFrames(_sourceSample)) return status;
   
+  // get faded input from the analysis interval and analysis params
   auto interval = params.getRealValue("analysis_interval").getIntervalValue();
-  auto frameInterval = interval*float(totalFrames);
-  
-  int framesInInterval = frameInterval.mX2 - frameInterval.mX1;
-  const float kFadeTime = 0.001f;
-  int fadeSamples = kFadeTime*_sourceSample.sampleRate;
-  
-  // make double-precision version of input
-  std::vector< double > vx;
-  vx.resize(framesInInterval);
-  int srcStart = frameInterval.mX1;
-  for(int i=0; i<framesInInterval; ++i)
-  {
-    vx[i] = _sourceSample[srcStart + i];
-  }
-  
-  // fade in
-  for(int i=0; i<fadeSamples; ++i)
-  {
-    double gain = (double)i / (double)fadeSamples;
-    vx[i] *= gain;
-  }
-  
-  // fade out
-  for(int i=0; i<fadeSamples; ++i)
-  {
-    int i2 = framesInInterval - 1 - i;
-    double gain = (double)i / (double)fadeSamples;
-    vx[i2] *= gain;
-  }
-  
-  // set sample rate and configure analyzer
-  int sr = _sourceSample.sampleRate;
-  auto res = params.getRealFloatValue("resolution");
-  auto width = params.getRealFloatValue("window_width");
-  auto drift = params.getRealFloatValue("freq_drift");
-  auto floor = params.getRealFloatValue("amp_floor");
-  auto loCut = params.getRealFloatValue("lo_cut");
-  auto hiCut = params.getRealFloatValue("hi_cut");
-  auto noiseWidth = params.getRealFloatValue("noise_width");
-  analyzer_configure(res, width);
-  analyzer_setFreqDrift(drift);
-  analyzer_setAmpFloor(floor);
-  analyzer_setFreqFloor(loCut);
-  analyzer_setBwRegionWidth(noiseWidth);
-    
-  // make new partial list and give ownership to _lorisPartials
-  Loris::PartialList* newPartials = createPartialList();
-  _lorisPartials = std::make_unique< Loris::PartialList >(*newPartials);
-  
-  
-  //  if verbose, spew out the Analyzer state:
-  if ( true )
-  {
-    std::cout << "* Loris Analyzer configuration:" << std::endl;
-    std::cout << "*\tfrequency resolution: " << analyzer_getFreqResolution() << " Hz\n";
-    std::cout << "*\tanalysis window width: " << analyzer_getWindowWidth() << " Hz\n";
-    std::cout << "*\tanalysis window sidelobe attenuation: "
-    << analyzer_getSidelobeLevel() << " dB\n";
-    std::cout << "*\tspectral amplitude floor: " << analyzer_getAmpFloor() << " dB\n";
-    std::cout << "*\tminimum partial frequecy: " << analyzer_getFreqFloor() << " Hz\n";
-    std::cout << "*\thop time: " << 1000*analyzer_getHopTime() << " ms\n";
-    std::cout << "*\tmaximum partial frequency drift: " << analyzer_getFreqDrift()
-    << " Hz\n";
-    std::cout << "*\tcrop time: " << 1000*analyzer_getCropTime() << " ms\n";
-    
-    if (1)//( gAnalyzer->associateBandwidth() )
-    {
-      if (1)// ( gAnalyzer->bandwidthIsResidue() )
-      {
-        std::cout << "*\tspectral residue bandwidth association region width: "
-        << analyzer_getBwRegionWidth() << " Hz\n";
-      }
-      else
-      {
-        std::cout << "*\tsinusoidal convergence bandwidth tolerance: "
-        << analyzer_getBwConvergenceTolerance() << "\n";
-      }
-    }
-    else
-    {
-      std::cout << "*\tstoring no bandwidth\n";
-    }
-
-    
-    std::cout << std::endl;
-  }
+  auto analysisInput = getAnalysisInput(_sourceSample, interval);
+  AnalysisParams analysisParams = getAnalysisParams(params);
   
-  analyze( vx.data(), framesInInterval, sr, _lorisPartials.get() );
+  // the Loris partials are only kept until they are converted.
+  Loris::PartialList lorisPartials = analyzeWithLoris(analysisInput, _sourceSample.sampleRate, analysisParams, true);
   
-  if(partialList_size(_lorisPartials.get()) > 0)
+  if(lorisPartials.size() > 0)
   {
     status = true;
     
-    // convert loris partials to Sumu format and calculate stats
-    _vutuPartials = std::make_unique< VutuPartialsData >();
-    _lorisToVutuPartials(_lorisPartials.get(), _vutuPartials.get());
-    cutHighs(*_vutuPartials, hiCut);
-    cleanOutliers(*_vutuPartials);
-    calcStats(*_vutuPartials);
-    showAnalysisInfo();
-    
-    // store analysis params used
+    // convert loris partials to Vutu format, filter and calculate stats
+    _vutuPartials = makeVutuPartials(lorisPartials, analysisParams);
     _vutuPartials->sourceFile = sourceFileLoaded.getShortName();
     _vutuPartials->sourceDuration = getDuration(_sourceSample);
-    _vutuPartials->resolution = res;
-    _vutuPartials->windowWidth = width;
-    _vutuPartials->ampFloor = floor;
-    _vutuPartials->freqDrift = drift;
-    _vutuPartials->loCut = loCut;
-    _vutuPartials->hiCut = hiCut;
-
-
-    // convert back to loris partials after cutHighs (hack-ish)
-    _sumuToLorisPartials(_vutuPartials.get(), _lorisPartials.get());
-    
+    showAnalysisInfo();
   }
   return status;
 }
 
-// generate the synthesized audio from the Loris partials.
-// note output sample may be a different sample rate!
+// distill the partials into one partial per harmonic of the fundamental parameter.
+int VutuController::distillPartials()
+{
+  if(!_vutuPartials.get()) return false;
+
+  // distilling is done by Loris, on a copy of the partials made just for it.
+  size_t partialsBefore = _vutuPartials->partials.size();
+  float fundamental = params.getRealFloatValue("fundamental");
+  Loris::PartialList lorisPartials;
+  vutuToLorisPartials(*_vutuPartials, lorisPartials);
+  distillHarmonics(lorisPartials, fundamental);
+
+  // make new Vutu partials, keeping the source and analysis info. The old ones may still be
+  // playing.
+  auto pDistilled = std::make_shared< VutuPartialsData >();
+  copyPartialsInfo(*_vutuPartials, *pDistilled);
+  lorisToVutuPartials(lorisPartials, *pDistilled);
+  PartialsPipeline().keepMinBreakpoints(2).apply(*pDistilled);
+  calcStats(*pDistilled);
+  pDistilled->fundamental = fundamental;
+  pDistilled->distilled = true;
+  _vutuPartials = pDistilled;
+
+  size_t partialsAfter = _vutuPartials->partials.size();
+  TextFragment distillText("distilled at ", floatToText(fundamental), " Hz: ", intToText(partialsBefore), " -> ", intToText(partialsAfter), " partials");
+  std::cout << "VutuController: " << distillText << "\n";
+  _printToConsole(distillText);
+  return partialsAfter > 0;
+}
+
+// generate the synthesized audio from the partials.
 void VutuController::synthesize()
 {
-  if(!_lorisPartials.get()) return;
+  if(!_vutuPartials.get()) return;
 
-  std::vector<double> destSamples;
-  Loris::Synthesizer::Parameters synthParams;
+  SynthesisParams synthParams;
   synthParams.sampleRate = kSampleRate;
-  const float kFadeTime = 0.001f;
+  synthParams.fadeTime = 0.001f;
 
-  // get frames in analysis interval to use for output length. Length of synthesis will be shorter.
+  // get frames in analysis interval to use for output length.
   Interval analysisInterval = params.getRealValue("analysis_interval").getIntervalValue();
   float duration = _vutuPartials->sourceDuration*(analysisInterval.mX2 -  analysisInterval.mX1);
-  int framesAnalyzed = duration*synthParams.sampleRate;
-  
-  // run the Loris synthesizer
-  Loris::Synthesizer synth(synthParams, destSamples);
-  synth.setFadeTime(kFadeTime);
-  synth.synthesize(_lorisPartials->begin(), _lorisPartials->end());
-  
-  std::cout << "VutuController: synthesize: " << destSamples.size() << "samples synthesized. " << framesAnalyzed << " frames analyzed. \n";
+  size_t framesAnalyzed = duration*synthParams.sampleRate;
+  if(!framesAnalyzed) return;
 
-  // resize and zero-pad output to fill entire interval
-  if(!destSamples.size()) return;
-  destSamples.resize(framesAnalyzed);
-  
-  // convert to floats
-  size_t outputFrames = destSamples.size();
-  int fadeSamples = min(size_t(kFadeTime*kSampleRate), outputFrames/2);
-  
-  resize(_synthesizedSample, outputFrames, 1);
-  
-  for(int i=0; i<outputFrames; ++i)
+  // dense partials are rendered all at once by the spectral engine. Otherwise, only partials
+  // that changed since the last synthesis are rendered.
+  SynthesisEngine engine = getSynthesisEngine(*_vutuPartials, synthParams);
+  if(engine == SynthesisEngine::kSpectral)
   {
-    _synthesizedSample[i] = destSamples[i];
+    synthesizeToSample(*_vutuPartials, synthParams, framesAnalyzed, _synthesizedSample);
   }
-
-  // fade in
-  for(int i=0; i<fadeSamples; ++i)
+  else
   {
-    double gain = (double)i / (double)fadeSamples;
-    _synthesizedSample[i] *= gain;
+    const auto& rendered = _synthesisCache.synthesize(*_vutuPartials, synthParams, framesAnalyzed);
+    renderedToSample(rendered, synthParams, framesAnalyzed, _synthesizedSample);
+    const auto& counts = _synthesisCache.getLastCounts();
+    std::cout << "VutuController: synthesize: " << counts.rendered << " partials rendered, " << counts.reused << " reused, " << counts.removed << " removed" << (counts.rebuilt ? " (rebuilt)" : "") << ", cache " << (_synthesisCache.getBytesUsed() >> 20) << " MB\n";
   }
-  
-  // fade out
-  for(int i=0; i<fadeSamples; ++i)
+  std::cout << "VutuController: synthesize: " << framesAnalyzed << " frames synthesized with " << getSynthesisEngineName(engine) << ". \n";
+
+  computeResidual();
+}
+
+// subtract the synthesized sample from the source over the analysis interval, and measure
+// the SNR. Synthesis runs at kSampleRate, so for sources at other rates the source is
+// resampled to that rate once and kept, to line up with the synthesis sample for sample.
+void VutuController::computeResidual()
+{
+  clear(_residualSample);
+  if(!usable(&_sourceSample) || !usable(&_synthesizedSample)) return;
+
+  // compare at the rate of the synthesized sample, resampling the source once if needed.
+  const ml::Sample* pSource = &_sourceSample;
+  if(_sourceSample.sampleRate != _synthesizedSample.sampleRate)
   {
-    int i2 = outputFrames - 1 - i;
-    double gain = (double)i / (double)fadeSamples;
-    _synthesizedSample[i2] *= gain;
+    if(!usable(&_sourceAtSynthRate))
+    {
+      _sourceAtSynthRate.sampleRate = _synthesizedSample.sampleRate;
+      resample(&_sourceSample, &_sourceAtSynthRate);
+    }
+    pSource = &_sourceAtSynthRate;
   }
 
-  normalize(_synthesizedSample);
-  _synthesizedSample.sampleRate = synthParams.sampleRate;
+  Interval analysisInterval = params.getRealValue("analysis_interval").getIntervalValue();
+  auto input = getAnalysisInput(*pSource, analysisInterval);
+  std::vector< float > source(input.begin(), input.end());
+  float sampleRate = pSource->sampleRate;
+  std::vector< float > synth(getConstFramePtr(_synthesizedSample), getConstFramePtr(_synthesizedSample) + getFrames(_synthesizedSample));
+
+  _residualStats = measureResidual(source, synth, sampleRate);
+  makeResidual(source, synth, _residualStats.gain, sampleRate, _residualSample);
+
+  TextFragment residualText("residual SNR: ", floatToText(_residualStats.snr), " dB");
+  if(const ResidualBand* pWorst = getWorstResidualBand(_residualStats))
+  {
+    residualText = TextFragment(residualText, ", worst band ", floatToText(pWorst->freqRange.mX1), "-", floatToText(pWorst->freqRange.mX2), " Hz: ", floatToText(pWorst->snr), " dB");
+  }
+  std::cout << "VutuController: " << residualText << "\n";
+  _printToConsole(residualText);
 }
 
 
@@ -572,6 +544,12 @@ void VutuController::onMessage(Message m)
           break;
         }
         case(hash("synth_time")):
+        {
+          sendMessageToActor(_viewName, {"widget/synth/set_prop/playback_time", m.value});
+          sendMessageToActor(_viewName, {"widget/partials/set_prop/playback_time", m.value});
+          break;
+        }
+        case(hash("residual_time")):
         {
           sendMessageToActor(_viewName, {"widget/synth/set_prop/playback_time", m.value});
           break;
@@ -613,6 +591,12 @@ void VutuController::onMessage(Message m)
 
           params.setValue("analysis_interval", Interval{0, 1});
           broadcastParam("analysis_interval", 0);
+          
+          // seed the analysis params from the pitch of the new source
+          if(usable(&_sourceSample))
+          {
+            setAnalysisParamsFromSourcePitch();
+          }
 
           messageHandled = true;
           break;
@@ -629,10 +613,46 @@ void VutuController::onMessage(Message m)
           messageHandled = true;
           break;
         }
+        case(hash("toggle_play_residual")):
+        {
+          sendMessageToActor(_processorName, {"do/toggle_play/residual"});
+          messageHandled = true;
+          break;
+        }
+        case(hash("scrub")):
+        case(hash("scrub_end")):
+        {
+          // scrubbing from the partials display
+          sendMessageToActor(_processorName, m);
+          messageHandled = true;
+          break;
+        }
+        case(hash("morph_target")):
+        {
+          // hold a copy of the current partials as the morph target, or clear the target
+          VutuPartialsData* pPartials = _vutuPartials.get();
+          if(_morphTarget)
+          {
+            _morphTarget.reset();
+          }
+          else if(pPartials && (pPartials->partials.size() > 0))
+          {
+            _morphTarget = std::make_unique< VutuPartialsData >(*pPartials);
+          }
+          broadcastMorphData();
+          setButtonEnableStates();
+          messageHandled = true;
+          break;
+        }
         case(hash("export_synth")):
         {
-          // save synthesized audio to a file
-          if(getSize(_synthesizedSample))
+          // render the partials to a file, or cancel an export in progress
+          VutuPartialsData* pPartials = _vutuPartials.get();
+          if(_exportRunning)
+          {
+            *_pCancelExport = true;
+          }
+          else if(pPartials && (pPartials->partials.size() > 0))
           {
             File exportOriginDir(recentSamplesOutPath);
             if(!exportOriginDir)
@@ -645,8 +665,7 @@ void VutuController::onMessage(Message m)
             if(savePath)
             {
               recentSamplesOutPath = savePath;
-              File saveFile (savePath);
-              saveSampleToWavFile(_synthesizedSample, savePath);
+              exportPartials(savePath);
             }
           }
           messageHandled = true;
@@ -666,11 +685,21 @@ void VutuController::onMessage(Message m)
           messageHandled = true;
           break;
         }
+        case(hash("distill")):
+        {
+          _clearSynthesizedSample();
+          distillPartials();
+          broadcastPartialsData();
+          broadcastSynthesizedSample();
+          setButtonEnableStates();
+          messageHandled = true;
+          break;
+        }
         case(hash("synthesize")):
         {
           _clearSynthesizedSample();
-          Loris::PartialList* pLorisPartials = _lorisPartials.get();
-          if(pLorisPartials && pLorisPartials->size() > 0)
+          VutuPartialsData* pPartials = _vutuPartials.get();
+          if(pPartials && pPartials->partials.size() > 0)
           {
             synthesize();
           }
@@ -695,7 +724,42 @@ void VutuController::onMessage(Message m)
               sendMessageToActor(_viewName, {"widget/play_synth/set_prop/text", TextFragment("stop")});
               break;
             }
+            case(hash("residual")):
+            {
+              // show the residual in place of the synthesized sample while it plays.
+              sendMessageToActor(_viewName, {"widget/play_residual/set_prop/text", TextFragment("stop")});
+              ml::Sample* pResidual = &_residualSample;
+              sendMessageToActor(_viewName, {"do/set_synth_data", Value(&pResidual, sizeof(ml::Sample*))});
+              _showingResidual = true;
+              break;
+            }
+          }
+          messageHandled = true;
+          break;
+        }
+        case(hash("export_progress")):
+        {
+          int percent = m.value.getFloatValue();
+          _printToConsole(TextFragment("exporting: ", textUtils::naturalNumberToText(percent), "%"));
+          messageHandled = true;
+          break;
+        }
+        case(hash("export_done")):
+        {
+          switch(ExportResult(int(m.value.getFloatValue())))
+          {
+            case ExportResult::kOK:
+              _printToConsole(TextFragment("exported ", _exportPath));
+              break;
+            case ExportResult::kCancelled:
+              _printToConsole("export cancelled.");
+              break;
+            case ExportResult::kFileError:
+              _printToConsole(TextFragment("could not write ", _exportPath));
+              break;
           }
+          sendMessageToActor(_viewName, {"widget/export_synth/set_prop/text", TextFragment("export audio")});
+          _exportRunning = false;
           messageHandled = true;
           break;
         }
@@ -704,7 +768,15 @@ void VutuController::onMessage(Message m)
           // switch play button texts
           sendMessageToActor(_viewName, {"widget/play_source/set_prop/text", TextFragment("play")});
           sendMessageToActor(_viewName, {"widget/play_synth/set_prop/text", TextFragment("play")});
+          sendMessageToActor(_viewName, {"widget/play_residual/set_prop/text", TextFragment("residual")});
+          if(_showingResidual)
+          {
+            ml::Sample* pSample = &_synthesizedSample;
+            sendMessageToActor(_viewName, {"do/set_synth_data", Value(&pSample, sizeof(ml::Sample*))});
+            _showingResidual = false;
+          }
           sendMessageToActor(_viewName, {"widget/sample/set_prop/playback_time", 0.f});
+          sendMessageToActor(_viewName, {"widget/partials/set_prop/playback_time", 0.f});
           messageHandled = true;
           break;
         }
@@ -731,10 +803,10 @@ void VutuController::onMessage(Message m)
 
               if(ext == "utu")
               {
-                // tuck current fundamental param value into partials data
-                pPartials->fundamental = params.getRealFloatValue("fundamental");
-                
+                // tuck current fundamental param value into the saved partials. The partials
+                // themselves are shared with the Processor, so they are left as they are.
                 auto partialsJson = vutuPartialsToJSON(*pPartials);
+                cJSON_ReplaceItemInObject(partialsJson.data(), "fundamental", cJSON_CreateNumber(params.getRealFloatValue("fundamental")));
                 auto partialsText = JSONToText(partialsJson);
                 File saveFile (savePath);
 
@@ -763,12 +835,9 @@ void VutuController::onMessage(Message m)
             // load Sumu partials from JSON
             if(loadPartialsFromPath(loadPath))
             {
-              // convert to Loris partials so we can use Loris to synthesize output
-              _lorisPartials = std::make_unique< Loris::PartialList >();
-              _sumuToLorisPartials(_vutuPartials.get(), _lorisPartials.get() );
-              
               // clear source sample so all data is consistent
               clear(_sourceSample);
+              clear(_sourceAtSynthRate);
               broadcastSourceSample();
               
               // clear synthesized sample and sync UI and params
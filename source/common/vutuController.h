@@ -14,10 +14,14 @@
 #include "vutuView.h"
 
 #include "vutuPartials.h"
+#include "vutuSynthesisCache.h"
+#include "vutuMorph.h"
+#include "vutuResidual.h"
 
 #include "sndfile.hh"
 
-#include "loris.h"
+#include <atomic>
+#include <thread>
 
 using namespace ml;
 
@@ -45,10 +49,31 @@ private:
   ml::Sample _sourceSample;
   ml::Sample _synthesizedSample;
 
-  std::unique_ptr< Loris::PartialList > _lorisPartials;
-  std::unique_ptr< VutuPartialsData > _vutuPartials;
+  // the source resampled to the synthesis rate for measuring the residual. It is made the
+  // first time it's needed after a source is loaded.
+  ml::Sample _sourceAtSynthRate;
 
-  int saveSampleToWavFile(const ml::Sample& signal, Path wavPath);
+  // the source minus the synthesized sample over the analysis interval, at the synthesis rate.
+  ml::Sample _residualSample;
+  ResidualStats _residualStats;
+  bool _showingResidual{false};
+  SynthesisCache _synthesisCache;
+
+  // the current partials. Once sent to the Processor they are shared with it and never
+  // changed, so edits make new partials.
+  std::shared_ptr< VutuPartialsData > _vutuPartials;
+
+  // a copy of earlier partials to morph to, and the morph to it from the current partials.
+  std::unique_ptr< VutuPartialsData > _morphTarget;
+  std::shared_ptr< const PartialsMorph > _morph;
+
+  // render the partials to a sound file on the export thread. The thread shares only the
+  // partials and the cancel flag with the controller, and reports back with messages.
+  void exportPartials(Path savePath);
+  std::thread _exportThread;
+  bool _exportRunning{false};
+  TextFragment _exportPath;
+  std::shared_ptr< std::atomic< bool > > _pCancelExport;
 
   int loadSampleFromPath(Path samplePath);
   int loadPartialsFromPath(Path samplePath);
@@ -57,15 +82,19 @@ private:
 
   void showAnalysisInfo();
   void setAnalysisParamsFromPartials();
+  void setAnalysisParamsFromSourcePitch();
 
   int _loadSampleFromDialog();
   int analyzeSample();
+  int distillPartials();
   void broadcastSourceSample();
 
   void _clearPartialsData();
   void broadcastPartialsData();
+  void broadcastMorphData();
 
   void synthesize();
+  void computeResidual();
 
   void _clearSynthesizedSample();
   void broadcastSynthesizedSample();
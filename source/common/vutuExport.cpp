@@ -0,0 +1,148 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuExport.h"
+#include "vutuSynthesizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace ml;
+
+namespace
+{
+
+// vectors rendered between progress reports and writes. Blocks are long so that the threads
+// of synthesizePartials() have plenty of work each.
+constexpr size_t kVectorsPerBlock{4096};
+
+// the fraction of the progress spent rendering when normalizing. The rest is the scaled copy.
+constexpr float kNormalizeRenderProgress{0.9f};
+
+
+// adds a block of output, starting at the given DSPVector, to the block.
+using RenderBlockFn = std::function< void(size_t, std::vector< float >&) >;
+
+SynthesisParams getSynthesisParams(const ExportParams& params)
+{
+  SynthesisParams synthParams;
+  synthParams.sampleRate = params.format.sampleRate;
+  synthParams.fadeTime = params.fadeTime;
+  return synthParams;
+}
+
+ExportResult exportToFile(RenderBlockFn renderBlock, const TextFragment& filePath, const ExportParams& params, ExportProgressFn progress)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  const size_t nFrames = size_t(params.duration*params.format.sampleRate);
+
+  size_t fadeFrames = std::min(size_t(params.fadeTime*params.format.sampleRate), nFrames/2);
+  auto getFadeGain = [&](size_t i)
+  {
+    size_t fromEnd = std::min(i, nFrames - 1 - i);
+    return (fromEnd < fadeFrames) ? float(fromEnd)/float(fadeFrames) : 1.f;
+  };
+
+  SoundFileWriter writer;
+  if(!writer.open(filePath, params.format)) return ExportResult::kFileError;
+
+  // when normalizing, the unscaled output goes to a temporary file until the peak is known.
+  std::FILE* pTemp{nullptr};
+  if(params.normalize)
+  {
+    pTemp = std::tmpfile();
+    if(!pTemp)
+    {
+      writer.close();
+      std::remove(filePath.getText());
+      return ExportResult::kFileError;
+    }
+  }
+  float renderProgress = params.normalize ? kNormalizeRenderProgress : 1.f;
+
+  bool completed{true};
+  bool writeOK{true};
+  float peak{0.f};
+  std::vector< float > block(kVectorsPerBlock*N);
+  for(size_t start=0; start<nFrames; start += block.size())
+  {
+    size_t blockFrames = std::min(block.size(), nFrames - start);
+    std::fill(block.begin(), block.end(), 0.f);
+    renderBlock(start/N, block);
+    for(size_t i=0; i<blockFrames; ++i)
+    {
+      block[i] *= getFadeGain(start + i);
+      peak = std::max(peak, std::fabs(block[i]));
+    }
+
+    if(pTemp)
+    {
+      writeOK &= (std::fwrite(block.data(), sizeof(float), blockFrames, pTemp) == blockFrames);
+    }
+    else
+    {
+      writeOK &= writer.writeMono(block.data(), blockFrames);
+    }
+
+    if(progress && !progress(renderProgress*float(start + blockFrames)/float(nFrames)))
+    {
+      completed = false;
+      break;
+    }
+  }
+
+  // copy the output from the temporary file, scaled to a peak of 1.
+  if(pTemp)
+  {
+    float scale = (peak > 0.f) ? 1.f/peak : 1.f;
+    std::rewind(pTemp);
+    for(size_t start=0; completed && writeOK && (start<nFrames); start += block.size())
+    {
+      size_t blockFrames = std::min(block.size(), nFrames - start);
+      writeOK &= (std::fread(block.data(), sizeof(float), blockFrames, pTemp) == blockFrames);
+      for(size_t i=0; i<blockFrames; ++i)
+      {
+        block[i] *= scale;
+      }
+      writeOK &= writer.writeMono(block.data(), blockFrames);
+
+      if(progress && !progress(renderProgress + (1.f - renderProgress)*float(start + blockFrames)/float(nFrames)))
+      {
+        completed = false;
+      }
+    }
+    std::fclose(pTemp);
+  }
+  writer.close();
+
+  if(!completed || !writeOK)
+  {
+    std::remove(filePath.getText());
+    return completed ? ExportResult::kFileError : ExportResult::kCancelled;
+  }
+  return ExportResult::kOK;
+}
+
+}
+
+ExportResult ml::exportPartialsToFile(const VutuPartialsData& partialsData, const TextFragment& filePath, const ExportParams& params, ExportProgressFn progress, size_t maxThreads)
+{
+  SynthesisParams synthParams = getSynthesisParams(params);
+  auto renderBlock = [&](size_t startVector, std::vector< float >& block)
+  {
+    synthesizePartials(partialsData, synthParams, params.pipeline, startVector, block, maxThreads);
+  };
+  return exportToFile(renderBlock, filePath, params, progress);
+}
+
+ExportResult ml::exportPartialsToFile(const CompactPartials& partials, const TextFragment& filePath, const ExportParams& params, ExportProgressFn progress, size_t maxThreads)
+{
+  CompactPartialsRenderer renderer(partials, getSynthesisParams(params), params.pipeline, maxThreads);
+  auto renderBlock = [&](size_t startVector, std::vector< float >& block)
+  {
+    renderer.render(startVector, block);
+  };
+  return exportToFile(renderBlock, filePath, params, progress);
+}
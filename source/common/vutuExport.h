@@ -0,0 +1,61 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <functional>
+
+#include "vutuPartials.h"
+#include "vutuCompactPartials.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuSampleFiles.h"
+
+// rendering partials straight to a sound file, a block of time at a time, so that memory use
+// doesn't depend on the length of the output. Each block is rendered offline by
+// synthesizePartials() on all threads, so every partial is heard.
+
+namespace ml
+{
+
+struct ExportParams
+{
+  // the partials are rendered in mono, and the same signal is written to every channel.
+  SoundFileFormat format;
+
+  // length of the output in seconds.
+  float duration{0};
+
+  // partials and the ends of the output are faded over this time.
+  float fadeTime{0.001f};
+
+  // scale the output to a peak of 1. The unscaled output is kept in a temporary file until
+  // the peak is known, then scaled as it is written.
+  bool normalize{true};
+
+  // operations applied to the partials as they are rendered, without copying them. The
+  // duration is that of the output, so it should include any time scaling.
+  PartialsPipeline pipeline;
+};
+
+// called with the fraction of the export done. Return false to cancel the export.
+using ExportProgressFn = std::function< bool(float) >;
+
+enum class ExportResult
+{
+  kOK,
+  kCancelled,
+  kFileError
+};
+
+// render the partials to a sound file at the sample rate of the format. The partials' stats
+// must be up to date. A cancelled export leaves no file behind. If maxThreads is 0, all
+// hardware threads are used.
+ExportResult exportPartialsToFile(const VutuPartialsData& partialsData, const TextFragment& filePath, const ExportParams& params, ExportProgressFn progress = nullptr, size_t maxThreads = 0);
+
+// render compact partials to a sound file, expanding only the partials sounding in each
+// block. The whole set is never expanded, so very long analyses can be rendered in the
+// memory their compact form takes.
+ExportResult exportPartialsToFile(const CompactPartials& partials, const TextFragment& filePath, const ExportParams& params, ExportProgressFn progress = nullptr, size_t maxThreads = 0);
+
+}
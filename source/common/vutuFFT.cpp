@@ -0,0 +1,249 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuFFT.h"
+
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#if VUTU_SIMD_FFT
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define VUTU_FFT_SSE 1
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VUTU_FFT_AVX2 1
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VUTU_FFT_NEON 1
+#endif
+#endif
+
+using namespace ml;
+
+namespace
+{
+
+// vector operations for the SIMD passes: four floats with SSE or NEON, and eight with AVX2.
+#if VUTU_FFT_SSE
+struct V4Ops
+{
+  using V = __m128;
+  static constexpr size_t kWidth{4};
+  static V load(const float* p) { return _mm_loadu_ps(p); }
+  static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+};
+constexpr bool kHaveSIMD{true};
+#elif VUTU_FFT_NEON
+struct V4Ops
+{
+  using V = float32x4_t;
+  static constexpr size_t kWidth{4};
+  static V load(const float* p) { return vld1q_f32(p); }
+  static void store(float* p, V v) { vst1q_f32(p, v); }
+  static V add(V a, V b) { return vaddq_f32(a, b); }
+  static V sub(V a, V b) { return vsubq_f32(a, b); }
+  static V mul(V a, V b) { return vmulq_f32(a, b); }
+};
+constexpr bool kHaveSIMD{true};
+#else
+constexpr bool kHaveSIMD{false};
+#endif
+
+#if VUTU_FFT_AVX2
+struct V8Ops
+{
+  using V = __m256;
+  static constexpr size_t kWidth{8};
+  static V load(const float* p) { return _mm256_loadu_ps(p); }
+  static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+};
+#endif
+
+#if VUTU_FFT_SSE || VUTU_FFT_NEON
+// one radix-2 pass with half-size m, which must be a multiple of the vector width.
+template< typename Ops >
+void passSIMD(float* re, float* im, size_t size, size_t m, const float* wRe, const float* wIm)
+{
+  using V = typename Ops::V;
+  for(size_t k=0; k<size; k += 2*m)
+  {
+    float* aRe = re + k;
+    float* aIm = im + k;
+    float* bRe = re + k + m;
+    float* bIm = im + k + m;
+    for(size_t j=0; j<m; j += Ops::kWidth)
+    {
+      V vwRe = Ops::load(wRe + j);
+      V vwIm = Ops::load(wIm + j);
+      V vbRe = Ops::load(bRe + j);
+      V vbIm = Ops::load(bIm + j);
+      V vaRe = Ops::load(aRe + j);
+      V vaIm = Ops::load(aIm + j);
+      V tRe = Ops::sub(Ops::mul(vbRe, vwRe), Ops::mul(vbIm, vwIm));
+      V tIm = Ops::add(Ops::mul(vbRe, vwIm), Ops::mul(vbIm, vwRe));
+      Ops::store(bRe + j, Ops::sub(vaRe, tRe));
+      Ops::store(bIm + j, Ops::sub(vaIm, tIm));
+      Ops::store(aRe + j, Ops::add(vaRe, tRe));
+      Ops::store(aIm + j, Ops::add(vaIm, tIm));
+    }
+  }
+}
+#endif
+
+constexpr size_t kSIMDWidth{4};
+constexpr double kPi{3.14159265358979323846};
+
+}
+
+FFTBackend ml::getDefaultFFTBackend()
+{
+  return kHaveSIMD ? FFTBackend::kSIMD : FFTBackend::kScalar;
+}
+
+const char* ml::getFFTBackendName(FFTBackend b)
+{
+#if VUTU_FFT_AVX2
+  const char* simdName = "AVX2";
+#elif VUTU_FFT_SSE
+  const char* simdName = "SSE";
+#elif VUTU_FFT_NEON
+  const char* simdName = "NEON";
+#else
+  const char* simdName = "SIMD (unavailable)";
+#endif
+  return (b == FFTBackend::kSIMD) ? simdName : "scalar";
+}
+
+FFT::FFT(size_t size, FFTBackend backend) :
+  _size(size), _log2Size(0), _backend(kHaveSIMD ? backend : FFTBackend::kScalar)
+{
+  while((size_t(1) << _log2Size) < _size)
+  {
+    _log2Size++;
+  }
+
+  // bit reversal table
+  _bitReversed.resize(_size);
+  for(size_t i=0; i<_size; ++i)
+  {
+    size_t r{0};
+    for(size_t b=0; b<_log2Size; ++b)
+    {
+      r |= ((i >> b) & 1) << (_log2Size - 1 - b);
+    }
+    _bitReversed[i] = r;
+  }
+
+  // twiddles for the pass with half-size m are exp(-2 pi i j / 2m) for j in [0, m),
+  // stored at [m, 2m).
+  _twiddleRe.resize(std::max(_size, size_t(2)));
+  _twiddleIm.resize(std::max(_size, size_t(2)));
+  for(size_t m=1; m<_size; m <<= 1)
+  {
+    for(size_t j=0; j<m; ++j)
+    {
+      double theta = -kPi*double(j)/double(m);
+      _twiddleRe[m + j] = cos(theta);
+      _twiddleIm[m + j] = sin(theta);
+    }
+  }
+}
+
+void FFT::permute(float* re, float* im) const
+{
+  for(size_t i=0; i<_size; ++i)
+  {
+    size_t j = _bitReversed[i];
+    if(j > i)
+    {
+      std::swap(re[i], re[j]);
+      std::swap(im[i], im[j]);
+    }
+  }
+}
+
+// radix-2 passes with half-sizes from firstHalfSize up to but not including endHalfSize.
+void FFT::passesScalar(float* re, float* im, size_t firstHalfSize, size_t endHalfSize) const
+{
+  for(size_t m=firstHalfSize; m<endHalfSize; m <<= 1)
+  {
+    const float* wRe = &_twiddleRe[m];
+    const float* wIm = &_twiddleIm[m];
+    for(size_t k=0; k<_size; k += 2*m)
+    {
+      float* aRe = re + k;
+      float* aIm = im + k;
+      float* bRe = re + k + m;
+      float* bIm = im + k + m;
+      for(size_t j=0; j<m; ++j)
+      {
+        float tRe = bRe[j]*wRe[j] - bIm[j]*wIm[j];
+        float tIm = bRe[j]*wIm[j] + bIm[j]*wRe[j];
+        bRe[j] = aRe[j] - tRe;
+        bIm[j] = aIm[j] - tIm;
+        aRe[j] += tRe;
+        aIm[j] += tIm;
+      }
+    }
+  }
+}
+
+void FFT::passesSIMD(float* re, float* im) const
+{
+  // the first passes have fewer butterflies per group than the SIMD width.
+  size_t firstSIMDHalfSize = std::min(kSIMDWidth, _size);
+  passesScalar(re, im, 1, firstSIMDHalfSize);
+
+#if VUTU_FFT_SSE || VUTU_FFT_NEON
+  for(size_t m=firstSIMDHalfSize; m<_size; m <<= 1)
+  {
+#if VUTU_FFT_AVX2
+    // passes with at least eight butterflies per group use the wider vectors.
+    if(m >= V8Ops::kWidth)
+    {
+      passSIMD< V8Ops >(re, im, _size, m, &_twiddleRe[m], &_twiddleIm[m]);
+      continue;
+    }
+#endif
+    passSIMD< V4Ops >(re, im, _size, m, &_twiddleRe[m], &_twiddleIm[m]);
+  }
+#else
+  passesScalar(re, im, firstSIMDHalfSize, _size);
+#endif
+}
+
+void FFT::forward(float* re, float* im) const
+{
+  if(_size < 2) return;
+  permute(re, im);
+  if(_backend == FFTBackend::kSIMD)
+  {
+    passesSIMD(re, im);
+  }
+  else
+  {
+    passesScalar(re, im, 1, _size);
+  }
+}
+
+void FFT::inverse(float* re, float* im) const
+{
+  // the inverse transform is the forward transform with real and imaginary parts swapped.
+  forward(im, re);
+  float scale = 1.f/float(_size);
+  for(size_t i=0; i<_size; ++i)
+  {
+    re[i] *= scale;
+    im[i] *= scale;
+  }
+}
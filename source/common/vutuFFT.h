@@ -0,0 +1,75 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// a complex FFT for vutu's own spectral work. Data are in split format
+// (separate real and imaginary arrays) so the butterflies can run on SIMD vectors.
+//
+// The SIMD kernels use SSE on x86 and NEON on ARM. They are built when VUTU_SIMD_FFT is
+// nonzero, which is set by the CMake option of the same name. When the compiler targets
+// AVX2, as it does with the CMake option VUTU_AVX2_FFT, the larger passes use eight-float
+// AVX2 vectors instead.
+
+#ifndef VUTU_SIMD_FFT
+#define VUTU_SIMD_FFT 1
+#endif
+
+namespace ml
+{
+
+enum class FFTBackend
+{
+  kScalar,
+  kSIMD
+};
+
+// return the fastest backend available in this build.
+FFTBackend getDefaultFFTBackend();
+
+const char* getFFTBackendName(FFTBackend b);
+
+class FFT
+{
+public:
+  // size must be a power of two.
+  explicit FFT(size_t size, FFTBackend backend = getDefaultFFTBackend());
+
+  size_t getSize() const { return _size; }
+
+  // forward transform in place, unscaled.
+  void forward(float* re, float* im) const;
+
+  // inverse transform in place, scaled by 1/size so that inverse(forward(x)) = x.
+  void inverse(float* re, float* im) const;
+
+private:
+  size_t _size;
+  size_t _log2Size;
+  FFTBackend _backend;
+  std::vector< size_t > _bitReversed;
+
+  // twiddles for each pass, stored at an offset equal to the half-size of the pass.
+  std::vector< float > _twiddleRe;
+  std::vector< float > _twiddleIm;
+
+  void permute(float* re, float* im) const;
+  void passesScalar(float* re, float* im, size_t firstHalfSize, size_t endHalfSize) const;
+  void passesSIMD(float* re, float* im) const;
+};
+
+inline size_t nextPowerOfTwo(size_t n)
+{
+  size_t p = 1;
+  while(p < n)
+  {
+    p <<= 1;
+  }
+  return p;
+}
+
+}
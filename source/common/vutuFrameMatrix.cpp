@@ -0,0 +1,363 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuFrameMatrix.h"
+#include "vutuThreads.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <queue>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr char kFrameMatrixTag[4]{'V', 'U', 'F', 'M'};
+constexpr uint32_t kFrameMatrixVersion{1};
+constexpr float kTwoPi{6.283185307179586f};
+
+// partials per job when resampling in parallel.
+constexpr size_t kFramePartialsPerJob{64};
+
+// the frames covered by a partial, not counting its empty frames at each end.
+struct FrameRange
+{
+  size_t first{0};
+  size_t last{0};
+};
+
+// the stream is little-endian, so values are byte-swapped on big-endian hosts.
+inline bool isHostLittleEndian()
+{
+  const uint32_t one{1};
+  unsigned char firstByte;
+  std::memcpy(&firstByte, &one, 1);
+  return firstByte == 1;
+}
+
+inline void swapBytes(char* p, size_t valueSize, size_t nValues)
+{
+  for(size_t i=0; i<nValues; ++i)
+  {
+    std::reverse(p + i*valueSize, p + (i + 1)*valueSize);
+  }
+}
+
+template< typename T >
+void writeValue(std::ostream& out, T x)
+{
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, &x, sizeof(T));
+  if(!isHostLittleEndian()) swapBytes(bytes, sizeof(T), 1);
+  out.write(bytes, sizeof(T));
+}
+
+template< typename T >
+T readValue(std::istream& in)
+{
+  char bytes[sizeof(T)]{};
+  in.read(bytes, sizeof(T));
+  if(!isHostLittleEndian()) swapBytes(bytes, sizeof(T), 1);
+  T x;
+  std::memcpy(&x, bytes, sizeof(T));
+  return x;
+}
+
+void writeFloats(std::ostream& out, const float* p, size_t n, std::vector< char >& temp)
+{
+  const char* bytes = reinterpret_cast< const char* >(p);
+  if(!isHostLittleEndian())
+  {
+    temp.assign(bytes, bytes + n*sizeof(float));
+    swapBytes(temp.data(), sizeof(float), n);
+    bytes = temp.data();
+  }
+  out.write(bytes, n*sizeof(float));
+}
+
+void readFloats(std::istream& in, float* p, size_t n)
+{
+  char* bytes = reinterpret_cast< char* >(p);
+  in.read(bytes, n*sizeof(float));
+  if(!isHostLittleEndian()) swapBytes(bytes, sizeof(float), n);
+}
+
+// read n floats onto the end of v, growing it no more than kReadChunk floats ahead of the
+// data actually read.
+void appendFloats(std::istream& in, std::vector< float >& v, size_t n)
+{
+  constexpr size_t kReadChunk{1 << 16};
+  while(n && in)
+  {
+    size_t chunk = std::min(n, kReadChunk);
+    size_t i = v.size();
+    v.resize(i + chunk);
+    readFloats(in, v.data() + i, chunk);
+    n -= chunk;
+  }
+}
+
+// get the number of bytes left in the stream, or -1 if it can't be found.
+int64_t getBytesLeft(std::istream& in)
+{
+  std::istream::pos_type pos = in.tellg();
+  if(pos == std::istream::pos_type(-1)) return -1;
+  in.seekg(0, std::ios::end);
+  std::istream::pos_type end = in.tellg();
+  in.seekg(pos);
+  if(!in || (end == std::istream::pos_type(-1))) return -1;
+  return int64_t(end - pos);
+}
+
+// resample one partial into its voice's column of the matrix.
+void resamplePartial(const VutuPartial& p, FrameRange r, size_t voice, FrameMatrix& m)
+{
+  const size_t n = p.time.size();
+  size_t c{0};
+  for(size_t k=r.first; k<=r.last; ++k)
+  {
+    float t = m.getFrameTime(k);
+    while((c + 2 < n) && (p.time[c + 1] <= t)) c++;
+    size_t c1 = std::min(c + 1, n - 1);
+    float dt = p.time[c1] - p.time[c];
+    float x = (dt > 0.f) ? clamp((t - p.time[c])/dt, 0.f, 1.f) : 0.f;
+    size_t i = m.getIndex(k, voice);
+    m.amp[i] = lerp(p.amp[c], p.amp[c1], x);
+    m.freq[i] = lerp(p.freq[c], p.freq[c1], x);
+    m.bandwidth[i] = lerp(p.bandwidth[c], p.bandwidth[c1], x);
+  }
+
+  // silent frames at each end, at the end frequencies
+  m.freq[m.getIndex(r.first - 1, voice)] = m.freq[m.getIndex(r.first, voice)];
+  m.freq[m.getIndex(r.last + 1, voice)] = m.freq[m.getIndex(r.last, voice)];
+}
+
+}
+
+std::shared_ptr< const FrameMatrix > ml::makeFrameMatrix(const VutuPartialsData& partialsData, float hop, size_t maxThreads)
+{
+  auto pMatrix = std::make_shared< FrameMatrix >();
+  FrameMatrix& m = *pMatrix;
+  const size_t nPartials = partialsData.partials.size();
+  m.hop = hop;
+
+  // frame 0 is one hop before time 0, so that partials starting at 0 have a silent frame.
+  m.startTime = -hop;
+  std::vector< FrameRange > ranges(nPartials);
+  std::vector< size_t > order;
+  order.reserve(nPartials);
+  size_t lastFrame{0};
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    const VutuPartial& p = partialsData.partials[i];
+    if(!p.time.size()) continue;
+    float t0 = std::max(p.time.front(), 0.f);
+    float t1 = std::max(p.time.back(), t0);
+    long first = std::lround(std::ceil(t0/hop)) + 1;
+    long last = std::lround(std::floor(t1/hop)) + 1;
+    if(first > last)
+    {
+      // shorter than a hop: use the nearest frame.
+      first = last = std::lround(0.5f*(t0 + t1)/hop) + 1;
+    }
+    ranges[i] = FrameRange{size_t(first), size_t(last)};
+    order.push_back(i);
+    lastFrame = std::max(lastFrame, size_t(last));
+  }
+  m.nFrames = nPartials ? lastFrame + 2 : 0;
+
+  // allocate voices in order of start, reusing the voice that became free first. A partial
+  // uses frames first - 1 through last + 1.
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return ranges[a].first < ranges[b].first; });
+  m.partialVoice.assign(nPartials, FrameMatrix::kNoVoice);
+  using VoiceEnd = std::pair< size_t, uint32_t >;
+  std::priority_queue< VoiceEnd, std::vector< VoiceEnd >, std::greater< VoiceEnd > > voiceEnds;
+  for(size_t i : order)
+  {
+    uint32_t v;
+    if(!voiceEnds.empty() && (voiceEnds.top().first < ranges[i].first - 1))
+    {
+      v = voiceEnds.top().second;
+      voiceEnds.pop();
+    }
+    else
+    {
+      v = uint32_t(m.nVoices++);
+    }
+    m.partialVoice[i] = v;
+    voiceEnds.push({ranges[i].last + 1, v});
+  }
+
+  // each partial writes only its own voice's frames, so they can be resampled in parallel.
+  size_t nCells = m.nFrames*m.nVoices;
+  m.amp.assign(nCells, 0.f);
+  m.freq.assign(nCells, 0.f);
+  m.bandwidth.assign(nCells, 0.f);
+  size_t nJobs = (nPartials + kFramePartialsPerJob - 1)/kFramePartialsPerJob;
+  parallelFor(nJobs, [&](size_t job)
+  {
+    size_t end = std::min(nPartials, (job + 1)*kFramePartialsPerJob);
+    for(size_t i=job*kFramePartialsPerJob; i<end; ++i)
+    {
+      if(m.partialVoice[i] == FrameMatrix::kNoVoice) continue;
+      resamplePartial(partialsData.partials[i], ranges[i], m.partialVoice[i], m);
+    }
+  }, maxThreads);
+
+  return pMatrix;
+}
+
+bool ml::writeFrameMatrix(const FrameMatrix& m, std::ostream& out)
+{
+  out.write(kFrameMatrixTag, 4);
+  writeValue(out, kFrameMatrixVersion);
+  writeValue(out, m.hop);
+  writeValue(out, m.startTime);
+  writeValue(out, uint32_t(m.nVoices));
+  writeValue(out, uint32_t(m.nFrames));
+  std::vector< char > temp;
+  for(size_t k=0; k<m.nFrames; ++k)
+  {
+    size_t i = m.getIndex(k, 0);
+    writeFloats(out, m.amp.data() + i, m.nVoices, temp);
+    writeFloats(out, m.freq.data() + i, m.nVoices, temp);
+    writeFloats(out, m.bandwidth.data() + i, m.nVoices, temp);
+  }
+  return bool(out);
+}
+
+bool ml::readFrameMatrix(std::istream& in, FrameMatrix& m)
+{
+  char tag[4]{};
+  in.read(tag, 4);
+  if(!in || !std::equal(tag, tag + 4, kFrameMatrixTag)) return false;
+  if(readValue< uint32_t >(in) != kFrameMatrixVersion) return false;
+  m.hop = readValue< float >(in);
+  m.startTime = readValue< float >(in);
+  m.nVoices = readValue< uint32_t >(in);
+  m.nFrames = readValue< uint32_t >(in);
+  if(!in || !(m.hop > 0.f)) return false;
+
+  // the sizes are 32 bits each, so the number of cells fits in 64 bits. If the stream is
+  // shorter than the frames it claims to hold, the header is bad.
+  const uint64_t nCells = uint64_t(m.nVoices)*m.nFrames;
+  const uint64_t cellBytes = 3*sizeof(float);
+  if(nCells > std::numeric_limits< size_t >::max()/cellBytes) return false;
+  int64_t bytesLeft = getBytesLeft(in);
+  bool sizeKnown = (bytesLeft >= 0);
+  if(sizeKnown && (uint64_t(bytesLeft)/cellBytes < nCells)) return false;
+
+  // allocate the whole matrix only when the stream is known to hold it. Otherwise grow it
+  // a bounded chunk at a time as the frames are read, so a bad header fails at the end of
+  // the stream.
+  m.amp.resize(sizeKnown ? nCells : 0);
+  m.freq.resize(sizeKnown ? nCells : 0);
+  m.bandwidth.resize(sizeKnown ? nCells : 0);
+  m.partialVoice.clear();
+  for(size_t k=0; (k < m.nFrames) && in; ++k)
+  {
+    if(sizeKnown)
+    {
+      size_t i = m.getIndex(k, 0);
+      readFloats(in, m.amp.data() + i, m.nVoices);
+      readFloats(in, m.freq.data() + i, m.nVoices);
+      readFloats(in, m.bandwidth.data() + i, m.nVoices);
+    }
+    else
+    {
+      appendFloats(in, m.amp, m.nVoices);
+      appendFloats(in, m.freq, m.nVoices);
+      appendFloats(in, m.bandwidth, m.nVoices);
+    }
+  }
+  return bool(in);
+}
+
+void FrameMatrixPlayer::setFrameMatrix(std::shared_ptr< const FrameMatrix > pMatrix, float sampleRate)
+{
+  _pMatrix = pMatrix;
+  _sampleRate = sampleRate;
+  size_t nVoices = pMatrix ? pMatrix->nVoices : 0;
+  _phase.assign(nVoices, 0.);
+  _noise.resize(nVoices);
+  start(0.);
+}
+
+void FrameMatrixPlayer::start(double time)
+{
+  _time = time;
+  for(size_t v=0; v<_phase.size(); ++v)
+  {
+    _phase[v] = 0.;
+    _noise[v].start(getNoiseHash(uint32_t(v), 0x564d4658u), time, _sampleRate);
+  }
+}
+
+bool FrameMatrixPlayer::processVector(DSPVector& out)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  if(!_pMatrix || (_pMatrix->nFrames < 2)) return false;
+  const FrameMatrix& m = *_pMatrix;
+
+  double t0 = _time;
+  double t1 = t0 + double(N)/_sampleRate;
+  _time = t1;
+
+  // the frames around each end of the vector
+  double x0 = (t0 - m.startTime)/m.hop;
+  double x1 = (t1 - m.startTime)/m.hop;
+  const double lastX = double(m.nFrames - 1);
+  if(x0 >= lastX) return false;
+  x0 = clamp(x0, 0., lastX);
+  x1 = clamp(x1, 0., lastX);
+  size_t k0 = std::min(size_t(x0), m.nFrames - 2);
+  size_t k1 = std::min(size_t(x1), m.nFrames - 2);
+  float a0 = float(x0 - k0);
+  float a1 = float(x1 - k1);
+  const size_t i0 = m.getIndex(k0, 0), j0 = m.getIndex(k0 + 1, 0);
+  const size_t i1 = m.getIndex(k1, 0), j1 = m.getIndex(k1 + 1, 0);
+
+  const float nyquist = _sampleRate*0.5f;
+  const DSPVector idx = columnIndex();
+  for(size_t v=0; v<m.nVoices; ++v)
+  {
+    float amp0 = lerp(m.amp[i0 + v], m.amp[j0 + v], a0);
+    float amp1 = lerp(m.amp[i1 + v], m.amp[j1 + v], a1);
+    if((amp0 == 0.f) && (amp1 == 0.f))
+    {
+      _phase[v] = 0.;
+      _noise[v].skipVector();
+      continue;
+    }
+    float freq0 = lerp(m.freq[i0 + v], m.freq[j0 + v], a0);
+    float freq1 = lerp(m.freq[i1 + v], m.freq[j1 + v], a1);
+    float bw0 = lerp(m.bandwidth[i0 + v], m.bandwidth[j0 + v], a0);
+    float bw1 = lerp(m.bandwidth[i1 + v], m.bandwidth[j1 + v], a1);
+    if(freq0 >= nyquist) amp0 = 0.f;
+    if(freq1 >= nyquist) amp1 = 0.f;
+
+    // phase over the vector from the linear frequency ramp, in cycles
+    double f0 = freq0/_sampleRate;
+    double f1 = freq1/_sampleRate;
+    double quadratic = (f1 - f0)/(2.*N);
+    DSPVector phase = DSPVector(float(_phase[v])) + idx*(DSPVector(float(f0)) + idx*DSPVector(float(quadratic)));
+    double p1 = _phase[v] + 0.5*(f0 + f1)*N;
+    _phase[v] = p1 - std::floor(p1);
+
+    DSPVector amp = DSPVector(amp0) + idx*DSPVector((amp1 - amp0)/N);
+    if((bw0 > 0.f) || (bw1 > 0.f))
+    {
+      amp = amp*getBandwidthModulation(_noise[v], bw0, bw1);
+    }
+    else
+    {
+      _noise[v].skipVector();
+    }
+    out = out + amp*cos(fractionalPart(phase)*DSPVector(kTwoPi));
+  }
+  return true;
+}
@@ -0,0 +1,86 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "vutuPartials.h"
+#include "vutuNoise.h"
+
+// partials resampled onto a grid of frames at a uniform hop, with each partial allocated to
+// a voice. Frames are stored one after another, each with the amp, freq and bandwidth of
+// every voice, so playing or drawing the partials in time order is a straight walk through
+// memory with no searching, and frames can be streamed as they are needed.
+//
+// A voice is only reused two empty frames after its last partial ends. The empty frame at
+// each end of a partial has zero amp and the partial's end frequency, so each partial fades in
+// and out at a constant frequency. Phases are not kept: a voice starts again at phase 0
+// whenever its amp is 0.
+
+namespace ml
+{
+
+constexpr float kDefaultFrameHop{0.005f};
+
+struct FrameMatrix
+{
+  float hop{kDefaultFrameHop};
+  float startTime{0};
+  size_t nFrames{0};
+  size_t nVoices{0};
+
+  // values of voice v in frame k are at [k*nVoices + v].
+  std::vector< float > amp;
+  std::vector< float > freq;
+  std::vector< float > bandwidth;
+
+  // the voice of each partial, or kNoVoice if it has no breakpoints. A partial shorter than
+  // a hop still gets a voice, at its nearest frame.
+  std::vector< uint32_t > partialVoice;
+
+  static constexpr uint32_t kNoVoice{0xFFFFFFFF};
+
+  size_t getIndex(size_t frame, size_t voice) const { return frame*nVoices + voice; }
+  float getFrameTime(size_t frame) const { return startTime + frame*hop; }
+  size_t getBytes() const { return (amp.size() + freq.size() + bandwidth.size())*sizeof(float); }
+};
+
+// make the frame matrix of the partials, resampling the partials in parallel.
+std::shared_ptr< const FrameMatrix > makeFrameMatrix(const VutuPartialsData& partialsData, float hop = kDefaultFrameHop, size_t maxThreads = 0);
+
+// write the matrix as a stream: a header with the hop, start time and sizes, then the frames
+// in order, each with the amp, freq and bandwidth of every voice. All values are written
+// little-endian, whatever the byte order of the host.
+bool writeFrameMatrix(const FrameMatrix& m, std::ostream& out);
+
+// read a matrix written by writeFrameMatrix(). The sizes in the header are checked against
+// the length of the stream when it can be found, and the frames are read one at a time
+// otherwise, so a bad header can't make a huge allocation. Returns false if the stream is
+// not a whole matrix.
+bool readFrameMatrix(std::istream& in, FrameMatrix& m);
+
+// plays a frame matrix forwards from any time.
+class FrameMatrixPlayer
+{
+public:
+  // set the matrix to play. This allocates, so it must not be called from the audio thread.
+  void setFrameMatrix(std::shared_ptr< const FrameMatrix > pMatrix, float sampleRate);
+
+  void start(double time);
+
+  // add one DSPVector of output to out. Returns false once past the last frame.
+  bool processVector(DSPVector& out);
+
+private:
+  std::shared_ptr< const FrameMatrix > _pMatrix;
+  float _sampleRate{48000};
+  double _time{0};
+  std::vector< double > _phase;
+  std::vector< BandwidthNoise > _noise;
+};
+
+}
@@ -0,0 +1,248 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuIncrementalStats.h"
+
+using namespace ml;
+
+namespace
+{
+
+inline size_t getTimeBin(float t)
+{
+  return size_t(std::max(t, 0.f)/IncrementalStats::kTimeResolution);
+}
+
+}
+
+void IncrementalStats::CountedRange::add(Interval r)
+{
+  lows.insert(r.mX1);
+  highs.insert(r.mX2);
+}
+
+void IncrementalStats::CountedRange::remove(Interval r)
+{
+  auto lo = lows.find(r.mX1);
+  if(lo != lows.end()) lows.erase(lo);
+  auto hi = highs.find(r.mX2);
+  if(hi != highs.end()) highs.erase(hi);
+}
+
+Interval IncrementalStats::CountedRange::get() const
+{
+  // with no partials, this is the empty range that calcStats() starts from.
+  if(lows.empty()) return Interval{std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
+  return Interval{*lows.begin(), *highs.rbegin()};
+}
+
+void IncrementalStats::PolyphonyTree::clear()
+{
+  _nLeaves = 0;
+  _max.clear();
+  _add.clear();
+}
+
+// double the number of leaves until there are more than nBins. The old tree becomes the
+// left half of the new one, so node 2^d + k moves to 2^(d + 1) + k.
+void IncrementalStats::PolyphonyTree::grow(size_t nBins)
+{
+  size_t newLeaves = std::max(_nLeaves, size_t(1));
+  while(newLeaves < nBins) newLeaves *= 2;
+  if(newLeaves == _nLeaves) return;
+
+  std::vector< int > newMax(2*newLeaves), newAdd(2*newLeaves);
+  if(_nLeaves)
+  {
+    size_t shift{0};
+    for(size_t n=_nLeaves; n<newLeaves; n *= 2) shift++;
+    for(size_t levelStart=1; levelStart<2*_nLeaves; levelStart *= 2)
+    {
+      for(size_t k=0; k<levelStart; ++k)
+      {
+        newMax[(levelStart << shift) + k] = _max[levelStart + k];
+        newAdd[(levelStart << shift) + k] = _add[levelStart + k];
+      }
+    }
+    for(size_t node=size_t(1) << (shift - 1); node>=1; node /= 2)
+    {
+      newMax[node] = std::max(newMax[2*node], newMax[2*node + 1]);
+    }
+  }
+  _nLeaves = newLeaves;
+  _max = std::move(newMax);
+  _add = std::move(newAdd);
+}
+
+void IncrementalStats::PolyphonyTree::addToNode(size_t node, size_t lo, size_t hi, size_t bin0, size_t bin1, int delta)
+{
+  if((bin1 < lo) || (hi < bin0)) return;
+  if((bin0 <= lo) && (hi <= bin1))
+  {
+    _max[node] += delta;
+    _add[node] += delta;
+    return;
+  }
+  size_t mid = (lo + hi)/2;
+  addToNode(2*node, lo, mid, bin0, bin1, delta);
+  addToNode(2*node + 1, mid + 1, hi, bin0, bin1, delta);
+  _max[node] = _add[node] + std::max(_max[2*node], _max[2*node + 1]);
+}
+
+void IncrementalStats::PolyphonyTree::add(size_t bin0, size_t bin1, int delta)
+{
+  grow(bin1 + 1);
+  addToNode(1, 0, _nLeaves - 1, bin0, bin1, delta);
+}
+
+size_t IncrementalStats::PolyphonyTree::getMaxBin() const
+{
+  if(!_nLeaves) return 0;
+  size_t node{1};
+  while(node < _nLeaves)
+  {
+    node = (_max[2*node + 1] >= _max[2*node]) ? 2*node + 1 : 2*node;
+  }
+  return node - _nLeaves;
+}
+
+void IncrementalStats::PolyphonyTree::getNodeCounts(size_t node, size_t lo, size_t hi, int above, std::vector< int >& counts) const
+{
+  if(lo == hi)
+  {
+    counts[lo] = above + _add[node];
+    return;
+  }
+  size_t mid = (lo + hi)/2;
+  getNodeCounts(2*node, lo, mid, above + _add[node], counts);
+  getNodeCounts(2*node + 1, mid + 1, hi, above + _add[node], counts);
+}
+
+void IncrementalStats::PolyphonyTree::getCounts(std::vector< int >& counts) const
+{
+  counts.assign(_nLeaves, 0);
+  if(_nLeaves)
+  {
+    getNodeCounts(1, 0, _nLeaves - 1, 0, counts);
+  }
+}
+
+void IncrementalStats::addExtent(const VutuPartial& partial, const PartialExtent& e, int delta)
+{
+  // a partial with no breakpoints has no extent, and adds nothing.
+  if(partial.time.empty()) return;
+
+  if(delta > 0)
+  {
+    _time.add(e.time);
+    _amp.add(e.amp);
+    _bandwidth.add(e.bandwidth);
+    _freq.add(e.freq);
+  }
+  else
+  {
+    _time.remove(e.time);
+    _amp.remove(e.amp);
+    _bandwidth.remove(e.bandwidth);
+    _freq.remove(e.freq);
+  }
+  _polyphony.add(getTimeBin(e.time.mX1), getTimeBin(e.time.mX2), delta);
+}
+
+void IncrementalStats::writeStats(VutuPartialsData& p) const
+{
+  p.stats.timeRange = _time.get();
+  p.stats.ampRange = _amp.get();
+  p.stats.bandwidthRange = _bandwidth.get();
+  p.stats.freqRange = _freq.get();
+  p.stats.nPartials = p.partials.size();
+  p.stats.maxActivePartials = _polyphony.getMax();
+  p.stats.maxActiveTime = p.stats.maxActivePartials ? _polyphony.getMaxBin()*kTimeResolution : 0.f;
+  p.stats.polyphony = PolyphonyTimeline();
+}
+
+void IncrementalStats::updatePolyphonyTimeline(VutuPartialsData& p) const
+{
+  std::vector< int > counts;
+  _polyphony.getCounts(counts);
+  PolyphonyTimeline& timeline = p.stats.polyphony;
+  timeline = PolyphonyTimeline();
+  for(size_t b=0; b<counts.size(); ++b)
+  {
+    uint32_t c = uint32_t(std::max(counts[b], 0));
+    if(timeline.counts.empty() ? (c > 0) : (timeline.counts.back() != c))
+    {
+      timeline.times.push_back(b*kTimeResolution);
+      timeline.counts.push_back(c);
+    }
+  }
+  if(timeline.counts.size() && timeline.counts.back())
+  {
+    timeline.times.push_back(counts.size()*kTimeResolution);
+    timeline.counts.push_back(0);
+  }
+  timeline.updatePercentiles();
+}
+
+void IncrementalStats::build(VutuPartialsData& p)
+{
+  *this = IncrementalStats();
+  const size_t nPartials = p.partials.size();
+  _extents.resize(nPartials);
+  p.stats.partialTimeRanges.resize(nPartials);
+  p.stats.summaries.resize(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    _extents[i] = getPartialExtent(p.partials[i]);
+    addExtent(p.partials[i], _extents[i], 1);
+    p.stats.partialTimeRanges[i] = _extents[i].time;
+    summarizePartial(p.partials[i], _extents[i], p.stats.summaries, i);
+  }
+  writeStats(p);
+  updatePolyphonyTimeline(p);
+}
+
+size_t IncrementalStats::addPartial(VutuPartialsData& p, VutuPartial partial)
+{
+  size_t index = p.partials.size();
+  PartialExtent e = getPartialExtent(partial);
+  p.partials.push_back(std::move(partial));
+  _extents.push_back(e);
+  p.stats.partialTimeRanges.push_back(e.time);
+  p.stats.summaries.resize(index + 1);
+  summarizePartial(p.partials[index], e, p.stats.summaries, index);
+  addExtent(p.partials[index], e, 1);
+  writeStats(p);
+  return index;
+}
+
+void IncrementalStats::removePartial(VutuPartialsData& p, size_t index)
+{
+  if(index >= p.partials.size()) return;
+  addExtent(p.partials[index], _extents[index], -1);
+  if(index + 1 < p.partials.size())
+  {
+    p.partials[index] = std::move(p.partials.back());
+    _extents[index] = _extents.back();
+    p.stats.partialTimeRanges[index] = p.stats.partialTimeRanges.back();
+  }
+  p.partials.pop_back();
+  _extents.pop_back();
+  p.stats.partialTimeRanges.pop_back();
+  p.stats.summaries.swapRemove(index);
+  writeStats(p);
+}
+
+void IncrementalStats::replacePartial(VutuPartialsData& p, size_t index, VutuPartial partial)
+{
+  if(index >= p.partials.size()) return;
+  addExtent(p.partials[index], _extents[index], -1);
+  PartialExtent e = getPartialExtent(partial);
+  p.partials[index] = std::move(partial);
+  _extents[index] = e;
+  p.stats.partialTimeRanges[index] = e.time;
+  summarizePartial(p.partials[index], e, p.stats.summaries, index);
+  addExtent(p.partials[index], e, 1);
+  writeStats(p);
+}
@@ -0,0 +1,97 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <set>
+#include <vector>
+
+#include "vutuPartials.h"
+
+// partials stats that are kept up to date as partials are added, removed or replaced, for
+// editing and progressive analysis. The parameter ranges are kept as counted sets of the
+// extrema of each partial, and the number of active partials as a segment tree of counts
+// over time bins, so each edit costs O(log n), plus the length of the partial, instead of a
+// calcStats() rerun. To keep this cost, partials are only added at the end, and a removed
+// partial is replaced by the last one, so edits don't keep the order of the partials.
+//
+// The polyphony is counted per time bin of kTimeResolution, so partials that meet within
+// one bin count as overlapping, and maxActiveTime is the start of a bin. The counts can be
+// slightly above those from calcStats(), never below. Edits clear the polyphony timeline,
+// which costs O(bins) to make, so it is remade only on request. Partials with no
+// breakpoints keep their place in the list, but add nothing to the ranges or the polyphony.
+
+namespace ml
+{
+
+class IncrementalStats
+{
+public:
+  static constexpr float kTimeResolution{0.01f};
+
+  // start tracking the partials, and fill in all their stats.
+  void build(VutuPartialsData& p);
+
+  // edit the partials, updating p.stats. The partials must have been built first.
+
+  // add a partial after the others, and return its index.
+  size_t addPartial(VutuPartialsData& p, VutuPartial partial);
+
+  // remove partial index, moving the last partial into its place.
+  void removePartial(VutuPartialsData& p, size_t index);
+
+  // replace partial index, for instance with a trimmed or edited copy.
+  void replacePartial(VutuPartialsData& p, size_t index, VutuPartial partial);
+
+  // make p.stats.polyphony from the binned counts.
+  void updatePolyphonyTimeline(VutuPartialsData& p) const;
+
+private:
+  // a multiset of the lower and upper ends of a range per partial.
+  struct CountedRange
+  {
+    std::multiset< float > lows;
+    std::multiset< float > highs;
+
+    void add(Interval r);
+    void remove(Interval r);
+    Interval get() const;
+  };
+
+  // counts of active partials per time bin, with range add and max in O(log bins).
+  class PolyphonyTree
+  {
+  public:
+    void clear();
+    void add(size_t bin0, size_t bin1, int delta);
+    int getMax() const { return _max.size() ? _max[1] : 0; }
+
+    // get the last bin where the count is at its maximum.
+    size_t getMaxBin() const;
+
+    // get the count in every bin.
+    void getCounts(std::vector< int >& counts) const;
+
+  private:
+    size_t _nLeaves{0};
+    std::vector< int > _max;
+    std::vector< int > _add;
+
+    void grow(size_t nBins);
+    void addToNode(size_t node, size_t lo, size_t hi, size_t bin0, size_t bin1, int delta);
+    void getNodeCounts(size_t node, size_t lo, size_t hi, int above, std::vector< int >& counts) const;
+  };
+
+  CountedRange _time;
+  CountedRange _amp;
+  CountedRange _bandwidth;
+  CountedRange _freq;
+  PolyphonyTree _polyphony;
+  std::vector< PartialExtent > _extents;
+
+  void addExtent(const VutuPartial& partial, const PartialExtent& e, int delta);
+  void writeStats(VutuPartialsData& p) const;
+};
+
+}
@@ -0,0 +1,148 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuInstrument.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ml;
+
+void PartialsInstrument::setPartials(const VutuPartialsData* pPartials, float sampleRate, size_t nVoices)
+{
+  _sampleRate = sampleRate;
+  _voices.clear();
+  _voices.resize(pPartials ? nVoices : 0);
+  for(auto& v : _voices)
+  {
+    v.player.setPartials(pPartials, sampleRate);
+    v.player.setCulling(true);
+  }
+
+  float f0 = pPartials ? pPartials->fundamental : 0.f;
+  _referenceNote = (f0 > 0.f) ? 69.f + 12.f*std::log2(f0/440.f) : 60.f;
+  _noteCounter = 0;
+}
+
+void PartialsInstrument::noteOn(int note, float velocity)
+{
+  if(_voices.empty()) return;
+
+  // take a free voice, or else the oldest releasing voice, or else the oldest voice.
+  Voice* pVoice{nullptr};
+  for(auto& v : _voices)
+  {
+    if(!v.player.isPlaying())
+    {
+      pVoice = &v;
+      break;
+    }
+  }
+  if(!pVoice)
+  {
+    auto isOlder = [](const Voice& a, const Voice& b)
+    {
+      return (a.releasing != b.releasing) ? a.releasing : (a.age < b.age);
+    };
+    pVoice = &*std::min_element(_voices.begin(), _voices.end(), isOlder);
+  }
+
+  Voice& v = *pVoice;
+  v.note = note;
+  v.gain = clamp(velocity, 0.f, 1.f);
+  v.gainStep = 0.f;
+  v.releasing = false;
+  v.age = _noteCounter++;
+  v.player.setPitchRatio(std::exp2((note - _referenceNote)/12.f));
+  v.player.start(0.);
+}
+
+void PartialsInstrument::noteOff(int note)
+{
+  const float vectorsPerRelease = std::max(kReleaseTime*_sampleRate/kFloatsPerDSPVector, 1.f);
+  for(auto& v : _voices)
+  {
+    if(v.player.isPlaying() && !v.releasing && (v.note == note))
+    {
+      v.releasing = true;
+      v.gainStep = v.gain/vectorsPerRelease;
+    }
+  }
+}
+
+void PartialsInstrument::allNotesOff()
+{
+  for(auto& v : _voices)
+  {
+    stopVoice(v);
+  }
+}
+
+void PartialsInstrument::handleEvent(const NoteEvent& e)
+{
+  if(e.velocity > 0.f)
+  {
+    noteOn(e.note, e.velocity);
+  }
+  else
+  {
+    noteOff(e.note);
+  }
+}
+
+void PartialsInstrument::stopVoice(Voice& v)
+{
+  v.player.stop();
+  v.note = -1;
+  v.gain = 0.f;
+  v.releasing = false;
+}
+
+size_t PartialsInstrument::getActiveVoiceCount() const
+{
+  return std::count_if(_voices.begin(), _voices.end(), [](const Voice& v) { return v.player.isPlaying(); });
+}
+
+void PartialsInstrument::processVector(DSPVector& out)
+{
+  const DSPVector rampIndex = (columnIndex() + DSPVector(1.f))*DSPVector(1.f/kFloatsPerDSPVector);
+  for(auto& v : _voices)
+  {
+    if(!v.player.isPlaying()) continue;
+
+    float g0 = v.gain;
+    float g1 = v.releasing ? std::max(g0 - v.gainStep, 0.f) : g0;
+    DSPVector voice;
+    bool playing = v.player.processVector(voice);
+    out = out + voice*(DSPVector(g0) + DSPVector(g1 - g0)*rampIndex);
+    v.gain = g1;
+
+    // free the voice once it has run off the end of the partials or finished its release.
+    if(!playing || (g1 == 0.f))
+    {
+      stopVoice(v);
+    }
+  }
+}
+
+void ml::renderNoteEvents(PartialsInstrument& instrument, const std::vector< NoteEvent >& events, std::vector< float >& out)
+{
+  const size_t nVectors = out.size()/kFloatsPerDSPVector;
+  const double sr = instrument.getSampleRate();
+  size_t nextEvent{0};
+  for(size_t i=0; i<nVectors; ++i)
+  {
+    double vectorEnd = double((i + 1)*kFloatsPerDSPVector)/sr;
+    for(; (nextEvent < events.size()) && (events[nextEvent].time < vectorEnd); ++nextEvent)
+    {
+      instrument.handleEvent(events[nextEvent]);
+    }
+
+    float* pVec = out.data() + i*kFloatsPerDSPVector;
+    DSPVector v;
+    load(v, pVec);
+    instrument.processVector(v);
+    store(v, pVec);
+  }
+}
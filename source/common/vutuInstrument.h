@@ -0,0 +1,118 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include "vutuPartialsPlayer.h"
+
+// a polyphonic instrument made from a set of partials. Each note plays the partials from
+// their start, transposed by the ratio of the note's frequency to the fundamental of the
+// partials. Note voices, and the oscillators of each voice, are allocated when the partials
+// are set, so nothing is allocated while playing.
+
+namespace ml
+{
+
+// a note on or off at a time in seconds. A velocity of 0 is a note off.
+struct NoteEvent
+{
+  double time{0};
+  int note{0};
+  float velocity{0};
+};
+
+// a queue of note events from one thread to another, such as from the message thread to the
+// audio thread. It holds a fixed number of events and never allocates.
+class NoteEventQueue
+{
+public:
+  static constexpr size_t kCapacity{256};
+
+  // add an event. Returns false if the queue is full.
+  bool push(const NoteEvent& e)
+  {
+    size_t w = _write.load(std::memory_order_relaxed);
+    size_t next = (w + 1) % kCapacity;
+    if(next == _read.load(std::memory_order_acquire)) return false;
+    _events[w] = e;
+    _write.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // get the oldest event. Returns false if the queue is empty.
+  bool pop(NoteEvent& e)
+  {
+    size_t r = _read.load(std::memory_order_relaxed);
+    if(r == _write.load(std::memory_order_acquire)) return false;
+    e = _events[r];
+    _read.store((r + 1) % kCapacity, std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::array< NoteEvent, kCapacity > _events;
+  std::atomic< size_t > _read{0};
+  std::atomic< size_t > _write{0};
+};
+
+class PartialsInstrument
+{
+public:
+  static constexpr size_t kDefaultVoices{16};
+
+  // set the partials to play and allocate nVoices note voices for them. This allocates, so
+  // it must not be called from the audio thread.
+  void setPartials(const VutuPartialsData* pPartials, float sampleRate, size_t nVoices = kDefaultVoices);
+
+  // start a note with a velocity in (0, 1]. If all voices are busy, the oldest is stolen.
+  void noteOn(int note, float velocity);
+
+  // release all voices playing the note. They fade out over kReleaseTime.
+  void noteOff(int note);
+
+  void allNotesOff();
+
+  void handleEvent(const NoteEvent& e);
+
+  // add one DSPVector of all the sounding notes to out.
+  void processVector(DSPVector& out);
+
+  float getSampleRate() const { return _sampleRate; }
+  size_t getVoiceCount() const { return _voices.size(); }
+  size_t getActiveVoiceCount() const;
+
+  // the MIDI note at which the partials play at their own pitch. Without a fundamental this
+  // is middle C.
+  float getReferenceNote() const { return _referenceNote; }
+
+private:
+  static constexpr float kReleaseTime{0.05f};
+
+  struct Voice
+  {
+    PartialsPlayer player;
+    int note{-1};
+    float gain{0};
+    float gainStep{0}; // per vector, while releasing
+    bool releasing{false};
+    size_t age{0};
+  };
+
+  std::vector< Voice > _voices;
+  float _sampleRate{48000};
+  float _referenceNote{60};
+  size_t _noteCounter{0};
+
+  void stopVoice(Voice& v);
+};
+
+// render the note events, in order of time, and add them to out, starting at time 0. Each
+// event takes effect at the start of the DSPVector containing it. The size of out must be a
+// multiple of kFloatsPerDSPVector.
+void renderNoteEvents(PartialsInstrument& instrument, const std::vector< NoteEvent >& events, std::vector< float >& out);
+
+}
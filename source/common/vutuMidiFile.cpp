@@ -0,0 +1,231 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuMidiFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr uint32_t kDefaultTempo{500000}; // microseconds per quarter note
+
+// an event from any track, before the tempo map is applied. At the same tick, tempo changes
+// come first, then note offs, then note ons.
+struct MidiFileEvent
+{
+  enum Kind { kTempo, kNoteOff, kNoteOn };
+
+  uint64_t tick{0};
+  Kind kind{kNoteOn};
+  int note{0};
+  float velocity{0};
+  uint32_t tempo{0};
+};
+
+class MidiFileReader
+{
+public:
+  MidiFileReader(const uint8_t* pData, size_t size) : _pData(pData), _size(size) {}
+
+  bool atEnd() const { return _pos >= _size; }
+  size_t getPosition() const { return _pos; }
+  bool ok() const { return _ok; }
+
+  uint8_t peek()
+  {
+    if(_pos >= _size) { _ok = false; return 0; }
+    return _pData[_pos];
+  }
+
+  uint8_t readByte()
+  {
+    uint8_t b = peek();
+    if(_ok) _pos++;
+    return b;
+  }
+
+  uint32_t readBigEndian(int bytes)
+  {
+    uint32_t r{0};
+    for(int i=0; i<bytes; ++i)
+    {
+      r = (r << 8) | readByte();
+    }
+    return r;
+  }
+
+  // variable-length quantity of up to four bytes.
+  uint32_t readVariableLength()
+  {
+    uint32_t r{0};
+    for(int i=0; i<4; ++i)
+    {
+      uint8_t b = readByte();
+      r = (r << 7) | (b & 0x7F);
+      if(!(b & 0x80)) break;
+    }
+    return r;
+  }
+
+  void skip(size_t bytes)
+  {
+    if(bytes > _size - std::min(_pos, _size)) { _ok = false; return; }
+    _pos += bytes;
+  }
+
+  bool readTag(const char* tag)
+  {
+    bool match{true};
+    for(int i=0; i<4; ++i)
+    {
+      match &= (readByte() == uint8_t(tag[i]));
+    }
+    return match && _ok;
+  }
+
+private:
+  const uint8_t* _pData;
+  size_t _size;
+  size_t _pos{0};
+  bool _ok{true};
+};
+
+// read the events of one track chunk, ending at trackEnd.
+bool readTrack(MidiFileReader& r, size_t trackEnd, std::vector< MidiFileEvent >& events)
+{
+  uint64_t tick{0};
+  uint8_t status{0};
+  while(r.ok() && (r.getPosition() < trackEnd))
+  {
+    tick += r.readVariableLength();
+    uint8_t b = r.peek();
+    if(b & 0x80)
+    {
+      r.readByte();
+      if(b < 0xF0) status = b;
+    }
+    else if(!status)
+    {
+      return false;
+    }
+    else
+    {
+      // running status
+      b = status;
+    }
+
+    if(b == 0xFF)
+    {
+      uint8_t type = r.readByte();
+      uint32_t length = r.readVariableLength();
+      if(type == 0x2F) break;
+      if((type == 0x51) && (length == 3))
+      {
+        events.push_back(MidiFileEvent{tick, MidiFileEvent::kTempo, 0, 0, r.readBigEndian(3)});
+      }
+      else
+      {
+        r.skip(length);
+      }
+    }
+    else if((b == 0xF0) || (b == 0xF7))
+    {
+      r.skip(r.readVariableLength());
+    }
+    else
+    {
+      uint8_t type = b & 0xF0;
+      uint8_t data1 = r.readByte();
+      uint8_t data2 = ((type == 0xC0) || (type == 0xD0)) ? 0 : r.readByte();
+      if((type == 0x90) && (data2 > 0))
+      {
+        events.push_back(MidiFileEvent{tick, MidiFileEvent::kNoteOn, data1, data2/127.f, 0});
+      }
+      else if((type == 0x80) || (type == 0x90))
+      {
+        events.push_back(MidiFileEvent{tick, MidiFileEvent::kNoteOff, data1, 0, 0});
+      }
+    }
+  }
+  return r.ok();
+}
+
+}
+
+bool ml::readNoteEventsFromMidiFile(const TextFragment& filePath, std::vector< NoteEvent >& events)
+{
+  std::ifstream file(filePath.getText(), std::ios::binary);
+  if(!file) return false;
+  std::vector< uint8_t > data((std::istreambuf_iterator< char >(file)), std::istreambuf_iterator< char >());
+
+  MidiFileReader r(data.data(), data.size());
+  if(!r.readTag("MThd")) return false;
+  uint32_t headerLength = r.readBigEndian(4);
+  uint32_t format = r.readBigEndian(2);
+  uint32_t nTracks = r.readBigEndian(2);
+  uint32_t division = r.readBigEndian(2);
+  r.skip(headerLength - std::min(headerLength, 6u));
+  if(!r.ok() || (format > 1) || !division) return false;
+
+  std::vector< MidiFileEvent > fileEvents;
+  for(uint32_t i=0; (i < nTracks) && !r.atEnd(); ++i)
+  {
+    // skip any unknown chunks
+    bool isTrack = r.readTag("MTrk");
+    uint32_t length = r.readBigEndian(4);
+    if(!r.ok()) return false;
+    size_t trackEnd = r.getPosition() + length;
+    if(isTrack && !readTrack(r, trackEnd, fileEvents)) return false;
+    if(r.getPosition() < trackEnd)
+    {
+      r.skip(trackEnd - r.getPosition());
+    }
+    if(!r.ok()) return false;
+  }
+
+  std::stable_sort(fileEvents.begin(), fileEvents.end(), [](const MidiFileEvent& a, const MidiFileEvent& b)
+  {
+    return (a.tick != b.tick) ? (a.tick < b.tick) : (a.kind < b.kind);
+  });
+
+  // apply the tempo map. With SMPTE division, ticks are a fixed fraction of a frame.
+  double secondsPerTick;
+  bool smpte = division & 0x8000;
+  if(smpte)
+  {
+    int fps = -int8_t(division >> 8);
+    double framesPerSecond = (fps == 29) ? 29.97 : fps;
+    secondsPerTick = 1./(framesPerSecond*(division & 0xFF));
+  }
+  else
+  {
+    secondsPerTick = kDefaultTempo*1e-6/division;
+  }
+
+  events.clear();
+  uint64_t prevTick{0};
+  double time{0};
+  for(const auto& e : fileEvents)
+  {
+    time += (e.tick - prevTick)*secondsPerTick;
+    prevTick = e.tick;
+    if(e.kind == MidiFileEvent::kTempo)
+    {
+      if(!smpte && e.tempo)
+      {
+        secondsPerTick = e.tempo*1e-6/division;
+      }
+    }
+    else
+    {
+      events.push_back(NoteEvent{time, e.note, e.velocity});
+    }
+  }
+  return true;
+}
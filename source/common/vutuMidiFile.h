@@ -0,0 +1,21 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "madronalib.h"
+
+#include "vutuInstrument.h"
+
+// reading the notes from Standard MIDI Files, so the instrument can be played offline.
+
+namespace ml
+{
+
+// read the note ons and offs from all tracks and channels of a format 0 or 1 MIDI file into
+// events, in order of time. Times in seconds follow the file's tempo changes. Returns false
+// if the file can't be read.
+bool readNoteEventsFromMidiFile(const TextFragment& filePath, std::vector< NoteEvent >& events);
+
+}
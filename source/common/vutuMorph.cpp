@@ -0,0 +1,467 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuMorph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr float kTwoPi{6.283185307179586f};
+
+// partials are matched by frequency only within this distance in octaves. Distance in
+// normalized time counts as kTimeWeight octaves per unit.
+constexpr float kMaxPitchDistance{1.f/12.f};
+constexpr float kTimeWeight{0.25f};
+
+// the envelopes of each track are sampled at about this interval in seconds.
+constexpr float kGridTime{0.005f};
+
+constexpr float kMinFreq{1.f};
+constexpr float kMinDuration{0.001f};
+
+// extra voices beyond the maximum number of active tracks, for scrubbing.
+constexpr size_t kExtraVoices{16};
+
+struct PartialSummary
+{
+  float pitch{0}; // log2 of the amplitude-weighted mean frequency
+  float center{0}; // middle of the partial in normalized time
+  float peak{0};
+};
+
+float getSetDuration(const VutuPartialsData& data)
+{
+  float duration{0};
+  for(const auto& p : data.partials)
+  {
+    if(p.time.size())
+    {
+      duration = std::max(duration, p.time.back());
+    }
+  }
+  return std::max(duration, kMinDuration);
+}
+
+// summarize the partials from the summaries in their stats, or from new ones if the stats
+// don't have them.
+std::vector< PartialSummary > summarize(const VutuPartialsData& data)
+{
+  const size_t n = data.partials.size();
+  const PartialSummaries* pStats = &data.stats.summaries;
+  PartialSummaries made;
+  std::vector< Interval > timeRanges(n);
+  if(hasPartialSummaries(data))
+  {
+    timeRanges = data.stats.partialTimeRanges;
+  }
+  else
+  {
+    made.resize(n);
+    for(size_t i=0; i<n; ++i)
+    {
+      PartialExtent e = getPartialExtent(data.partials[i]);
+      summarizePartial(data.partials[i], e, made, i);
+      timeRanges[i] = e.time;
+    }
+    pStats = &made;
+  }
+
+  float duration = getSetDuration(data);
+  std::vector< PartialSummary > summaries(n);
+  for(size_t i=0; i<n; ++i)
+  {
+    if(!pStats->nBreakpoints[i]) continue;
+    summaries[i].pitch = std::log2(std::max(pStats->meanFreq[i], kMinFreq));
+    summaries[i].center = 0.5f*(timeRanges[i].mX1 + timeRanges[i].mX2)/duration;
+    summaries[i].peak = pStats->peakAmp[i];
+  }
+  return summaries;
+}
+
+// indices of the partials, loudest first.
+std::vector< size_t > getLoudnessOrder(const std::vector< PartialSummary >& summaries)
+{
+  std::vector< size_t > order(summaries.size());
+  for(size_t i=0; i<order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y)
+  {
+    return summaries[x].peak > summaries[y].peak;
+  });
+  return order;
+}
+
+}
+
+std::vector< size_t > ml::matchPartials(const VutuPartialsData& a, const VutuPartialsData& b)
+{
+  auto summariesA = summarize(a);
+  auto summariesB = summarize(b);
+  std::vector< size_t > matches(summariesA.size(), kNoMatch);
+  std::vector< bool > usedB(summariesB.size(), false);
+  auto orderA = getLoudnessOrder(summariesA);
+
+  if(a.distilled && b.distilled && (a.fundamental > 0.f) && (b.fundamental > 0.f))
+  {
+    // distilled: match each harmonic number to the loudest partial with it in each set.
+    auto getHarmonic = [](const PartialSummary& s, float fundamental)
+    {
+      return long(std::lround(std::exp2(s.pitch)/fundamental));
+    };
+    std::unordered_map< long, size_t > harmonicsB;
+    for(auto i : getLoudnessOrder(summariesB))
+    {
+      harmonicsB.insert({getHarmonic(summariesB[i], b.fundamental), i});
+    }
+    for(auto i : orderA)
+    {
+      auto it = harmonicsB.find(getHarmonic(summariesA[i], a.fundamental));
+      if((it != harmonicsB.end()) && !usedB[it->second])
+      {
+        matches[i] = it->second;
+        usedB[it->second] = true;
+      }
+    }
+    return matches;
+  }
+
+  // otherwise match by frequency, searching the partials of b in order of pitch.
+  std::vector< size_t > pitchOrderB(summariesB.size());
+  for(size_t i=0; i<pitchOrderB.size(); ++i)
+  {
+    pitchOrderB[i] = i;
+  }
+  std::sort(pitchOrderB.begin(), pitchOrderB.end(), [&](size_t x, size_t y)
+  {
+    return summariesB[x].pitch < summariesB[y].pitch;
+  });
+
+  for(auto i : orderA)
+  {
+    const PartialSummary& s = summariesA[i];
+    auto first = std::lower_bound(pitchOrderB.begin(), pitchOrderB.end(), s.pitch - kMaxPitchDistance, [&](size_t j, float pitch)
+    {
+      return summariesB[j].pitch < pitch;
+    });
+    size_t best{kNoMatch};
+    float bestCost{std::numeric_limits< float >::max()};
+    for(auto it = first; (it != pitchOrderB.end()) && (summariesB[*it].pitch <= s.pitch + kMaxPitchDistance); ++it)
+    {
+      if(usedB[*it]) continue;
+      float cost = std::fabs(summariesB[*it].pitch - s.pitch) + kTimeWeight*std::fabs(summariesB[*it].center - s.center);
+      if(cost < bestCost)
+      {
+        bestCost = cost;
+        best = *it;
+      }
+    }
+    if(best != kNoMatch)
+    {
+      matches[i] = best;
+      usedB[best] = true;
+    }
+  }
+  return matches;
+}
+
+PartialsMorph::PartialsMorph(const VutuPartialsData& a, const VutuPartialsData& b, const SynthesisParams& params)
+{
+  const VutuPartialsData* sets[2]{&a, &b};
+  _duration[0] = getSetDuration(a);
+  _duration[1] = getSetDuration(b);
+  const float step = kGridTime/std::max(_duration[0], _duration[1]);
+
+  // list the pairs: each partial of a with its match, then the unmatched partials of b.
+  std::vector< std::pair< size_t, size_t > > pairs;
+  auto matches = matchPartials(a, b);
+  std::vector< bool > matchedB(b.partials.size(), false);
+  for(size_t i=0; i<matches.size(); ++i)
+  {
+    pairs.push_back({i, matches[i]});
+    if(matches[i] != kNoMatch)
+    {
+      matchedB[matches[i]] = true;
+      _nMatched++;
+    }
+  }
+  for(size_t j=0; j<matchedB.size(); ++j)
+  {
+    if(!matchedB[j])
+    {
+      pairs.push_back({kNoMatch, j});
+    }
+  }
+
+  for(const auto& pair : pairs)
+  {
+    const VutuPartial* partials[2];
+    partials[0] = (pair.first != kNoMatch) ? &a.partials[pair.first] : nullptr;
+    partials[1] = (pair.second != kNoMatch) ? &b.partials[pair.second] : nullptr;
+
+    // get the range of normalized time covered by either partial, with its fades.
+    float u0{std::numeric_limits< float >::max()};
+    float u1{std::numeric_limits< float >::lowest()};
+    for(int s=0; s<2; ++s)
+    {
+      const VutuPartial* p = partials[s];
+      if(!p || !p->time.size()) continue;
+      u0 = std::min(u0, (p->time.front() - params.fadeTime)/_duration[s]);
+      u1 = std::max(u1, (p->time.back() + params.fadeTime)/_duration[s]);
+    }
+    if(u0 > u1) continue;
+
+    MorphTrack track;
+    track.start = u0;
+    track.step = step;
+    size_t nPoints = size_t(std::ceil((u1 - u0)/step)) + 1;
+    for(int s=0; s<2; ++s)
+    {
+      const VutuPartial* p = partials[s];
+      if(!p || !p->time.size()) continue;
+      track.amp[s].resize(nPoints);
+      track.pitch[s].resize(nPoints);
+      track.bandwidth[s].resize(nPoints);
+      size_t segment{0};
+      for(size_t k=0; k<nPoints; ++k)
+      {
+        double t = (u0 + k*step)*_duration[s];
+        segment = seekPartialSegment(*p, segment, t);
+        PartialEnvelope e = getPartialEnvelope(*p, segment, t, params.fadeTime);
+        track.amp[s][k] = e.amp;
+        track.pitch[s][k] = std::log2(std::max(e.freq, kMinFreq));
+        track.bandwidth[s][k] = e.bandwidth;
+      }
+    }
+
+    // a partial without a match is paired with a silent copy of itself.
+    for(int s=0; s<2; ++s)
+    {
+      if(!track.amp[s].size())
+      {
+        track.amp[s].assign(nPoints, 0.f);
+        track.pitch[s] = track.pitch[1 - s];
+        track.bandwidth[s] = track.bandwidth[1 - s];
+      }
+    }
+    track.noiseSeed = getPartialNoiseSeed(partials[0] ? *partials[0] : *partials[1]);
+    _tracks.push_back(std::move(track));
+  }
+
+  std::sort(_tracks.begin(), _tracks.end(), [](const MorphTrack& x, const MorphTrack& y)
+  {
+    return x.start < y.start;
+  });
+
+  // count the most tracks sounding at once.
+  std::vector< std::pair< float, int > > events;
+  events.reserve(_tracks.size()*2);
+  for(const auto& track : _tracks)
+  {
+    events.push_back({track.start, 1});
+    events.push_back({track.end(), -1});
+  }
+  std::sort(events.begin(), events.end(), [](const std::pair< float, int >& x, const std::pair< float, int >& y)
+  {
+    return (x.first < y.first) || ((x.first == y.first) && (x.second > y.second));
+  });
+  int active{0};
+  for(const auto& event : events)
+  {
+    active += event.second;
+    _maxActiveTracks = std::max(_maxActiveTracks, size_t(active));
+  }
+}
+
+float PartialsMorph::getDuration(float amount) const
+{
+  return lerp(_duration[0], _duration[1], amount);
+}
+
+PartialEnvelope PartialsMorph::getEnvelope(size_t trackIdx, float u, float amount) const
+{
+  PartialEnvelope e;
+  const MorphTrack& track = _tracks[trackIdx];
+  size_t n = track.size();
+  if((n < 2) || (u < track.start) || (u > track.end())) return e;
+
+  float x = (u - track.start)/track.step;
+  size_t k = std::min(size_t(x), n - 2);
+  float frac = x - k;
+  auto getValue = [&](const std::vector< float >* values)
+  {
+    return lerp(lerp(values[0][k], values[0][k + 1], frac), lerp(values[1][k], values[1][k + 1], frac), amount);
+  };
+  e.amp = getValue(track.amp);
+  e.freq = std::exp2(getValue(track.pitch));
+  e.bandwidth = getValue(track.bandwidth);
+  return e;
+}
+
+void MorphPlayer::setMorph(const PartialsMorph* pMorph, float sampleRate)
+{
+  _playing = false;
+  _pMorph = pMorph;
+  _sampleRate = sampleRate;
+
+  size_t nTracks = pMorph ? pMorph->getTracks().size() : 0;
+  size_t nVoices = pMorph ? pMorph->getMaxActiveTracks() + kExtraVoices : 0;
+  _voices.resize(nVoices);
+  _freeVoices.clear();
+  _freeVoices.reserve(nVoices);
+  _activeVoices.clear();
+  _activeVoices.reserve(nVoices);
+  for(size_t v=0; v<nVoices; ++v)
+  {
+    _voices[v].track = kNone;
+    _freeVoices.push_back(nVoices - 1 - v);
+  }
+  _trackVoice.assign(nTracks, kNone);
+
+  _endPosition = 1.f;
+  for(size_t i=0; i<nTracks; ++i)
+  {
+    _endPosition = std::max(_endPosition, pMorph->getTracks()[i].end());
+  }
+  _needsScan = true;
+}
+
+void MorphPlayer::start(float position)
+{
+  if(!_pMorph) return;
+  releaseAllVoices();
+  _position = position;
+  _needsScan = true;
+  _playing = true;
+}
+
+void MorphPlayer::stop()
+{
+  releaseAllVoices();
+  _playing = false;
+}
+
+void MorphPlayer::setPosition(float position)
+{
+  _position = position;
+  _needsScan = true;
+}
+
+void MorphPlayer::releaseAllVoices()
+{
+  for(auto v : _activeVoices)
+  {
+    _trackVoice[_voices[v].track] = kNone;
+    _voices[v].track = kNone;
+    _freeVoices.push_back(v);
+  }
+  _activeVoices.clear();
+}
+
+void MorphPlayer::startVoice(size_t track)
+{
+  // if there are no free voices, the track is dropped.
+  if(_freeVoices.empty()) return;
+  size_t v = _freeVoices.back();
+  _freeVoices.pop_back();
+
+  // start each track at a phase from its seed, so the tracks don't all start in phase.
+  uint32_t seed = _pMorph->getTracks()[track].noiseSeed;
+  Voice& voice = _voices[v];
+  voice.track = track;
+  voice.phase = getNoiseHash(seed, 0)*(1./4294967296.);
+  voice.noise.start(seed, 0., _sampleRate);
+  _trackVoice[track] = v;
+  _activeVoices.push_back(v);
+}
+
+bool MorphPlayer::processVector(DSPVector& out)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  if(!_playing || !_pMorph) return false;
+
+  const auto& tracks = _pMorph->getTracks();
+  const size_t nTracks = tracks.size();
+  float duration = std::max(_pMorph->getDuration(_amount), kMinDuration);
+  float u0 = _position;
+  float u1 = u0 + _rate*N/(duration*_sampleRate);
+  float lo = std::min(u0, u1);
+  float hi = std::max(u0, u1);
+
+  // release voices whose tracks are no longer sounding
+  for(size_t i=_activeVoices.size(); i-- > 0; )
+  {
+    size_t v = _activeVoices[i];
+    const MorphTrack& track = tracks[_voices[v].track];
+    if((track.end() < lo) || (track.start > hi))
+    {
+      _trackVoice[_voices[v].track] = kNone;
+      _voices[v].track = kNone;
+      _freeVoices.push_back(v);
+      _activeVoices[i] = _activeVoices.back();
+      _activeVoices.pop_back();
+    }
+  }
+
+  // start voices for tracks sounding in [lo, hi]. After a jump or when playing backwards,
+  // check every track that has started, otherwise only the tracks after the last started.
+  size_t i = (_needsScan || (_rate < 0.f)) ? 0 : _nextToStart;
+  for(; (i < nTracks) && (tracks[i].start <= hi); ++i)
+  {
+    if((_trackVoice[i] == kNone) && (tracks[i].end() >= lo))
+    {
+      startVoice(i);
+    }
+  }
+  _nextToStart = i;
+  _needsScan = false;
+
+  const float nyquist = _sampleRate*0.5f;
+  const DSPVector idx = columnIndex();
+  for(auto v : _activeVoices)
+  {
+    Voice& voice = _voices[v];
+    PartialEnvelope e0 = _pMorph->getEnvelope(voice.track, u0, _amount);
+    PartialEnvelope e1 = _pMorph->getEnvelope(voice.track, u1, _amount);
+
+    // phase over the vector: a quadratic from the linear frequency ramp.
+    double f0 = e0.freq/_sampleRate;
+    double f1 = e1.freq/_sampleRate;
+    double quadratic = (f1 - f0)/(2.*N);
+    DSPVector phase = DSPVector(float(voice.phase)) + idx*(DSPVector(float(f0)) + idx*DSPVector(float(quadratic)));
+    DSPVector carrier = cos(fractionalPart(phase)*DSPVector(kTwoPi));
+    double p1 = voice.phase + 0.5*(f0 + f1)*N;
+    voice.phase = p1 - std::floor(p1);
+
+    float a0 = (e0.freq < nyquist) ? e0.amp : 0.f;
+    float a1 = (e1.freq < nyquist) ? e1.amp : 0.f;
+    DSPVector amp = DSPVector(a0) + idx*DSPVector((a1 - a0)/N);
+    if((e0.bandwidth > 0.f) || (e1.bandwidth > 0.f))
+    {
+      amp = amp*getBandwidthModulation(voice.noise, e0.bandwidth, e1.bandwidth);
+    }
+    else
+    {
+      voice.noise.skipVector();
+    }
+    out = out + amp*carrier;
+  }
+  _position = u1;
+
+  // stop after running off either end
+  bool pastEnd = (_rate > 0.f) && (u0 > _endPosition);
+  bool pastStart = (_rate < 0.f) && (u0 < 0.f);
+  if(pastEnd || pastStart)
+  {
+    stop();
+  }
+  return _playing;
+}
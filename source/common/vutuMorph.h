@@ -0,0 +1,119 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <limits>
+
+#include "vutuSynthesizer.h"
+
+// morphing between two sets of partials. The partials of the two sets are matched once, and
+// each matched pair is resampled onto a common grid of normalized time, 0 at the start of
+// each set and 1 at its end. During playback, each pair's envelope is interpolated from the
+// grid and between the two sets by the morph amount, so nothing is searched or matched per
+// block. Partials without a match fade out towards the other set.
+
+namespace ml
+{
+
+constexpr size_t kNoMatch{std::numeric_limits< size_t >::max()};
+
+// for each partial in a, get the index of the matching partial in b, or kNoMatch. When both
+// sets have been distilled, partials are matched by their harmonic numbers of each set's
+// fundamental, the nearest whole multiple of it. Only the loudest partial of each harmonic
+// number in each set is matched. Partials below half the fundamental all have harmonic
+// number 0, so only the loudest of those in each set are paired, and the rest fade out.
+// Otherwise, louder partials are matched first, each to the unmatched partial of b nearest
+// in frequency and normalized time.
+std::vector< size_t > matchPartials(const VutuPartialsData& a, const VutuPartialsData& b);
+
+// a matched pair of partials, or a partial and a silent copy of itself. Each envelope is
+// sampled every step of normalized time starting at start, for each of the two sets.
+struct MorphTrack
+{
+  float start{0};
+  float step{0};
+  std::vector< float > amp[2];
+  std::vector< float > pitch[2]; // log2 of frequency
+  std::vector< float > bandwidth[2];
+  uint32_t noiseSeed{0};
+
+  size_t size() const { return amp[0].size(); }
+  float end() const { return start + step*(size() - 1); }
+};
+
+class PartialsMorph
+{
+public:
+  PartialsMorph(const VutuPartialsData& a, const VutuPartialsData& b, const SynthesisParams& params = SynthesisParams());
+
+  // the duration in seconds of the morph at the given amount, from 0 for a to 1 for b.
+  float getDuration(float amount) const;
+
+  // get the envelope of a track at normalized time u and the given morph amount.
+  PartialEnvelope getEnvelope(size_t track, float u, float amount) const;
+
+  const std::vector< MorphTrack >& getTracks() const { return _tracks; }
+  size_t getMaxActiveTracks() const { return _maxActiveTracks; }
+  size_t getMatchedCount() const { return _nMatched; }
+
+private:
+  std::vector< MorphTrack > _tracks; // in order of start
+  float _duration[2]{0, 0};
+  size_t _maxActiveTracks{0};
+  size_t _nMatched{0};
+};
+
+// real-time playback of a morph. Like PartialsPlayer, voices are allocated when the morph is
+// set, and nothing is allocated while playing. Position is in normalized time.
+class MorphPlayer
+{
+public:
+  // set the morph to play. This allocates, so it must not be called from the audio thread.
+  void setMorph(const PartialsMorph* pMorph, float sampleRate);
+
+  void start(float position);
+  void stop();
+  bool isPlaying() const { return _playing; }
+
+  void setPosition(float position);
+  float getPosition() const { return _position; }
+
+  void setRate(float rate) { _rate = rate; }
+  void setAmount(float amount) { _amount = clamp(amount, 0.f, 1.f); }
+
+  // add one DSPVector of output to out. Returns false once playback has run off either end.
+  bool processVector(DSPVector& out);
+
+private:
+  static constexpr size_t kNone{std::numeric_limits< size_t >::max()};
+
+  struct Voice
+  {
+    size_t track{kNone};
+    double phase{0}; // in cycles
+    BandwidthNoise noise;
+  };
+
+  const PartialsMorph* _pMorph{nullptr};
+  float _sampleRate{48000};
+
+  std::vector< Voice > _voices;
+  std::vector< size_t > _freeVoices;
+  std::vector< size_t > _activeVoices;
+  std::vector< size_t > _trackVoice;
+  size_t _nextToStart{0};
+  bool _needsScan{true};
+
+  float _position{0};
+  float _endPosition{1};
+  float _rate{1};
+  float _amount{0};
+  bool _playing{false};
+
+  void releaseAllVoices();
+  void startVoice(size_t track);
+};
+
+}
@@ -0,0 +1,105 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuNoise.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+// linear interpolation between points made every d samples has a half-power frequency of
+// about 0.32/d times the sample rate.
+constexpr float kHalfPowerPerPointRate{0.32f};
+
+// points are uniform on [-1, 1), with variance 1/3. Interpolating between them lowers the
+// average variance by 2/3.
+constexpr float kInterpolatedVariance{2.f/9.f};
+
+}
+
+void BandwidthNoise::start(uint32_t seed, double time, float sampleRate)
+{
+  // make points at the power of two spacing that best matches the cutoff, no more than one
+  // per DSPVector.
+  float idealSpacing = kHalfPowerPerPointRate*sampleRate/kCutoff;
+  _pointSpacing = 4;
+  while((_pointSpacing < kFloatsPerDSPVector) && (_pointSpacing*1.5f < idealSpacing))
+  {
+    _pointSpacing *= 2;
+  }
+
+  // the counter is the index of the last point at or before the start, counting from time
+  // 0, and the phase is the start's distance past that point in samples.
+  int64_t startSample = std::llround(time*sampleRate);
+  int64_t spacing = _pointSpacing;
+  int64_t pointIndex = (startSample >= 0) ? startSample/spacing : -((spacing - 1 - startSample)/spacing);
+  _seed = seed;
+  _counter = uint32_t(pointIndex);
+  _phase = uint32_t(startSample - pointIndex*spacing);
+  _point = getNoiseValue(_seed, _counter);
+}
+
+DSPVector BandwidthNoise::nextVector()
+{
+  constexpr uint32_t N = kFloatsPerDSPVector;
+  const float gain = std::sqrt(kVariance/kInterpolatedVariance);
+
+  // the position of each sample in spacings from the point at the counter. The spacing
+  // divides the DSPVector size, so the phase is the same for every vector of the stream.
+  const DSPVector x = (columnIndex() + DSPVector(float(_phase)))*DSPVector(1.f/_pointSpacing);
+
+  // linear interpolation starts from the point at the counter and adds the change to each
+  // later point, ramped in over the spacing before it. The ramps are clipped to [0, 1] to
+  // cover just their segments. The point after the vector's last sample is included.
+  const uint32_t nPoints = (_phase + N - 1)/_pointSpacing + 2;
+  const uint32_t pointsPerVector = N/_pointSpacing;
+  DSPVector out(_point*gain);
+  float prev = _point;
+  float nextStart = _point;
+  for(uint32_t m=1; m<nPoints; ++m)
+  {
+    float point = getNoiseValue(_seed, _counter + m);
+    if(m == pointsPerVector)
+    {
+      nextStart = point;
+    }
+    DSPVector ramp = min(max(x - DSPVector(float(m - 1)), DSPVector(0.f)), DSPVector(1.f));
+    out = out + DSPVector((point - prev)*gain)*ramp;
+    prev = point;
+  }
+
+  _counter += pointsPerVector;
+  _point = nextStart;
+  return out;
+}
+
+void BandwidthNoise::skipVector()
+{
+  _counter += kFloatsPerDSPVector/_pointSpacing;
+  _point = getNoiseValue(_seed, _counter);
+}
+
+void ml::getBandwidthGains(BandwidthNoise& noise, float bw0, float bw1, DSPVector& sineGain, DSPVector& noiseGain)
+{
+  bw0 = clamp(bw0, 0.f, 1.f);
+  bw1 = clamp(bw1, 0.f, 1.f);
+  float sine0 = std::sqrt(1.f - bw0);
+  float sine1 = std::sqrt(1.f - bw1);
+  float noise0 = std::sqrt(2.f*bw0);
+  float noise1 = std::sqrt(2.f*bw1);
+  DSPVector x = columnIndex()*DSPVector(1.f/kFloatsPerDSPVector);
+  sineGain = DSPVector(sine0) + x*DSPVector(sine1 - sine0);
+  noiseGain = (DSPVector(noise0) + x*DSPVector(noise1 - noise0))*noise.nextVector();
+}
+
+DSPVector ml::getBandwidthModulation(BandwidthNoise& noise, float bw0, float bw1)
+{
+  DSPVector sineGain, noiseGain;
+  getBandwidthGains(noise, bw0, bw1, sineGain, noiseGain);
+  return sineGain + noiseGain;
+}
@@ -0,0 +1,79 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "madronalib.h"
+#include "mldsp.h"
+
+// noise for bandwidth-enhanced synthesis. Random values come from a counter-based generator,
+// a hash of a seed and a counter, so each stream can be started anywhere and is the same
+// however it is split up. The noise is low-passed blockwise: random points are made every
+// few samples and interpolated linearly across each DSPVector, so there is no per-sample
+// recursion. Points sit at whole multiples of the spacing from time 0, so streams with the
+// same seed started at different times agree where they overlap.
+//
+// Each vector is made with DSPVector ops, as the first point it spans plus a clipped ramp
+// for the change to each later point, so the SIMD width of madronalib is used. There are
+// only a few points per vector at usual sample rates, which is where the saving over a
+// per-sample filter comes from.
+
+namespace ml
+{
+
+// get a random 32-bit value from a seed and a counter.
+inline uint32_t getNoiseHash(uint32_t seed, uint32_t counter)
+{
+  uint32_t x = (counter*0x9E3779B9u) ^ seed;
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// get a random value in [-1, 1) from a seed and a counter.
+inline float getNoiseValue(uint32_t seed, uint32_t counter)
+{
+  return float(int32_t(getNoiseHash(seed, counter)))*(1.f/2147483648.f);
+}
+
+class BandwidthNoise
+{
+public:
+  // start the stream for the given seed at a time in seconds. Streams started at the same
+  // seed and time, at the same sample rate, are identical.
+  void start(uint32_t seed, double time, float sampleRate);
+
+  // get the next DSPVector of noise, low-passed at about kCutoff and with variance kVariance.
+  DSPVector nextVector();
+
+  // move past the next DSPVector without making it.
+  void skipVector();
+
+  static constexpr float kCutoff{500.f};
+  static constexpr float kVariance{0.5f};
+
+private:
+  uint32_t _seed{0};
+  uint32_t _counter{0};
+  uint32_t _pointSpacing{32};
+
+  // the distance of the next sample past the point at the counter, which is the same at
+  // the start of every vector.
+  uint32_t _phase{0};
+  float _point{0};
+};
+
+// get the bandwidth-enhanced amplitude modulation sqrt(1 - bw) + sqrt(2 bw)*noise for one
+// DSPVector, with bandwidth moving linearly from bw0 to bw1. Bandwidth changes slowly, so the
+// square roots are taken at the ends of the vector and interpolated.
+DSPVector getBandwidthModulation(BandwidthNoise& noise, float bw0, float bw1);
+
+// get the two terms of the modulation separately: the sine gain sqrt(1 - bw), and the noise
+// sqrt(2 bw)*noise.
+void getBandwidthGains(BandwidthNoise& noise, float bw0, float bw1, DSPVector& sineGain, DSPVector& noiseGain);
+
+}
@@ -0,0 +1,237 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuPartials.h"
+#include "vutuThreads.h"
+
+using namespace ml;
+
+namespace
+{
+
+// partials per thread below which calcStats does not bother with more threads.
+constexpr size_t kStatsPartialsPerThread{512};
+
+inline void includeRange(Interval& r, Interval x)
+{
+  r.mX1 = std::min(r.mX1, x.mX1);
+  r.mX2 = std::max(r.mX2, x.mX2);
+}
+
+struct ParamRanges
+{
+  Interval time{std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
+  Interval amp{time};
+  Interval bandwidth{time};
+  Interval freq{time};
+};
+
+// sort x using nChunks threads: each chunk is sorted on its own, then neighboring runs
+// are merged in parallel until one run is left.
+void parallelSort(std::vector< float >& x, size_t nChunks)
+{
+  const size_t n = x.size();
+  nChunks = std::max(size_t(1), std::min(nChunks, n));
+  parallelForChunks(n, nChunks, [&](size_t, size_t begin, size_t end)
+  {
+    std::sort(x.begin() + begin, x.begin() + end);
+  });
+
+  for(size_t width=1; width<nChunks; width *= 2)
+  {
+    size_t nMerges = (nChunks + 2*width - 1)/(2*width);
+    parallelFor(nMerges, [&](size_t m)
+    {
+      size_t c0 = m*2*width;
+      size_t c1 = std::min(c0 + width, nChunks);
+      size_t c2 = std::min(c0 + 2*width, nChunks);
+      if(c1 < c2)
+      {
+        auto begin = x.begin();
+        std::inplace_merge(begin + getChunkStart(n, nChunks, c0), begin + getChunkStart(n, nChunks, c1),
+                           begin + getChunkStart(n, nChunks, c2));
+      }
+    });
+  }
+}
+
+}
+
+void ml::summarizePartial(const VutuPartial& partial, const PartialExtent& extent, PartialSummaries& s, size_t i)
+{
+  const Interval freqRange = extent.freq;
+  const Interval ampRange = extent.amp;
+  const Interval timeRange = extent.time;
+  const size_t n = partial.time.size();
+  double sumAmp{0}, sumFreq{0}, sumBandwidth{0}, energy{0};
+  for(size_t k=0; k<n; ++k)
+  {
+    sumAmp += partial.amp[k];
+    sumFreq += partial.amp[k]*partial.freq[k];
+    sumBandwidth += partial.bandwidth[k];
+  }
+  for(size_t k=1; k<n; ++k)
+  {
+    float a0 = partial.amp[k - 1], a1 = partial.amp[k];
+    energy += 0.5*(a0*a0 + a1*a1)*(partial.time[k] - partial.time[k - 1]);
+  }
+
+  float duration = timeRange.mX2 - timeRange.mX1;
+  s.minFreq[i] = freqRange.mX1;
+  s.maxFreq[i] = freqRange.mX2;
+  s.meanFreq[i] = (sumAmp > 0.) ? float(sumFreq/sumAmp) : 0.5f*(freqRange.mX1 + freqRange.mX2);
+  s.peakAmp[i] = ampRange.mX2;
+  s.rmsAmp[i] = (duration > 0.f) ? std::sqrt(float(energy)/duration) : ampRange.mX2;
+  s.energy[i] = float(energy);
+  s.duration[i] = duration;
+  s.meanBandwidth[i] = n ? float(sumBandwidth/n) : 0.f;
+  s.nBreakpoints[i] = uint32_t(n);
+}
+
+void ml::calcStats(VutuPartialsData& p)
+{
+  const size_t nPartials = p.partials.size();
+  p.stats.nPartials = nPartials;
+  p.stats.partialTimeRanges.resize(nPartials);
+  p.stats.summaries.resize(nPartials);
+
+  // get all the ranges of each partial together, reducing the ranges of each chunk of
+  // partials in chunk order.
+  const size_t nChunks = std::min(getWorkerThreadCount(), nPartials/kStatsPartialsPerThread + 1);
+  std::vector< ParamRanges > chunkRanges(nChunks);
+  std::vector< float > startTimes(nPartials), endTimes(nPartials);
+  parallelForChunks(nPartials, nChunks, [&](size_t c, size_t begin, size_t end)
+  {
+    ParamRanges& r = chunkRanges[c];
+    for(size_t i=begin; i<end; ++i)
+    {
+      const VutuPartial& partial = p.partials[i];
+      PartialExtent extent = getPartialExtent(partial);
+      includeRange(r.time, extent.time);
+      includeRange(r.amp, extent.amp);
+      includeRange(r.bandwidth, extent.bandwidth);
+      includeRange(r.freq, extent.freq);
+      summarizePartial(partial, extent, p.stats.summaries, i);
+      p.stats.partialTimeRanges[i] = extent.time;
+      startTimes[i] = extent.time.mX1;
+      endTimes[i] = extent.time.mX2;
+    }
+  });
+
+  ParamRanges total;
+  for(const auto& r : chunkRanges)
+  {
+    includeRange(total.time, r.time);
+    includeRange(total.amp, r.amp);
+    includeRange(total.bandwidth, r.bandwidth);
+    includeRange(total.freq, r.freq);
+  }
+  p.stats.timeRange = total.time;
+  p.stats.ampRange = total.amp;
+  p.stats.bandwidthRange = total.bandwidth;
+  p.stats.freqRange = total.freq;
+
+  // calc max simultaneous partials and the polyphony timeline: sort the start and end times
+  // separately, then walk them together. At each time, the starts are taken before the ends,
+  // so partials that touch count as active together.
+  parallelSort(startTimes, nChunks);
+  parallelSort(endTimes, nChunks);
+
+  PolyphonyTimeline& timeline = p.stats.polyphony;
+  timeline = PolyphonyTimeline();
+  int activePartials{0};
+  int maxActive{0};
+  float maxActiveTime{0.f};
+  for(size_t i=0, j=0; j<nPartials; )
+  {
+    float t = (i < nPartials) ? std::min(startTimes[i], endTimes[j]) : endTimes[j];
+    size_t i0 = i;
+    for(; (i < nPartials) && (startTimes[i] == t); ++i)
+    {
+      activePartials++;
+    }
+    if((i > i0) && (activePartials >= maxActive))
+    {
+      maxActive = activePartials;
+      maxActiveTime = t;
+    }
+    for(; (j < nPartials) && (endTimes[j] == t); ++j)
+    {
+      activePartials--;
+    }
+
+    // add a step if the count changed.
+    if(timeline.counts.empty() || (timeline.counts.back() != uint32_t(activePartials)))
+    {
+      timeline.times.push_back(t);
+      timeline.counts.push_back(activePartials);
+    }
+  }
+  timeline.updatePercentiles();
+
+  p.stats.maxActivePartials = maxActive;
+  p.stats.maxActiveTime = maxActiveTime;
+}
+
+size_t PolyphonyTimeline::getCount(float t) const
+{
+  auto it = std::upper_bound(times.begin(), times.end(), t);
+  return (it == times.begin()) ? 0 : counts[it - times.begin() - 1];
+}
+
+size_t PolyphonyTimeline::getMaxCount(Interval r) const
+{
+  auto it = std::upper_bound(times.begin(), times.end(), r.mX1);
+  size_t k = (it == times.begin()) ? 0 : it - times.begin() - 1;
+  uint32_t maxCount{0};
+  for(; (k < times.size()) && (times[k] <= r.mX2); ++k)
+  {
+    maxCount = std::max(maxCount, counts[k]);
+  }
+  return maxCount;
+}
+
+float PolyphonyTimeline::getTimeAbove(size_t n) const
+{
+  double t{0};
+  for(size_t k=0; k + 1<times.size(); ++k)
+  {
+    if(counts[k] > n)
+    {
+      t += times[k + 1] - times[k];
+    }
+  }
+  return float(t);
+}
+
+size_t PolyphonyTimeline::getPercentile(float q) const
+{
+  // weight each count by how long it lasts, from the first step to the last.
+  std::vector< std::pair< uint32_t, float > > steps;
+  double totalTime{0};
+  for(size_t k=0; k + 1<times.size(); ++k)
+  {
+    float dt = times[k + 1] - times[k];
+    steps.push_back({counts[k], dt});
+    totalTime += dt;
+  }
+  if(steps.empty()) return counts.size() ? counts[0] : 0;
+
+  std::sort(steps.begin(), steps.end());
+  double threshold = clamp(q, 0.f, 1.f)*totalTime;
+  double t{0};
+  for(const auto& s : steps)
+  {
+    t += s.second;
+    if(t >= threshold) return s.first;
+  }
+  return steps.back().first;
+}
+
+void PolyphonyTimeline::updatePercentiles()
+{
+  median = getPercentile(0.5f);
+  p90 = getPercentile(0.9f);
+  p99 = getPercentile(0.99f);
+}
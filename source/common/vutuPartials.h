@@ -19,6 +19,68 @@ static constexpr float kVutuPartialsFileVersion{ 1.0 };
 static constexpr char kVutuPartialsFileType[] = "VutuPartials";
 static constexpr char kVutuPartials2FileType[] = "VutuPartials2";
 
+// a summary of each partial, stored as one vector per value so that filtering, sorting and
+// culling can scan just the values they need without touching the breakpoints.
+struct PartialSummaries
+{
+  std::vector< float > minFreq;
+  std::vector< float > maxFreq;
+  std::vector< float > meanFreq; // weighted by amplitude
+  std::vector< float > peakAmp;
+  std::vector< float > rmsAmp; // over the duration of the partial
+  std::vector< float > energy; // integral of amp^2 over time
+  std::vector< float > duration;
+  std::vector< float > meanBandwidth;
+  std::vector< uint32_t > nBreakpoints;
+
+  size_t size() const { return nBreakpoints.size(); }
+
+  void resize(size_t n)
+  {
+    for(auto pv : {&minFreq, &maxFreq, &meanFreq, &peakAmp, &rmsAmp, &energy, &duration, &meanBandwidth})
+    {
+      pv->resize(n);
+    }
+    nBreakpoints.resize(n);
+  }
+
+  // move the last entry to entry i, and remove the last entry.
+  void swapRemove(size_t i)
+  {
+    for(auto pv : {&minFreq, &maxFreq, &meanFreq, &peakAmp, &rmsAmp, &energy, &duration, &meanBandwidth})
+    {
+      (*pv)[i] = pv->back();
+      pv->pop_back();
+    }
+    nBreakpoints[i] = nBreakpoints.back();
+    nBreakpoints.pop_back();
+  }
+};
+
+// the number of active partials over time, as a step function. The count is counts[k] from
+// times[k] until times[k + 1], and 0 before the first time. Steps are only added where the
+// count changes. The percentiles are weighted by time, from the first step to the last.
+struct PolyphonyTimeline
+{
+  std::vector< float > times;
+  std::vector< uint32_t > counts;
+  size_t median{0};
+  size_t p90{0};
+  size_t p99{0};
+
+  size_t getCount(float t) const;
+
+  // get the maximum count over the time interval r.
+  size_t getMaxCount(Interval r) const;
+
+  // get the total time in seconds with more than n active partials.
+  float getTimeAbove(size_t n) const;
+
+  // get the count that the active partials are at or below for the fraction q of the time.
+  size_t getPercentile(float q) const;
+  void updatePercentiles();
+};
+
 // these values are calculated after reading in the partials data.
 struct PartialsStats
 {
@@ -32,6 +94,8 @@ struct PartialsStats
   float maxActiveTime;
   
   std::vector< Interval > partialTimeRanges; // time range for each partial
+  PartialSummaries summaries;
+  PolyphonyTimeline polyphony;
 };
 
 // a single partial is a trajectory of these five values over time.
@@ -63,8 +127,28 @@ struct VutuPartialsData
   float loCut{0};
   float hiCut{0};
   float fundamental{0};
+
+  // true if the partials have been distilled to one partial per harmonic of the fundamental.
+  bool distilled{false};
 };
 
+// copy the source and analysis info of partials data, without the partials or stats.
+inline void copyPartialsInfo(const VutuPartialsData& src, VutuPartialsData& dest)
+{
+  dest.version = src.version;
+  dest.type = src.type;
+  dest.sourceFile = src.sourceFile;
+  dest.sourceDuration = src.sourceDuration;
+  dest.resolution = src.resolution;
+  dest.windowWidth = src.windowWidth;
+  dest.ampFloor = src.ampFloor;
+  dest.freqDrift = src.freqDrift;
+  dest.loCut = src.loCut;
+  dest.hiCut = src.hiCut;
+  dest.fundamental = src.fundamental;
+  dest.distilled = src.distilled;
+}
+
 struct PartialFrame
 {
   float amp{0};
@@ -100,15 +184,65 @@ inline std::ostream& operator<< (std::ostream& out, const PartialFrame& r)
 }
 
 
+// get the min and max of a vector in one pass, or {0, 0} if it is empty. The extrema are kept
+// in lanes so that the loop compiles to packed min and max.
 inline Interval getVectorExtrema(const std::vector< float >& vec)
 {
-  float fMin{0}, fMax{0};
-  if(vec.size() > 0)
+  constexpr size_t kLanes{8};
+  const size_t n = vec.size();
+  if(!n) return Interval{0, 0};
+
+  const float* px = vec.data();
+  float lo[kLanes], hi[kLanes];
+  for(size_t j=0; j<kLanes; ++j)
+  {
+    lo[j] = hi[j] = px[0];
+  }
+  size_t i{0};
+  for(; i + kLanes <= n; i += kLanes)
+  {
+    for(size_t j=0; j<kLanes; ++j)
+    {
+      lo[j] = (px[i + j] < lo[j]) ? px[i + j] : lo[j];
+      hi[j] = (px[i + j] > hi[j]) ? px[i + j] : hi[j];
+    }
+  }
+  for(; i<n; ++i)
   {
-    fMin = *std::min_element(vec.begin(), vec.end());
-    fMax = *std::max_element(vec.begin(), vec.end());
+    lo[0] = std::min(lo[0], px[i]);
+    hi[0] = std::max(hi[0], px[i]);
   }
-  return Interval{fMin, fMax};
+  for(size_t j=1; j<kLanes; ++j)
+  {
+    lo[0] = std::min(lo[0], lo[j]);
+    hi[0] = std::max(hi[0], hi[j]);
+  }
+  return Interval{lo[0], hi[0]};
+}
+
+// the ranges of the parameters of one partial.
+struct PartialExtent
+{
+  Interval time;
+  Interval amp;
+  Interval bandwidth;
+  Interval freq;
+};
+
+inline PartialExtent getPartialExtent(const VutuPartial& partial)
+{
+  return PartialExtent{getVectorExtrema(partial.time), getVectorExtrema(partial.amp),
+    getVectorExtrema(partial.bandwidth), getVectorExtrema(partial.freq)};
+}
+
+// write the summary of a partial with the given extent to entry i of the summaries.
+void summarizePartial(const VutuPartial& partial, const PartialExtent& extent, PartialSummaries& s, size_t i);
+
+// are there summaries in the stats for every partial? They are made by calcStats(), and are
+// out of date once the partials are changed, until it is run again.
+inline bool hasPartialSummaries(const VutuPartialsData& p)
+{
+  return (p.stats.summaries.size() == p.partials.size()) && (p.stats.partialTimeRanges.size() == p.partials.size());
 }
 
 inline Interval getParamRangeInPartials(const VutuPartialsData& partialData, Symbol param)
@@ -148,110 +282,37 @@ inline Interval getParamRangeInPartials(const VutuPartialsData& partialData, Sym
   return r;
 }
 
-inline void cutHighs(VutuPartialsData& p, float fCut)
-{
-  for(int i=0; i < p.partials.size(); ++i)
-  {
-    const VutuPartial& partial = p.partials[i];
-    
-    // if any instantaneous frequency of partial is > f, remove the partial
-    float fMax = *std::max_element(partial.freq.begin(), partial.freq.end());
-    if(fMax > fCut)
-    {
-      p.partials[i] = VutuPartial();
-    }
-  }
-  
-  // do cleanOutliers() afterwards to remove empty Partials
-}
-
-inline void cleanOutliers(VutuPartialsData& p)
-{
-  int before, after;
-  
-  auto discardPartial = [](const VutuPartial& p){
-    return p.time.size() <= 1;
-  };
-  
-  before = p.partials.size();
-  p.partials.erase(std::remove_if(p.partials.begin(), p.partials.end(), discardPartial), p.partials.end());
-  after = p.partials.size();
-  std::cout << "cleanOutliers: before: " << before << ", after: " << after << "\n";
-}
-
-// Get stats for partials data to aid synthesis and drawing.
+// Get stats for partials data to aid synthesis and drawing. The ranges of all parameters
+// are found in one pass over each partial, with the partials divided among threads, and
+// the start and end times are sorted in parallel to count the active partials over time. The
+// summary of each partial is made in the same pass.
 // TODO check that time is monotonically increasing
 //
-inline void calcStats(VutuPartialsData& p)
+void calcStats(VutuPartialsData& p);
+
+// get the indices of the partials for which pred(i) is true, in order. Predicates that read
+// only stats.summaries run in O(partials).
+template< typename P >
+inline std::vector< size_t > selectPartials(const VutuPartialsData& p, P pred)
 {
-  p.stats.timeRange = getParamRangeInPartials(p, "time");
-  p.stats.ampRange = getParamRangeInPartials(p, "amp");
-  p.stats.bandwidthRange = getParamRangeInPartials(p, "bandwidth");
-  p.stats.freqRange = getParamRangeInPartials(p, "freq");
-  p.stats.nPartials = p.partials.size();
-  
-  std::cout << "calcStats: " <<   p.stats.nPartials << " partials. \n";
-  std::cout << "    timeRange: " <<   p.stats.timeRange << "\n";
-  // store min, max times for each partial
-  p.stats.partialTimeRanges.clear();
-  for(int i=0; i<p.stats.nPartials; ++i)
+  std::vector< size_t > indices;
+  for(size_t i=0; i<p.partials.size(); ++i)
   {
-    const VutuPartial& partial = p.partials[i];
-    if(partial.time.size() > 0)
-    {
-      const auto& timeVec = partial.time;
-      Interval ptr = getVectorExtrema(timeVec);
-      p.stats.partialTimeRanges.push_back(ptr);
-    }
-    else
-    {
-      p.stats.partialTimeRanges.push_back(Interval{0, 0});
-    }
+    if(pred(i)) indices.push_back(i);
   }
-  
-  // calc max simultaneous partials:
-  //
-  // push all start and end times
+  return indices;
+}
 
-  std::vector< std::pair< float, bool > > startAndEndTimes;
-  for(const auto& startAndEnd : p.stats.partialTimeRanges)
-  {
-    startAndEndTimes.push_back(std::pair< float, bool >{startAndEnd.mX1, 0});
-    startAndEndTimes.push_back(std::pair< float, bool >{startAndEnd.mX2, 1});
-  }
-  // sort them
-  std::sort(startAndEndTimes.begin(), startAndEndTimes.end(), [](std::pair< float, bool > a, std::pair< float, bool > b){
-    return a.first < b.first;
-  });
-  // walk the sorted list keeping track of max simultaneously active partials
-  int activePartials{0};
-  int maxActive{0};
-  float maxActiveTime{0.f};
-  for(auto& p : startAndEndTimes)
+// get the indices of the partials sorted by one of the summary values, largest first.
+inline std::vector< size_t > sortPartialsBy(const VutuPartialsData& p, const std::vector< float >& values)
+{
+  std::vector< size_t > indices(values.size());
+  for(size_t i=0; i<indices.size(); ++i)
   {
-    if(p.second)
-    {
-      activePartials--;
-    }
-    else
-    {
-      activePartials++;
-      maxActive = std::max(activePartials, maxActive);
-      if(maxActive == activePartials)
-      {
-        maxActiveTime = p.first;
-      }
-    }
-    
-    // std::cout << "time: " << p.time << (p.isEnd ? "-" : "+") << ", n = " << activePartials << "\n";
+    indices[i] = i;
   }
-  
-  assert(activePartials == 0);
-  
-  p.stats.maxActivePartials = maxActive;
-  p.stats.maxActiveTime = maxActiveTime;
-  
-  std::cout << "max active partials: " << p.stats.maxActivePartials <<  " at time: " << p.stats.maxActiveTime << "\n";
+  std::stable_sort(indices.begin(), indices.end(), [&](size_t a, size_t b){ return values[a] > values[b]; });
+  return indices;
 }
 
 // get an interpolated frame of data from the partial index p of the VutuPartialsData at time t.
@@ -400,6 +461,7 @@ inline JSONHolder vutuPartialsToJSON(const VutuPartialsData& partialsData)
   cJSON_AddNumberToObject(root.data(), "lo_cut", partialsData.loCut);
   cJSON_AddNumberToObject(root.data(), "hi_cut", partialsData.hiCut);
   cJSON_AddNumberToObject(root.data(), "fundamental", partialsData.fundamental);
+  cJSON_AddNumberToObject(root.data(), "distilled", partialsData.distilled ? 1 : 0);
 
   const size_t nPartials = partialsData.partials.size();
   
@@ -442,6 +504,7 @@ inline std::vector<uint8_t> vutuPartialsToBinary(const VutuPartialsData& partial
   tree["lo_cut"] = partialsData.loCut;
   tree["hi_cut"] = partialsData.hiCut;
   tree["fundamental"] = partialsData.fundamental;
+  tree["distilled"] = partialsData.distilled ? 1 : 0;
 
   const size_t nPartials = partialsData.partials.size();
   tree["n_partials"] = (unsigned long)nPartials;
@@ -519,6 +582,7 @@ inline VutuPartialsData* binaryToVutuPartials(const std::vector<unsigned char>&
       partialsData->loCut = tree["lo_cut"].getFloatValue();
       partialsData->hiCut = tree["hi_cut"].getFloatValue();
       partialsData->fundamental = tree["fundamental"].getFloatValue();
+      partialsData->distilled = tree["distilled"].getIntValue() != 0;
 
       partialsData->partials.resize(nPartials);
       std::cout << "reading " << nPartials << " partials from binary\n";
@@ -584,6 +648,9 @@ inline VutuPartialsData* jsonToVutuPartials(JSONHolder& jsonData)
           case(hash("fundamental")):
             pVutuPartials->fundamental = obj->valuedouble;
             break;
+          case(hash("distilled")):
+            pVutuPartials->distilled = (obj->valueint != 0);
+            break;
         }
         
         // TEMP
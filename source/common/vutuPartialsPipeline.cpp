@@ -0,0 +1,206 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuPartialsPipeline.h"
+#include "vutuThreads.h"
+
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+// partials per job when testing and transforming in parallel.
+constexpr size_t kPipelinePartialsPerJob{256};
+
+inline void scaleVector(std::vector< float >& v, float k)
+{
+  for(float& x : v)
+  {
+    x *= k;
+  }
+}
+
+}
+
+bool ml::isNearHarmonic(float f, float fundamental, float toleranceCents)
+{
+  if((fundamental <= 0.f) || (f <= 0.f)) return false;
+  float harmonicNumber = std::max(std::round(f/fundamental), 1.f);
+  float cents = 1200.f*std::fabs(std::log2(f/(harmonicNumber*fundamental)));
+  return cents <= toleranceCents;
+}
+
+PartialsPipeline& PartialsPipeline::keepBand(Interval freqRange)
+{
+  _filters.push_back(Filter{Filter::kBand, freqRange.mX1/_freqRatio, freqRange.mX2/_freqRatio});
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::keepMinDuration(float seconds)
+{
+  _filters.push_back(Filter{Filter::kMinDuration, seconds/_timeScale});
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::keepMinAmp(float amp)
+{
+  _filters.push_back(Filter{Filter::kMinAmp, amp/_gain});
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::keepMinBreakpoints(size_t n)
+{
+  _filters.push_back(Filter{Filter::kMinBreakpoints, float(n)});
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::keepHarmonics(float fundamental, float toleranceCents)
+{
+  _filters.push_back(Filter{Filter::kHarmonics, fundamental/_freqRatio, toleranceCents});
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::transpose(float ratio)
+{
+  _freqRatio *= ratio;
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::scaleTime(float ratio)
+{
+  _timeScale *= ratio;
+  return *this;
+}
+
+PartialsPipeline& PartialsPipeline::scaleAmp(float gain)
+{
+  _gain *= gain;
+  return *this;
+}
+
+bool PartialsPipeline::keepsSummary(const PartialSummaries& s, size_t i) const
+{
+  for(const auto& f : _filters)
+  {
+    bool pass{true};
+    switch(f.kind)
+    {
+      case Filter::kBand:
+      {
+        pass = (s.minFreq[i] >= f.a) && (s.maxFreq[i] <= f.b);
+        break;
+      }
+      case Filter::kMinDuration:
+      {
+        pass = s.nBreakpoints[i] && (s.duration[i] >= f.a);
+        break;
+      }
+      case Filter::kMinAmp:
+      {
+        pass = (s.peakAmp[i] >= f.a);
+        break;
+      }
+      case Filter::kMinBreakpoints:
+      {
+        pass = (s.nBreakpoints[i] >= f.a);
+        break;
+      }
+      case Filter::kHarmonics:
+      {
+        pass = isNearHarmonic(s.meanFreq[i], f.a, f.b);
+        break;
+      }
+    }
+    if(!pass) return false;
+  }
+  return true;
+}
+
+bool PartialsPipeline::keeps(const VutuPartial& p) const
+{
+  if(!hasFilters()) return true;
+  PartialSummaries s;
+  s.resize(1);
+  summarizePartial(p, getPartialExtent(p), s, 0);
+  return keepsSummary(s, 0);
+}
+
+bool PartialsPipeline::keeps(const VutuPartialsData& partialsData, size_t i) const
+{
+  if(!hasFilters()) return true;
+  if(hasPartialSummaries(partialsData))
+  {
+    return keepsSummary(partialsData.stats.summaries, i);
+  }
+  return keeps(partialsData.partials[i]);
+}
+
+void PartialsPipeline::transform(const VutuPartial& src, VutuPartial& dest) const
+{
+  if(&dest != &src)
+  {
+    dest = src;
+  }
+  if(_freqRatio != 1.f) scaleVector(dest.freq, _freqRatio);
+  if(_timeScale != 1.f) scaleVector(dest.time, _timeScale);
+  if(_gain != 1.f) scaleVector(dest.amp, _gain);
+}
+
+std::vector< uint8_t > PartialsPipeline::getKeptPartials(const VutuPartialsData& partialsData, size_t maxThreads) const
+{
+  const size_t nPartials = partialsData.partials.size();
+  std::vector< uint8_t > kept(nPartials, 1);
+  if(!hasFilters()) return kept;
+
+  size_t nJobs = (nPartials + kPipelinePartialsPerJob - 1)/kPipelinePartialsPerJob;
+  parallelFor(nJobs, [&](size_t job)
+  {
+    size_t end = std::min(nPartials, (job + 1)*kPipelinePartialsPerJob);
+    for(size_t i=job*kPipelinePartialsPerJob; i<end; ++i)
+    {
+      kept[i] = keeps(partialsData, i);
+    }
+  }, maxThreads);
+  return kept;
+}
+
+void PartialsPipeline::apply(VutuPartialsData& partialsData, size_t maxThreads) const
+{
+  auto& partials = partialsData.partials;
+  const size_t nPartials = partials.size();
+
+  // test and transform each partial in place, in one pass.
+  std::vector< uint8_t > kept(nPartials, 1);
+  size_t nJobs = (nPartials + kPipelinePartialsPerJob - 1)/kPipelinePartialsPerJob;
+  parallelFor(nJobs, [&](size_t job)
+  {
+    size_t end = std::min(nPartials, (job + 1)*kPipelinePartialsPerJob);
+    for(size_t i=job*kPipelinePartialsPerJob; i<end; ++i)
+    {
+      kept[i] = keeps(partialsData, i);
+      if(kept[i] && hasTransforms())
+      {
+        transform(partials[i], partials[i]);
+      }
+    }
+  }, maxThreads);
+
+  // move the kept partials down over the dropped ones, keeping their order.
+  size_t nKept{0};
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    if(!kept[i]) continue;
+    if(nKept != i)
+    {
+      partials[nKept] = std::move(partials[i]);
+    }
+    nKept++;
+  }
+  partials.resize(nKept);
+
+  partialsData.fundamental *= _freqRatio;
+  partialsData.sourceDuration *= _timeScale;
+}
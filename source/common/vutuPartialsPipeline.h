@@ -0,0 +1,90 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <vector>
+
+#include "vutuPartials.h"
+
+// a chain of operations on partials: filters that keep or drop whole partials, and transforms
+// of their frequency, time and amplitude. Operations are only recorded as they are added.
+// Each filter is mapped back through the transforms before it, so the whole chain reduces to
+// a set of tests on the original partials and one scale for each of frequency, time and
+// amplitude. It can then be applied in one pass, or evaluated on the fly by playback.
+
+namespace ml
+{
+
+// is f within toleranceCents of a harmonic of the fundamental?
+bool isNearHarmonic(float f, float fundamental, float toleranceCents);
+
+class PartialsPipeline
+{
+public:
+  // keep partials whose frequencies all lie within freqRange.
+  PartialsPipeline& keepBand(Interval freqRange);
+
+  // keep partials lasting at least the given time in seconds.
+  PartialsPipeline& keepMinDuration(float seconds);
+
+  // keep partials with a peak amplitude of at least amp.
+  PartialsPipeline& keepMinAmp(float amp);
+
+  // keep partials with at least n breakpoints.
+  PartialsPipeline& keepMinBreakpoints(size_t n);
+
+  // keep partials whose mean frequency is within toleranceCents of a harmonic.
+  PartialsPipeline& keepHarmonics(float fundamental, float toleranceCents = 30.f);
+
+  // multiply the frequencies, times or amplitudes of the partials.
+  PartialsPipeline& transpose(float ratio);
+  PartialsPipeline& scaleTime(float ratio);
+  PartialsPipeline& scaleAmp(float gain);
+
+  float getFreqRatio() const { return _freqRatio; }
+  float getTimeScale() const { return _timeScale; }
+  float getGain() const { return _gain; }
+  bool hasFilters() const { return !_filters.empty(); }
+  bool hasTransforms() const { return (_freqRatio != 1.f) || (_timeScale != 1.f) || (_gain != 1.f); }
+
+  // does the partial pass all the filters?
+  bool keeps(const VutuPartial& p) const;
+
+  // does partial i pass all the filters? If the stats have summaries of the partials, the
+  // filters read those instead of the breakpoints, so they must be up to date.
+  bool keeps(const VutuPartialsData& partialsData, size_t i) const;
+
+  // write the transformed partial to dest, which may be src.
+  void transform(const VutuPartial& src, VutuPartial& dest) const;
+
+  // get whether each partial is kept, testing the partials in parallel.
+  std::vector< uint8_t > getKeptPartials(const VutuPartialsData& partialsData, size_t maxThreads = 0) const;
+
+  // filter and transform the partials in one parallel pass, then compact them in place. The
+  // fundamental and source duration are transformed too. The stats must be recalculated
+  // afterwards.
+  void apply(VutuPartialsData& partialsData, size_t maxThreads = 0) const;
+
+private:
+  // a filter on the original partials, with its arguments in their units.
+  struct Filter
+  {
+    enum Kind { kBand, kMinDuration, kMinAmp, kMinBreakpoints, kHarmonics };
+    Kind kind;
+    float a{0};
+    float b{0};
+  };
+
+  std::vector< Filter > _filters;
+
+  // test entry i of the summaries.
+  bool keepsSummary(const PartialSummaries& s, size_t i) const;
+
+  float _freqRatio{1};
+  float _timeScale{1};
+  float _gain{1};
+};
+
+}
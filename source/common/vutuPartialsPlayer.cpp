@@ -0,0 +1,377 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuPartialsPlayer.h"
+
+#include <algorithm>
+
+using namespace ml;
+
+namespace
+{
+
+// extra voices beyond the maximum number of active partials, for partials overlapping during
+// their fades and while scrubbing.
+constexpr size_t kExtraVoices{16};
+
+// masking model for culling. A partial masks its neighbors at kMaskingOffset dB below its own
+// level, falling off with distance in Bark more slowly above the masker than below it.
+// Partials below kAudibleFloor dB are never rendered.
+constexpr float kMaskingOffset{10.f};
+constexpr float kMaskingSlopeUp{10.f};
+constexpr float kMaskingSlopeDown{25.f};
+constexpr float kAudibleFloor{-96.f};
+constexpr float kMinMaskingLevel{-1000.f};
+
+// time for partials to fade in and out as they enter and leave the rendered set.
+constexpr float kCullFadeTime{0.01f};
+
+// critical band rate (Traunmüller).
+float hzToBark(float f)
+{
+  return 26.81f*f/(1960.f + f) - 0.53f;
+}
+
+}
+
+void PartialsPlayer::setPartials(const VutuPartialsData* pPartials, float sampleRate)
+{
+  _playing = false;
+  _pPartials = pPartials;
+  _synthParams.sampleRate = sampleRate;
+
+  size_t nPartials = pPartials ? pPartials->partials.size() : 0;
+  size_t nVoices = pPartials ? pPartials->stats.maxActivePartials + pPartials->stats.maxActivePartials/4 + kExtraVoices : 0;
+
+  _oscillators.resize(nVoices);
+  setPitchRatio(_pitchRatio);
+  _voicePartial.assign(nVoices, kNone);
+  _freeVoices.clear();
+  _freeVoices.reserve(nVoices);
+  _activeVoices.clear();
+  _activeVoices.reserve(nVoices);
+  for(size_t v=0; v<nVoices; ++v)
+  {
+    _freeVoices.push_back(nVoices - 1 - v);
+  }
+
+  _voiceGain.assign(nVoices, 0.f);
+  _voiceSelected.assign(nVoices, false);
+  _voiceDormant.assign(nVoices, false);
+  _voiceSegment.assign(nVoices, 0);
+  _voiceSalience.assign(nVoices, 0.f);
+  _voiceBark.assign(nVoices, 0.f);
+  _voiceMasking.assign(nVoices, 0.f);
+  _cullOrder.clear();
+  _cullOrder.reserve(nVoices);
+
+  _partialVoice.assign(nPartials, kNone);
+  _partialKept = pPartials ? _pipeline.getKeptPartials(*pPartials) : std::vector< uint8_t >();
+  _partialSeeds.resize(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    _partialSeeds[i] = getPartialNoiseSeed(pPartials->partials[i]);
+  }
+  _partialExtents.resize(nPartials);
+  _endTime = 0.;
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    Interval r = pPartials->stats.partialTimeRanges[i];
+    _partialExtents[i] = Interval{r.mX1 - _synthParams.fadeTime, r.mX2 + _synthParams.fadeTime};
+    _endTime = std::max(_endTime, double(_partialExtents[i].mX2));
+  }
+
+  _startOrder.resize(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    _startOrder[i] = i;
+  }
+  std::sort(_startOrder.begin(), _startOrder.end(), [&](size_t a, size_t b)
+  {
+    return _partialExtents[a].mX1 < _partialExtents[b].mX1;
+  });
+  _needsScan = true;
+}
+
+void PartialsPlayer::setCulling(bool culling, size_t maxVoices)
+{
+  _culling = culling;
+  _maxVoices = maxVoices;
+}
+
+void PartialsPlayer::setPitchRatio(float ratio)
+{
+  _pitchRatio = ratio;
+  for(auto& osc : _oscillators)
+  {
+    osc.setPitchRatio(ratio*_pipeline.getFreqRatio());
+    osc.setTimeScale(_pipeline.getTimeScale());
+  }
+}
+
+void PartialsPlayer::setPipeline(const PartialsPipeline& pipeline)
+{
+  _pipeline = pipeline;
+  setPitchRatio(_pitchRatio);
+  if(_pPartials)
+  {
+    _partialKept = _pipeline.getKeptPartials(*_pPartials);
+  }
+}
+
+void PartialsPlayer::start(double time)
+{
+  if(!_pPartials) return;
+  releaseAllVoices();
+  _time = time;
+  _needsScan = true;
+  _playing = true;
+}
+
+void PartialsPlayer::stop()
+{
+  releaseAllVoices();
+  _playing = false;
+}
+
+void PartialsPlayer::setTime(double time)
+{
+  if(!_pPartials) return;
+  _time = time;
+  for(auto v : _activeVoices)
+  {
+    _oscillators[v].setTime(_pPartials->partials[_voicePartial[v]], time);
+    _voiceSegment[v] = 0;
+  }
+  _needsScan = true;
+}
+
+void PartialsPlayer::startVoice(size_t partialIdx, double time)
+{
+  // if there are no free voices, the partial is dropped.
+  if(_freeVoices.empty()) return;
+  size_t v = _freeVoices.back();
+  _freeVoices.pop_back();
+
+  _oscillators[v].start(_pPartials->partials[partialIdx], time, _synthParams, _partialSeeds[partialIdx]);
+  _voicePartial[v] = partialIdx;
+  _partialVoice[partialIdx] = v;
+  _activeVoices.push_back(v);
+
+  // a negative gain marks a new voice, which starts at full gain if it is selected.
+  _voiceGain[v] = -1.f;
+  _voiceDormant[v] = false;
+  _voiceSegment[v] = 0;
+}
+
+void PartialsPlayer::releaseAllVoices()
+{
+  for(auto v : _activeVoices)
+  {
+    _partialVoice[_voicePartial[v]] = kNone;
+    _voicePartial[v] = kNone;
+    _freeVoices.push_back(v);
+  }
+  _activeVoices.clear();
+}
+
+// start voices for any partials sounding in [t0, t1] that don't have them.
+void PartialsPlayer::startVoicesInRange(double t0, double t1)
+{
+  size_t nPartials = _startOrder.size();
+  auto needsVoice = [&](size_t p)
+  {
+    return (_partialVoice[p] == kNone) && _partialKept[p] && (_partialExtents[p].mX2 >= t0) && (_partialExtents[p].mX1 <= t1);
+  };
+
+  if(_needsScan || (_rate < 0.f))
+  {
+    // after a jump or when playing backwards, check every partial that has started.
+    size_t i{0};
+    for(; (i < nPartials) && (_partialExtents[_startOrder[i]].mX1 <= t1); ++i)
+    {
+      size_t p = _startOrder[i];
+      if(needsVoice(p))
+      {
+        startVoice(p, t0);
+      }
+    }
+    _nextToStart = i;
+    _needsScan = false;
+  }
+  else
+  {
+    // playing forwards, only partials after the last one started can begin.
+    for(; (_nextToStart < nPartials) && (_partialExtents[_startOrder[_nextToStart]].mX1 <= t1); ++_nextToStart)
+    {
+      size_t p = _startOrder[_nextToStart];
+      if(needsVoice(p))
+      {
+        startVoice(p, t0);
+      }
+    }
+  }
+}
+
+// decide which active voices to render at the given time. Each partial's level is compared
+// to the masking threshold from all the other partials, found with one pass up and one pass
+// down through the partials in order of frequency. The partials above the threshold are
+// selected, and if there are more than _maxVoices of them, only the most salient are kept.
+void PartialsPlayer::selectVoices(double time)
+{
+  if(!_culling)
+  {
+    for(auto v : _activeVoices)
+    {
+      _voiceSelected[v] = true;
+    }
+    return;
+  }
+
+  for(auto v : _activeVoices)
+  {
+    const VutuPartial& p = _pPartials->partials[_voicePartial[v]];
+    _voiceSegment[v] = seekPartialSegment(p, _voiceSegment[v], time);
+    PartialEnvelope env = getPartialEnvelope(p, _voiceSegment[v], time, _synthParams.fadeTime);
+    float amp = env.amp*_pipeline.getGain();
+    _voiceSalience[v] = (amp > 0.f) ? ampTodB(amp) : kMinMaskingLevel;
+    _voiceBark[v] = hzToBark(std::max(env.freq*_pitchRatio*_pipeline.getFreqRatio(), 0.f));
+  }
+
+  _cullOrder.assign(_activeVoices.begin(), _activeVoices.end());
+  std::sort(_cullOrder.begin(), _cullOrder.end(), [&](size_t a, size_t b)
+  {
+    return _voiceBark[a] < _voiceBark[b];
+  });
+
+  // masking from partials below each partial
+  float threshold{kMinMaskingLevel};
+  for(size_t i=0; i<_cullOrder.size(); ++i)
+  {
+    size_t v = _cullOrder[i];
+    if(i > 0)
+    {
+      threshold -= kMaskingSlopeUp*(_voiceBark[v] - _voiceBark[_cullOrder[i - 1]]);
+    }
+    _voiceMasking[v] = threshold;
+    threshold = std::max(threshold, _voiceSalience[v] - kMaskingOffset);
+  }
+
+  // masking from partials above
+  threshold = kMinMaskingLevel;
+  for(size_t i=_cullOrder.size(); i-- > 0; )
+  {
+    size_t v = _cullOrder[i];
+    if(i + 1 < _cullOrder.size())
+    {
+      threshold -= kMaskingSlopeDown*(_voiceBark[_cullOrder[i + 1]] - _voiceBark[v]);
+    }
+    _voiceMasking[v] = std::max(_voiceMasking[v], threshold);
+    threshold = std::max(threshold, _voiceSalience[v] - kMaskingOffset);
+  }
+
+  size_t nSelected{0};
+  for(auto v : _cullOrder)
+  {
+    _voiceSalience[v] -= std::max(_voiceMasking[v], kAudibleFloor);
+    _voiceSelected[v] = (_voiceSalience[v] > 0.f);
+    nSelected += _voiceSelected[v];
+  }
+
+  // keep only the most salient voices within the budget
+  if(_maxVoices && (nSelected > _maxVoices))
+  {
+    std::nth_element(_cullOrder.begin(), _cullOrder.begin() + _maxVoices, _cullOrder.end(), [&](size_t a, size_t b)
+    {
+      return _voiceSalience[a] > _voiceSalience[b];
+    });
+    for(size_t i=_maxVoices; i<_cullOrder.size(); ++i)
+    {
+      _voiceSelected[_cullOrder[i]] = false;
+    }
+  }
+}
+
+bool PartialsPlayer::processVector(DSPVector& out)
+{
+  if(!_playing || !_pPartials) return false;
+
+  double timePerSample = _rate/(_pipeline.getTimeScale()*_synthParams.sampleRate);
+  double t0 = _time;
+  double t1 = t0 + timePerSample*kFloatsPerDSPVector;
+  double lo = std::min(t0, t1);
+  double hi = std::max(t0, t1);
+
+  // release voices whose partials are no longer sounding
+  for(size_t i=_activeVoices.size(); i-- > 0; )
+  {
+    size_t v = _activeVoices[i];
+    size_t p = _voicePartial[v];
+    if((_partialExtents[p].mX2 < lo) || (_partialExtents[p].mX1 > hi))
+    {
+      _partialVoice[p] = kNone;
+      _voicePartial[v] = kNone;
+      _freeVoices.push_back(v);
+      _activeVoices[i] = _activeVoices.back();
+      _activeVoices.pop_back();
+    }
+  }
+
+  startVoicesInRange(lo, hi);
+  selectVoices(t0);
+
+  // voices fade in and out linearly over the vector as they are selected and deselected.
+  // Voices that have faded out are dormant, and are restarted at the current time when
+  // they are selected again.
+  const float fadeStep = kFloatsPerDSPVector/(_synthParams.sampleRate*kCullFadeTime);
+  const DSPVector rampIndex = (columnIndex() + DSPVector(1.f))*DSPVector(1.f/kFloatsPerDSPVector);
+  DSPVector mix;
+  for(auto v : _activeVoices)
+  {
+    const VutuPartial& p = _pPartials->partials[_voicePartial[v]];
+    bool selected = _voiceSelected[v];
+    float g0 = _voiceGain[v];
+    if(g0 < 0.f)
+    {
+      g0 = selected ? 1.f : 0.f;
+    }
+    float g1 = selected ? std::min(g0 + fadeStep, 1.f) : std::max(g0 - fadeStep, 0.f);
+    _voiceGain[v] = g1;
+
+    if((g0 == 0.f) && (g1 == 0.f))
+    {
+      _voiceDormant[v] = true;
+      _vectorsCulled++;
+      continue;
+    }
+    if(_voiceDormant[v])
+    {
+      _oscillators[v].start(p, t0, _synthParams, _partialSeeds[_voicePartial[v]]);
+      _voiceDormant[v] = false;
+    }
+
+    if((g0 == 1.f) && (g1 == 1.f))
+    {
+      _oscillators[v].addVector(p, timePerSample, mix);
+    }
+    else
+    {
+      DSPVector voice;
+      _oscillators[v].addVector(p, timePerSample, voice);
+      mix = mix + voice*(DSPVector(g0) + DSPVector(g1 - g0)*rampIndex);
+    }
+    _vectorsRendered++;
+  }
+  out = out + ((_pipeline.getGain() != 1.f) ? mix*DSPVector(_pipeline.getGain()) : mix);
+  _time = t1;
+
+  // stop after running off either end
+  bool pastEnd = (_rate > 0.f) && (t0 > _endTime);
+  bool pastStart = (_rate < 0.f) && (t0 < 0.);
+  if(pastEnd || pastStart)
+  {
+    stop();
+  }
+  return _playing;
+}
@@ -0,0 +1,110 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <limits>
+
+#include "vutuSynthesizer.h"
+#include "vutuPartialsPipeline.h"
+
+// real-time playback of partials. Voices are allocated when the partials are set, so
+// nothing is allocated while playing.
+
+namespace ml
+{
+
+class PartialsPlayer
+{
+public:
+  // set the partials to play and allocate voices for them. This allocates, so it must not be
+  // called from the audio thread, and playback must be stopped.
+  void setPartials(const VutuPartialsData* pPartials, float sampleRate);
+
+  void start(double time);
+  void stop();
+  bool isPlaying() const { return _playing; }
+
+  // jump to a new time. Voices for partials that are still sounding keep their phases.
+  void setTime(double time);
+  double getTime() const { return _time; }
+
+  // set the rate at which playback moves through the partials. The pitch does not change
+  // with the rate. 0 holds the current time, and negative rates play backwards.
+  void setRate(float rate) { _rate = rate; }
+
+  // transpose the partials by multiplying their frequencies by ratio.
+  void setPitchRatio(float ratio);
+
+  // play the partials through a pipeline without making a copy of them. Partials the pipeline
+  // drops are never started, and its transforms are applied as a pitch ratio, a change of
+  // playback rate and a gain. Times are still those of the original partials. This allocates
+  // like setPartials.
+  void setPipeline(const PartialsPipeline& pipeline);
+
+  // when culling is on, partials masked by louder neighbors are not rendered, and no more
+  // than maxVoices of the most salient partials are rendered. Partials fade in and out as
+  // they enter and leave the rendered set. maxVoices of 0 means no limit.
+  void setCulling(bool culling, size_t maxVoices = 0);
+
+  // add one DSPVector of output to out. Returns false once playback has run off either end.
+  bool processVector(DSPVector& out);
+
+  // the total number of partial vectors rendered, and the number skipped by culling.
+  size_t getVectorsRendered() const { return _vectorsRendered; }
+  size_t getVectorsCulled() const { return _vectorsCulled; }
+
+private:
+  static constexpr size_t kNone{std::numeric_limits< size_t >::max()};
+
+  const VutuPartialsData* _pPartials{nullptr};
+  SynthesisParams _synthParams;
+
+  // voices
+  std::vector< PartialOscillator > _oscillators;
+  std::vector< size_t > _voicePartial;
+  std::vector< size_t > _freeVoices;
+  std::vector< size_t > _activeVoices;
+
+  // culling state for each voice: current gain, whether it is selected for rendering, and
+  // whether its oscillator is stopped.
+  std::vector< float > _voiceGain;
+  std::vector< bool > _voiceSelected;
+  std::vector< bool > _voiceDormant;
+  std::vector< size_t > _voiceSegment;
+  std::vector< float > _voiceSalience;
+  std::vector< float > _voiceBark;
+  std::vector< float > _voiceMasking;
+  std::vector< size_t > _cullOrder;
+
+  bool _culling{false};
+  size_t _maxVoices{0};
+  size_t _vectorsRendered{0};
+  size_t _vectorsCulled{0};
+
+  // for each partial, its voice or kNone, its time range including fades, and its noise seed.
+  std::vector< size_t > _partialVoice;
+  std::vector< Interval > _partialExtents;
+  std::vector< uint32_t > _partialSeeds;
+  std::vector< uint8_t > _partialKept;
+  PartialsPipeline _pipeline;
+
+  // partials in order of start time, and the next one to start when playing forwards.
+  std::vector< size_t > _startOrder;
+  size_t _nextToStart{0};
+  bool _needsScan{true};
+
+  double _time{0};
+  double _endTime{0};
+  float _rate{1};
+  float _pitchRatio{1};
+  bool _playing{false};
+
+  void startVoice(size_t partialIdx, double time);
+  void releaseAllVoices();
+  void startVoicesInRange(double t0, double t1);
+  void selectVoices(double time);
+};
+
+}
@@ -0,0 +1,229 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuPitch.h"
+#include "vutuFFT.h"
+
+using namespace ml;
+
+namespace
+{
+
+constexpr size_t kMaxFrames{24};
+constexpr float kYinThreshold{0.15f};
+constexpr float kSilentFrameRatio{0.01f}; // frames with less than this fraction of the max power are skipped
+constexpr float kAgreementCents{50.f};
+
+// computes the YIN difference function d(tau) for tau in [0, maxTau) over a window of
+// windowSize samples, using an FFT to get the cross-correlation term.
+class YinDifference
+{
+public:
+  YinDifference(size_t windowSize, size_t maxTau) :
+    _windowSize(windowSize), _maxTau(maxTau), _fft(nextPowerOfTwo(windowSize + maxTau))
+  {
+    size_t n = _fft.getSize();
+    _re.resize(n);
+    _im.resize(n);
+    _cRe.resize(n);
+    _cIm.resize(n);
+  }
+
+  // x must have windowSize + maxTau samples available.
+  void operator()(const float* x, float* d)
+  {
+    size_t n = _fft.getSize();
+    size_t frameSize = _windowSize + _maxTau;
+
+    // pack the window a (real) and the whole frame b (imaginary) into one transform
+    std::fill(_re.begin(), _re.end(), 0.f);
+    std::fill(_im.begin(), _im.end(), 0.f);
+    std::copy(x, x + _windowSize, _re.begin());
+    std::copy(x, x + frameSize, _im.begin());
+    _fft.forward(_re.data(), _im.data());
+
+    // separate the spectra A and B and get C = conj(A)B, the spectrum of the cross-correlation
+    for(size_t k=0; k<n; ++k)
+    {
+      size_t k2 = (n - k) & (n - 1);
+      float aRe = 0.5f*(_re[k] + _re[k2]);
+      float aIm = 0.5f*(_im[k] - _im[k2]);
+      float bRe = 0.5f*(_im[k] + _im[k2]);
+      float bIm = -0.5f*(_re[k] - _re[k2]);
+      _cRe[k] = aRe*bRe + aIm*bIm;
+      _cIm[k] = aRe*bIm - aIm*bRe;
+    }
+    _fft.inverse(_cRe.data(), _cIm.data());
+
+    // d(tau) = sum of a^2 + sum of shifted a^2 - 2 * cross-correlation
+    float energy0{0.f};
+    for(size_t j=0; j<_windowSize; ++j)
+    {
+      energy0 += x[j]*x[j];
+    }
+    float energyTau = energy0;
+    d[0] = 0.f;
+    for(size_t tau=1; tau<_maxTau; ++tau)
+    {
+      float leaving = x[tau - 1];
+      float entering = x[tau - 1 + _windowSize];
+      energyTau += entering*entering - leaving*leaving;
+      d[tau] = std::max(energy0 + energyTau - 2.f*_cRe[tau], 0.f);
+    }
+  }
+
+private:
+  size_t _windowSize;
+  size_t _maxTau;
+  FFT _fft;
+  std::vector< float > _re, _im, _cRe, _cIm;
+};
+
+// estimate the period of one frame in samples. Returns the period and sets aperiodicity
+// to the cumulative mean normalized difference at that period (0 = perfectly periodic).
+float yinPeriod(std::vector< float >& d, size_t minTau, size_t maxTau, float& aperiodicity)
+{
+  // cumulative mean normalized difference
+  float runningSum{0.f};
+  d[0] = 1.f;
+  for(size_t tau=1; tau<maxTau; ++tau)
+  {
+    runningSum += d[tau];
+    d[tau] = (runningSum > 0.f) ? d[tau]*tau/runningSum : 1.f;
+  }
+
+  // take the first dip below the threshold, or the global minimum if there is none
+  size_t best = minTau;
+  for(size_t tau=minTau; tau<maxTau; ++tau)
+  {
+    if(d[tau] < d[best])
+    {
+      best = tau;
+    }
+  }
+  for(size_t tau=minTau; tau<maxTau; ++tau)
+  {
+    if(d[tau] < kYinThreshold)
+    {
+      while((tau + 1 < maxTau) && (d[tau + 1] < d[tau]))
+      {
+        tau++;
+      }
+      best = tau;
+      break;
+    }
+  }
+  aperiodicity = d[best];
+
+  // parabolic interpolation around the minimum
+  float period = best;
+  if((best > minTau) && (best + 1 < maxTau))
+  {
+    float a = d[best - 1];
+    float b = d[best];
+    float c = d[best + 1];
+    float denom = a - 2.f*b + c;
+    if(denom > 0.f)
+    {
+      period += 0.5f*(a - c)/denom;
+    }
+  }
+  return period;
+}
+
+}
+
+PitchEstimate ml::estimateFundamental(const ml::Sample& sample, Interval interval, Interval freqRange)
+{
+  PitchEstimate r;
+  float sr = sample.sampleRate;
+  size_t totalFrames = getFrames(sample);
+  if(!totalFrames || sr <= 0.f || freqRange.mX1 <= 0.f) return r;
+
+  auto frameInterval = interval*float(totalFrames);
+  size_t start = frameInterval.mX1;
+  size_t end = std::min(size_t(frameInterval.mX2), totalFrames);
+
+  // window length is one period of the lowest frequency, which needs twice that many samples.
+  size_t minTau = std::max(size_t(2), size_t(sr/freqRange.mX2));
+  size_t maxTau = size_t(sr/freqRange.mX1) + 2;
+  size_t windowSize = maxTau;
+  size_t frameSize = windowSize + maxTau;
+  if(end < start + frameSize) return r;
+
+  // choose frame starts spread evenly through the interval
+  size_t nFrames = std::min(kMaxFrames, (end - start)/frameSize);
+  nFrames = std::max(nFrames, size_t(1));
+  size_t frameStep = (nFrames > 1) ? (end - start - frameSize)/(nFrames - 1) : 0;
+
+  // get the power of each frame so we can skip the quiet ones
+  std::vector< float > framePower(nFrames);
+  float maxPower{0.f};
+  for(size_t f=0; f<nFrames; ++f)
+  {
+    const float* x = getConstFramePtr(sample, start + f*frameStep);
+    float p{0.f};
+    for(size_t j=0; j<windowSize; ++j)
+    {
+      p += x[j]*x[j];
+    }
+    framePower[f] = p;
+    maxPower = std::max(maxPower, p);
+  }
+
+  struct FrameEstimate
+  {
+    float frequency;
+    float periodicity;
+  };
+  std::vector< FrameEstimate > estimates;
+  std::vector< float > d(maxTau);
+  YinDifference yinDifference(windowSize, maxTau);
+  for(size_t f=0; f<nFrames; ++f)
+  {
+    if(framePower[f] < maxPower*kSilentFrameRatio) continue;
+    const float* x = getConstFramePtr(sample, start + f*frameStep);
+    yinDifference(x, d.data());
+    float aperiodicity{1.f};
+    float period = yinPeriod(d, minTau, maxTau, aperiodicity);
+    if(period > 0.f)
+    {
+      estimates.push_back({sr/period, clamp(1.f - aperiodicity, 0.f, 1.f)});
+    }
+  }
+  if(estimates.empty()) return r;
+
+  // take the median of the frame frequencies weighted by periodicity
+  std::sort(estimates.begin(), estimates.end(), [](const FrameEstimate& a, const FrameEstimate& b){ return a.frequency < b.frequency; });
+  float totalWeight{0.f};
+  for(const auto& e : estimates)
+  {
+    totalWeight += e.periodicity;
+  }
+  float halfWeight = totalWeight/2.f;
+  float weightSoFar{0.f};
+  r.frequency = estimates.back().frequency;
+  for(const auto& e : estimates)
+  {
+    weightSoFar += e.periodicity;
+    if(weightSoFar >= halfWeight)
+    {
+      r.frequency = e.frequency;
+      break;
+    }
+  }
+
+  // confidence is the periodicity of the agreeing frames over the number of frames estimated
+  float agreeingWeight{0.f};
+  for(const auto& e : estimates)
+  {
+    float cents = 1200.f*fabsf(log2f(e.frequency/r.frequency));
+    if(cents < kAgreementCents)
+    {
+      agreeingWeight += e.periodicity;
+    }
+  }
+  r.confidence = agreeingWeight/estimates.size();
+  return r;
+}
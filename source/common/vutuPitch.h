@@ -0,0 +1,35 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "madronalib.h"
+#include "MLDSPSample.h"
+
+// fast estimation of the fundamental frequency of a sample, used to seed the analysis parameters.
+
+namespace ml
+{
+
+struct PitchEstimate
+{
+  float frequency{0};
+
+  // 0 to 1: the fraction of voiced frames that agree with the estimate, weighted by their periodicity.
+  float confidence{0};
+};
+
+// estimates with less confidence than this should not be used to set parameters.
+constexpr float kMinPitchConfidence{0.5f};
+
+// estimate the fundamental of the given interval of a mono sample using the YIN method on a
+// set of frames spread through the interval. The difference function is computed with FFTs.
+// Only frequencies within freqRange are considered.
+PitchEstimate estimateFundamental(const ml::Sample& sample, Interval interval, Interval freqRange);
+
+// get the analysis resolution and window width suggested for a given fundamental.
+inline float getResolutionForFundamental(float f0) { return 0.8f*f0; }
+inline float getWindowWidthForFundamental(float f0) { return f0; }
+
+}
@@ -8,16 +8,12 @@
 
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <math.h>
 #include <iostream>
 
 #include "libresample.h"
 
-// Loris includes
-#include "loris.h"
-#include "PartialList.h"
-#include "Synthesizer.h"
-
 using namespace ml;
 
 constexpr float kSizeLo = 0, kSizeHi = 40;
@@ -95,6 +91,41 @@ void readParameterDescriptions(ParameterDescriptionList& params)
     { "units", "Hz" }
   } ) );
   
+  params.push_back( std::make_unique< ParameterDescription >(WithValues{
+    { "name", "simplify_cents" },
+    { "range", {0, 50} },
+    { "plaindefault", 5 },
+    { "units", "cents" }
+  } ) );
+  
+  params.push_back( std::make_unique< ParameterDescription >(WithValues{
+    { "name", "simplify_db" },
+    { "range", {0, 6} },
+    { "plaindefault", 0.5f },
+    { "units", "dB" }
+  } ) );
+  
+  params.push_back( std::make_unique< ParameterDescription >(WithValues{
+    { "name", "playback_rate" },
+    { "range", {0.25f, 4.f} },
+    { "plaindefault", 1.f },
+    { "log", true },
+    { "units", "x" }
+  } ) );
+  
+  params.push_back( std::make_unique< ParameterDescription >(WithValues{
+    { "name", "morph" },
+    { "range", {0, 1} },
+    { "plaindefault", 0 }
+  } ) );
+  
+  params.push_back( std::make_unique< ParameterDescription >(WithValues{
+    { "name", "max_voices" },
+    { "range", {8, 1024} },
+    { "plaindefault", 512 },
+    { "log", true }
+  } ) );
+  
   params.push_back( std::make_unique< ParameterDescription >(WithValues{
     { "name", "fundamental" },
     { "range", {22, 2200} },
@@ -209,12 +240,51 @@ RtAudioProcessor(nInputs, nOutputs, sampleRate)
   
   // register ourself
   auto myName = TextFragment(appName, "processor", ml::textUtils::naturalNumberToText(instanceNum));
+  _processorName = myName;
   registerActor(myName, this);
   
   buildParameterTree(pdl, _params);
   setDefaults(_params);
 }
 
+VutuProcessor::~VutuProcessor()
+{
+  delete _pendingPlayback.exchange(nullptr);
+  delete _retiredPlayback.exchange(nullptr);
+}
+
+void VutuProcessor::publishPlayback()
+{
+  auto pPlayback = std::make_unique< PartialsPlayback >();
+  pPlayback->partials = _latestPartials;
+  pPlayback->player.setPartials(pPlayback->partials.get(), _processData.sampleRate);
+  pPlayback->morph = _latestMorph;
+  pPlayback->morphPlayer.setMorph(pPlayback->morph.get(), _processData.sampleRate);
+  pPlayback->instrument.setPartials(pPlayback->partials.get(), _processData.sampleRate);
+
+  // a playback the audio thread has not taken yet can be replaced.
+  delete _pendingPlayback.exchange(pPlayback.release());
+  freeRetiredPlayback();
+}
+
+void VutuProcessor::freeRetiredPlayback()
+{
+  delete _retiredPlayback.exchange(nullptr);
+}
+
+void VutuProcessor::takePendingPlayback()
+{
+  if(_retiredPlayback.load()) return;
+  PartialsPlayback* pNew = _pendingPlayback.exchange(nullptr);
+  if(!pNew) return;
+  _retiredPlayback.store(_pPlayback.release());
+  _pPlayback.reset(pNew);
+
+  // synth playback started since the partials were sent starts again on the new player.
+  _synthStartPending = (playbackState == "synth");
+  sendMessageToActor(_processorName, Message{"do/free_playback"});
+}
+
 // declare the processVector function that will run our DSP in vectors of size kFloatsPerDSPVector
 // with the nullptr constructor argument above, RtAudioProcessor
 void VutuProcessor::processVector(MainInputs inputs, MainOutputs outputs, void *stateDataUnused)
@@ -235,6 +305,12 @@ void VutuProcessor::processVector(MainInputs inputs, MainOutputs outputs, void *
     //std::cout << "analysis interval: " << _params.getRealValue("analysis_interval").getIntervalValue() << "\n";
   }
   
+  takePendingPlayback();
+  if(_allNotesOffPending.exchange(false) && _pPlayback)
+  {
+    _pPlayback->instrument.allNotesOff();
+  }
+
   // get params from the SignalProcessor.
   float gain = _params.getRealFloatValue("output_volume");
   float amp = dBToAmp(gain);
@@ -262,12 +338,78 @@ void VutuProcessor::processVector(MainInputs inputs, MainOutputs outputs, void *
 
     viewProperty = "source_time";
   }
+  else if(playbackState == "residual")
+  {
+    // residual: play all of it, since it covers only the analysis interval
+    samplePlaying = &_residualSample;
+    frameEnd = getFrames(*samplePlaying);
+    viewProperty = "residual_time";
+  }
   else if(playbackState == "synth")
   {
-    // synthesized: play entire length
-    samplePlaying = _pSynthesizedSample;
-    frameEnd = getEndFrame(*samplePlaying, {0, 1});
-    viewProperty = "synth_time";
+    // synthesized: render the partials, or the morph, in real time. While scrubbing, hold at
+    // the scrub position, otherwise move through the partials at the playback rate. Times
+    // in the morph are shown on the time scale of the partials.
+    float rate = _scrubbing ? 0.f : _params.getRealFloatValue("playback_rate");
+    bool playing;
+    float playbackTime;
+    if(_pPlayback && _pPlayback->morph)
+    {
+      MorphPlayer& morphPlayer = _pPlayback->morphPlayer;
+      float displayDuration = _pPlayback->morph->getDuration(0.f);
+      if(_synthStartPending.exchange(false))
+      {
+        morphPlayer.start(0.f);
+      }
+      if(_scrubPending.exchange(false))
+      {
+        morphPlayer.setPosition(_scrubTime.load()/displayDuration);
+      }
+      morphPlayer.setRate(rate);
+      morphPlayer.setAmount(_params.getRealFloatValue("morph"));
+      playing = morphPlayer.processVector(sampleVec);
+      playbackTime = morphPlayer.getPosition()*displayDuration;
+    }
+    else if(_pPlayback)
+    {
+      PartialsPlayer& player = _pPlayback->player;
+      if(_synthStartPending.exchange(false))
+      {
+        player.start(0.);
+      }
+      if(_scrubPending.exchange(false))
+      {
+        player.setTime(_scrubTime.load());
+      }
+      player.setRate(rate);
+      player.setCulling(true, _params.getRealFloatValue("max_voices"));
+      playing = player.processVector(sampleVec);
+      playbackTime = player.getTime();
+    }
+    else
+    {
+      playing = false;
+      playbackTime = 0.f;
+    }
+    
+    if(!playing)
+    {
+      playbackState = "off";
+      sendMessageToActor(_controllerName, Message{"do/playback_stopped"});
+    }
+    sendMessageToActor(_controllerName, Message{"set_prop/synth_time", playbackTime});
+  }
+  else if(playbackState == "instrument")
+  {
+    NoteEvent e;
+    while(_noteEvents.pop(e))
+    {
+      if(_pPlayback) _pPlayback->instrument.handleEvent(e);
+    }
+    if(_pPlayback)
+    {
+      _pPlayback->instrument.processVector(sampleVec);
+    }
   }
 
   if(samplePlaying)
@@ -301,6 +443,7 @@ void VutuProcessor::togglePlaybackState(Symbol whichSample)
   if(playbackState != "off")
   {
     playbackState = "off";
+    _allNotesOffPending = true;
     playbackSampleIdx = 0;
     sendMessageToActor(_controllerName, Message{"do/playback_stopped"});
     sendMessageToActor(_controllerName, Message{"set_prop/source_time", 0});
@@ -321,15 +464,28 @@ void VutuProcessor::togglePlaybackState(Symbol whichSample)
       }
     }
   }
+  else if(whichSample == "residual")
+  {
+    if(prevState != "residual")
+    {
+      if(getFrames(_residualSample) > kFloatsPerDSPVector)
+      {
+        playbackState = "residual";
+        playbackSampleIdx = 0;
+        sendMessageToActor(_controllerName, Message{"do/playback_started/residual"});
+      }
+    }
+  }
   else if(whichSample == "synth")
   {
     if(prevState != "synth")
     {
-      if(usable(_pSynthesizedSample))
+      if(_latestPartials && (_latestPartials->partials.size() > 0))
       {
-        // synthesized sample always starts from beginning
+        // synthesized partials always start from the beginning, on the audio thread.
+        _scrubbing = false;
+        _synthStartPending = true;
         playbackState = "synth";
-        playbackSampleIdx = 0;
         sendMessageToActor(_controllerName, Message{"do/playback_started/synth"});
       }
     }
@@ -340,6 +496,8 @@ void VutuProcessor::onMessage(Message msg)
 {
 //  std::cout << "VutuProcessor: " << msg.address << " -> " << msg.value << "\n";
   
+  freeRetiredPlayback();
+
   switch(hash(head(msg.address)))
   {
     case(hash("set_param")):
@@ -374,29 +532,105 @@ void VutuProcessor::onMessage(Message msg)
           break;
         }
           
-        case(hash("set_loris_partials_data")):
+        case(hash("set_residual_data")):
+        {
+          if(playbackState == "residual")
+          {
+            playbackState = "off";
+            playbackSampleIdx = 0;
+            sendMessageToActor(_controllerName, Message{"do/playback_stopped"});
+          }
+          
+          // resample the residual to the current system sample rate for playback
+          ml::Sample* pResidual = *reinterpret_cast<ml::Sample**>(msg.value.getBlobValue());
+          _residualSample.sampleRate = _processData.sampleRate;
+          if(usable(pResidual))
+          {
+            resample(pResidual, &_residualSample);
+          }
+          else
+          {
+            clear(_residualSample);
+          }
+          break;
+        }
+          
+        case(hash("set_partials_data")):
         {
           playbackState = "off";
           sendMessageToActor(_controllerName, Message{"do/playback_stopped"});
           
-          // get pointer from message
-          Loris::PartialList* pPartials = *reinterpret_cast<Loris::PartialList**>(msg.value.getBlobValue());
-          _pLorisPartials = *reinterpret_cast<Loris::PartialList**>(msg.value.getBlobValue());
-          
-
- //         std::cout << "VutuProcessor: got new loris partials: n = " << _pLorisPartials->size() << "\n";
-
+          // take ownership of the shared pointer in the message, and set up voices for
+          // real-time playback
+          auto pShared = *reinterpret_cast<std::shared_ptr< const VutuPartialsData >**>(msg.value.getBlobValue());
+          _latestPartials = std::move(*pShared);
+          delete pShared;
+          publishPlayback();
           break;
         }
 
-        case(hash("set_synth_data")):
+        case(hash("free_playback")):
+        {
+          // sent by the audio thread when it has retired a playback.
+          break;
+        }
+          
+        case(hash("set_morph_data")):
         {
           playbackState = "off";
           sendMessageToActor(_controllerName, Message{"do/playback_stopped"});
           
-          // get pointer from message
-          _pSynthesizedSample = *reinterpret_cast<ml::Sample**>(msg.value.getBlobValue());
-
+          // take ownership of the shared pointer in the message, which is null when there is
+          // no morph target
+          auto pShared = *reinterpret_cast<std::shared_ptr< const PartialsMorph >**>(msg.value.getBlobValue());
+          _latestMorph = std::move(*pShared);
+          delete pShared;
+          publishPlayback();
+          break;
+        }
+          
+        case(hash("scrub")):
+        {
+          // start partials playback if needed, then hold at the scrub time until scrub_end.
+          if(playbackState != "synth")
+          {
+            togglePlaybackState("synth");
+          }
+          if(playbackState == "synth")
+          {
+            _scrubTime = msg.value.getFloatValue();
+            _scrubPending = true;
+            _scrubbing = true;
+          }
+          break;
+        }
+          
+        case(hash("scrub_end")):
+        {
+          _scrubbing = false;
+          break;
+        }
+          
+        case(hash("note")):
+        {
+          // the message holds a NoteEvent, which is applied now whatever its time. A blob of
+          // any other size is ignored.
+          if(msg.value.getBlobSize() != sizeof(NoteEvent)) break;
+          if(!_latestPartials || (_latestPartials->partials.size() == 0)) break;
+          if(playbackState != "instrument")
+          {
+            togglePlaybackState("off");
+            playbackState = "instrument";
+          }
+          NoteEvent e;
+          std::memcpy(&e, msg.value.getBlobValue(), sizeof(NoteEvent));
+          _noteEvents.push(e);
+          break;
+        }
+          
+        case(hash("all_notes_off")):
+        {
+          _allNotesOffPending = true;
           break;
         }
           
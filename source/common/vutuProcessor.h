@@ -15,7 +15,13 @@
 #include "MLMath2D.h"
 #include "MLDSPSample.h"
 
-#include "loris.h"
+#include "vutuPartials.h"
+#include "vutuPartialsPlayer.h"
+#include "vutuMorph.h"
+#include "vutuInstrument.h"
+
+#include <atomic>
+#include <memory>
 
 using namespace ml;
 
@@ -25,6 +31,25 @@ constexpr int kSampleRate = 48000;
 
 void readParameterDescriptions(ParameterDescriptionList& params);
 
+// resample the first channel of pSrc to the sample rate of pDest, making pDest mono.
+void resample(const ml::Sample* pSrc, ml::Sample* pDest);
+
+// partials and the players made for them. A playback is made on the message thread and
+// handed to the audio thread whole, so nothing the audio thread reads is changed or freed
+// while it plays.
+struct PartialsPlayback
+{
+  std::shared_ptr< const VutuPartialsData > partials;
+  PartialsPlayer player;
+
+  // the morph to the target, played instead of the partials while a target is set.
+  std::shared_ptr< const PartialsMorph > morph;
+  MorphPlayer morphPlayer;
+
+  // the partials played as a polyphonic instrument.
+  PartialsInstrument instrument;
+};
+
 
 class VutuProcessor final :
 public RtAudioProcessor
@@ -36,7 +61,7 @@ public:
   VutuProcessor(TextFragment appName, size_t instanceNum,
                    size_t nInputs, size_t nOutputs,
                    int sampleRate, const ParameterDescriptionList& pdl);
-  ~VutuProcessor() = default;
+  ~VutuProcessor();
   
   void processVector(MainInputs inputs, MainOutputs outputs, void *stateDataUnused) override;
 
@@ -45,6 +70,7 @@ public:
 private:
   
   Path _controllerName;
+  Path _processorName;
   
   int testCounter{0};
   
@@ -56,11 +82,42 @@ private:
   
   ml::Sample* _pSourceSampleInController{nullptr};
   ml::Sample _sourceSample;
-  ml::Sample* _pSynthesizedSample{nullptr};
 
+  // the residual of the analysis, resampled for playback like the source.
+  ml::Sample _residualSample;
+
+  // real-time synthesis of the partials. The audio thread owns the current playback, takes
+  // a new one from _pendingPlayback and hands the old one back in _retiredPlayback, to be
+  // freed on the message thread.
+  std::unique_ptr< PartialsPlayback > _pPlayback;
+  std::atomic< PartialsPlayback* > _pendingPlayback{nullptr};
+  std::atomic< PartialsPlayback* > _retiredPlayback{nullptr};
+  std::atomic< bool > _synthStartPending{false};
+
+  // the latest partials and morph sent, for the message thread.
+  std::shared_ptr< const VutuPartialsData > _latestPartials;
+  std::shared_ptr< const PartialsMorph > _latestMorph;
+
+  // note events sent in "do/note" messages, for the instrument on the audio thread. The first
+  // note switches playback to the instrument.
+  NoteEventQueue _noteEvents;
+  std::atomic< bool > _allNotesOffPending{false};
+  
+  // scrub position from the partials display, applied on the audio thread.
+  std::atomic< float > _scrubTime{0.f};
+  std::atomic< bool > _scrubPending{false};
+  std::atomic< bool > _scrubbing{false};
 
-  Loris::PartialList* _pLorisPartials{ nullptr };
 
   void togglePlaybackState(Symbol whichSample);
 
+  // make a playback for the latest partials and morph and hand it to the audio thread.
+  void publishPlayback();
+
+  // free the playback retired by the audio thread, if any.
+  void freeRetiredPlayback();
+
+  // on the audio thread, switch to a pending playback once the last one has been freed.
+  void takePendingPlayback();
+
 };
@@ -0,0 +1,191 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuResidual.h"
+#include "vutuFFT.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace ml;
+
+namespace
+{
+
+// band powers are measured with Hann-windowed frames overlapping by half.
+constexpr size_t kResidualFrameSize{2048};
+constexpr size_t kResidualHopSize{kResidualFrameSize/2};
+
+// lower edges of the octave bands. The top band goes up to Nyquist.
+constexpr float kBandEdges[]{0, 125, 250, 500, 1000, 2000, 4000, 8000, 16000};
+
+// sums of source power, synth power and their cross product.
+struct PowerSums
+{
+  double source{0};
+  double synth{0};
+  double cross{0};
+
+  // get the SNR in dB of the source against source - gain*synth.
+  float getSNR(double gain) const
+  {
+    if(source <= 0.) return 0.f;
+    double residual = source - 2.*gain*cross + gain*gain*synth;
+    residual = std::max(residual, source*1e-12);
+    return 10.f*log10f(float(source/residual));
+  }
+};
+
+const std::vector< float >& getHannWindow()
+{
+  static const std::vector< float > window = []()
+  {
+    std::vector< float > w(kResidualFrameSize);
+    for(size_t i=0; i<w.size(); ++i)
+    {
+      w[i] = 0.5f - 0.5f*cosf(6.2831853f*i/kResidualFrameSize);
+    }
+    return w;
+  }();
+  return window;
+}
+
+// load a DSPVector from x starting at start, with zeros past the end of x.
+inline void loadPadded(const std::vector< float >& x, size_t start, DSPVector& v)
+{
+  if(start + kFloatsPerDSPVector <= x.size())
+  {
+    load(v, x.data() + start);
+  }
+  else
+  {
+    float* pv = v.getBuffer();
+    for(size_t i=0; i<kFloatsPerDSPVector; ++i)
+    {
+      pv[i] = (start + i < x.size()) ? x[start + i] : 0.f;
+    }
+  }
+}
+
+}
+
+ResidualStats ml::measureResidual(const std::vector< float >& source, const std::vector< float >& synth, float sampleRate)
+{
+  constexpr size_t N = kResidualFrameSize;
+  constexpr size_t H = kResidualHopSize;
+  constexpr size_t V = kFloatsPerDSPVector;
+  const size_t nSamples = source.size();
+  const float nyquist = sampleRate*0.5f;
+
+  ResidualStats stats;
+  for(size_t i=0; (i < std::size(kBandEdges)) && (kBandEdges[i] < nyquist); ++i)
+  {
+    float hi = (i + 1 < std::size(kBandEdges)) ? std::min(kBandEdges[i + 1], nyquist) : nyquist;
+    stats.bands.push_back(ResidualBand{Interval{kBandEdges[i], hi}, 0.f, 0.f});
+  }
+  std::vector< size_t > binBand(N/2 + 1);
+  for(size_t k=0, b=0; k<=N/2; ++k)
+  {
+    float f = k*sampleRate/N;
+    while((b + 1 < stats.bands.size()) && (f >= stats.bands[b + 1].freqRange.mX1)) b++;
+    binBand[k] = b;
+  }
+
+  const auto& window = getHannWindow();
+  const FFT fft(N);
+  std::vector< float > re(N), im(N);
+  PowerSums total;
+  std::vector< PowerSums > bandSums(stats.bands.size());
+
+  for(size_t frameStart=0; frameStart < nSamples; frameStart += H)
+  {
+    // window the source into the real part and the synth into the imaginary part, so that
+    // one transform gives both spectra. The first half of each frame is new, so the
+    // broadband sums are taken from it.
+    for(size_t j=0; j<N; j += V)
+    {
+      DSPVector s, y, w;
+      loadPadded(source, frameStart + j, s);
+      loadPadded(synth, frameStart + j, y);
+      load(w, window.data() + j);
+      if(j < H)
+      {
+        total.source += sum(s*s);
+        total.synth += sum(y*y);
+        total.cross += sum(s*y);
+      }
+      store(s*w, re.data() + j);
+      store(y*w, im.data() + j);
+    }
+    fft.forward(re.data(), im.data());
+
+    // separate the two spectra using their Hermitian symmetry.
+    for(size_t k=0; k<=N/2; ++k)
+    {
+      size_t m = (N - k) & (N - 1);
+      float xr = 0.5f*(re[k] + re[m]);
+      float xi = 0.5f*(im[k] - im[m]);
+      float yr = 0.5f*(im[k] + im[m]);
+      float yi = 0.5f*(re[m] - re[k]);
+      PowerSums& b = bandSums[binBand[k]];
+      b.source += xr*xr + xi*xi;
+      b.synth += yr*yr + yi*yi;
+      b.cross += xr*yr + xi*yi;
+    }
+  }
+
+  // scale the synth by the least-squares gain, which minimizes the residual power.
+  double gain = (total.synth > 0.) ? total.cross/total.synth : 0.;
+  stats.gain = float(gain);
+  stats.snr = total.getSNR(gain);
+
+  double bandSourceTotal{0};
+  for(const auto& b : bandSums)
+  {
+    bandSourceTotal += b.source;
+  }
+  for(size_t i=0; i<stats.bands.size(); ++i)
+  {
+    double level = (bandSourceTotal > 0.) ? bandSums[i].source/bandSourceTotal : 0.;
+    stats.bands[i].level = 10.f*log10f(float(std::max(level, 1e-30)));
+    stats.bands[i].snr = bandSums[i].getSNR(gain);
+  }
+  return stats;
+}
+
+void ml::makeResidual(const std::vector< float >& source, const std::vector< float >& synth, float gain, float sampleRate, ml::Sample& out)
+{
+  constexpr size_t V = kFloatsPerDSPVector;
+  const size_t nSamples = source.size();
+  resize(out, nSamples, 1);
+  out.sampleRate = sampleRate;
+
+  size_t i{0};
+  const DSPVector g(gain);
+  for(; i + V <= std::min(nSamples, synth.size()); i += V)
+  {
+    DSPVector s, y;
+    load(s, source.data() + i);
+    load(y, synth.data() + i);
+    store(s - y*g, getFramePtr(out, i));
+  }
+  for(; i<nSamples; ++i)
+  {
+    out[i] = source[i] - ((i < synth.size()) ? gain*synth[i] : 0.f);
+  }
+}
+
+const ResidualBand* ml::getWorstResidualBand(const ResidualStats& stats, float minLevel)
+{
+  const ResidualBand* pWorst{nullptr};
+  for(const auto& b : stats.bands)
+  {
+    if((b.level > minLevel) && (!pWorst || (b.snr < pWorst->snr)))
+    {
+      pWorst = &b;
+    }
+  }
+  return pWorst;
+}
@@ -0,0 +1,51 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <vector>
+
+#include "madronalib.h"
+#include "MLDSPSample.h"
+
+// the residual of an analysis: the source minus the resynthesized partials. The synthesis is
+// scaled by the least-squares gain first, because synthesized samples are normalized. The
+// ratio of source power to residual power, overall and in octave bands, measures how well
+// the partials match the source.
+
+namespace ml
+{
+
+struct ResidualBand
+{
+  Interval freqRange;
+
+  // level of the source in the band relative to the whole source, in dB.
+  float level{0};
+
+  // ratio of source power to residual power in the band, in dB.
+  float snr{0};
+};
+
+struct ResidualStats
+{
+  float snr{0};
+  float gain{0};
+  std::vector< ResidualBand > bands;
+};
+
+// measure the residual of a synthesized signal against a source at the same sample rate,
+// both starting at the start of the analysis interval. If synth is shorter than source, it is
+// treated as silent past its end. The broadband and band powers are gathered together in
+// one pass over the signals.
+ResidualStats measureResidual(const std::vector< float >& source, const std::vector< float >& synth, float sampleRate);
+
+// make the residual source - gain*synth as a sample at the given rate.
+void makeResidual(const std::vector< float >& source, const std::vector< float >& synth, float gain, float sampleRate, ml::Sample& out);
+
+// get the band with the lowest SNR of those with a source level above minLevel dB, or
+// nullptr if there are none.
+const ResidualBand* getWorstResidualBand(const ResidualStats& stats, float minLevel = -30.f);
+
+}
@@ -0,0 +1,176 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSampleFiles.h"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+#include "sndfile.hh"
+
+using namespace ml;
+
+namespace
+{
+
+// write the file in blocks of this many frames.
+constexpr size_t kWriteBlockFrames{4096};
+
+int getSoundFileFormatFlags(const SoundFileFormat& format)
+{
+  int type = format.aiff ? SF_FORMAT_AIFF : SF_FORMAT_WAV;
+  switch(format.bitDepth)
+  {
+    case 16:
+      return type | SF_FORMAT_PCM_16;
+    case 24:
+      return type | SF_FORMAT_PCM_24;
+    default:
+      return type | SF_FORMAT_FLOAT;
+  }
+}
+
+}
+
+bool ml::readMonoSampleFromFile(const TextFragment& filePath, ml::Sample& dest, float maxSeconds, SampleFileInfo& info)
+{
+  info = SampleFileInfo{};
+  SF_INFO fileInfo{};
+  SNDFILE* file = sf_open(filePath.getText(), SFM_READ, &fileInfo);
+  if(!file) return false;
+
+  size_t maxFrames = maxSeconds*fileInfo.samplerate;
+  size_t framesToRead = std::min(size_t(fileInfo.frames), maxFrames);
+  info.framesInFile = fileInfo.frames;
+  info.sampleRate = fileInfo.samplerate;
+  info.channels = fileInfo.channels;
+  info.truncated = (framesToRead == maxFrames);
+
+  auto pData = resize(dest, framesToRead, fileInfo.channels);
+  dest.sampleRate = fileInfo.samplerate;
+
+  sf_count_t framesRead{0};
+  if(pData)
+  {
+    framesRead = sf_readf_float(file, pData, static_cast<sf_count_t>(framesToRead));
+  }
+  sf_close(file);
+  info.framesRead = framesRead;
+
+  // deinterleave in place to extract first channel if needed
+  if(usable(&dest) && dest.channels > 1)
+  {
+    for(int i=0; i < framesRead; ++i)
+    {
+      dest[i] = dest[i*dest.channels];
+    }
+    resize(dest, framesRead, 1);
+  }
+
+  return (info.framesRead == framesToRead);
+}
+
+bool ml::isAIFFPath(const TextFragment& filePath)
+{
+  std::string path(filePath.getText());
+  auto dot = path.rfind('.');
+  if(dot == std::string::npos) return false;
+  std::string ext = path.substr(dot + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c){ return std::tolower(c); });
+  return (ext == "aif") || (ext == "aiff") || (ext == "aifc");
+}
+
+bool SoundFileWriter::open(const TextFragment& filePath, const SoundFileFormat& format)
+{
+  close();
+  _format = format;
+  _format.channels = std::max(1, _format.channels);
+
+  SF_INFO fileInfo{};
+  fileInfo.samplerate = _format.sampleRate;
+  fileInfo.channels = _format.channels;
+  fileInfo.format = getSoundFileFormatFlags(_format);
+  if(!sf_format_check(&fileInfo)) return false;
+
+  _file = sf_open(filePath.getText(), SFM_WRITE, &fileInfo);
+  if(!_file) return false;
+
+  // clip out-of-range floats when converting to integers, instead of wrapping.
+  sf_command(_file, SFC_SET_CLIPPING, nullptr, SF_TRUE);
+  _interleaved.resize(kWriteBlockFrames*_format.channels);
+  return true;
+}
+
+void SoundFileWriter::close()
+{
+  if(_file)
+  {
+    sf_close(_file);
+    _file = nullptr;
+  }
+}
+
+// triangular dither of +/- 1 LSB, or 0 if not dithering. The float to integer conversion is
+// done by libsndfile.
+float SoundFileWriter::getDither()
+{
+  if(!_format.dither || (_format.bitDepth >= 32)) return 0.f;
+  float lsb = 1.f/float(1 << (_format.bitDepth - 1));
+  auto nextUniform = [&]()
+  {
+    _ditherState = _ditherState*1664525u + 1013904223u;
+    return float(_ditherState >> 8)*(1.f/16777216.f);
+  };
+  return (nextUniform() + nextUniform() - 1.f)*lsb;
+}
+
+bool SoundFileWriter::writeMono(const float* pSrc, size_t frames)
+{
+  if(!_file) return false;
+
+  const size_t channels = _format.channels;
+  for(size_t start=0; start<frames; start += kWriteBlockFrames)
+  {
+    size_t blockFrames = std::min(kWriteBlockFrames, frames - start);
+    for(size_t i=0; i<blockFrames; ++i)
+    {
+      float x = pSrc[start + i] + getDither();
+      for(size_t c=0; c<channels; ++c)
+      {
+        _interleaved[i*channels + c] = x;
+      }
+    }
+    if(sf_writef_float(_file, _interleaved.data(), blockFrames) != sf_count_t(blockFrames)) return false;
+  }
+  return true;
+}
+
+bool SoundFileWriter::writeChannels(const std::vector< const float* >& sources, size_t frames)
+{
+  if(!_file) return false;
+
+  const size_t channels = _format.channels;
+  for(size_t start=0; start<frames; start += kWriteBlockFrames)
+  {
+    size_t blockFrames = std::min(kWriteBlockFrames, frames - start);
+    for(size_t i=0; i<blockFrames; ++i)
+    {
+      for(size_t c=0; c<channels; ++c)
+      {
+        float x = (c < sources.size()) ? sources[c][start + i] : 0.f;
+        _interleaved[i*channels + c] = x + getDither();
+      }
+    }
+    if(sf_writef_float(_file, _interleaved.data(), blockFrames) != sf_count_t(blockFrames)) return false;
+  }
+  return true;
+}
+
+bool ml::writeMonoSampleToFile(const TextFragment& filePath, const ml::Sample& src, const SoundFileFormat& format)
+{
+  SoundFileWriter writer;
+  if(!writer.open(filePath, format)) return false;
+  return writer.writeMono(getConstFramePtr(src), getFrames(src));
+}
@@ -0,0 +1,76 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <vector>
+
+#include "madronalib.h"
+#include "MLDSPSample.h"
+
+#include "sndfile.h"
+
+// reading and writing sound files with libsndfile.
+
+namespace ml
+{
+
+struct SampleFileInfo
+{
+  size_t framesInFile{0};
+  size_t framesRead{0};
+  int sampleRate{0};
+  int channels{0};
+  bool truncated{false};
+};
+
+// read the first channel of the sound file at filePath into dest, reading no more than
+// maxSeconds of audio. Returns true if all the requested frames were read.
+bool readMonoSampleFromFile(const TextFragment& filePath, ml::Sample& dest, float maxSeconds, SampleFileInfo& info);
+
+struct SoundFileFormat
+{
+  bool aiff{false};
+  int sampleRate{48000};
+  int channels{1};
+
+  // 16 or 24 for integer samples, or 32 for float.
+  int bitDepth{24};
+
+  // add triangular dither at the level of the LSB when writing integer samples.
+  bool dither{true};
+};
+
+// get whether a file path has an AIFF extension.
+bool isAIFFPath(const TextFragment& filePath);
+
+// writes a sound file a block at a time, so that long files don't need to be in memory.
+class SoundFileWriter
+{
+public:
+  SoundFileWriter() = default;
+  ~SoundFileWriter() { close(); }
+
+  bool open(const TextFragment& filePath, const SoundFileFormat& format);
+  void close();
+
+  // write frames of mono audio to every channel of the file.
+  bool writeMono(const float* pSrc, size_t frames);
+
+  // write frames of audio with one source per channel. Channels without a source are silent.
+  bool writeChannels(const std::vector< const float* >& sources, size_t frames);
+
+private:
+  SNDFILE* _file{nullptr};
+  SoundFileFormat _format;
+  std::vector< float > _interleaved;
+  uint32_t _ditherState{1};
+
+  float getDither();
+};
+
+// write a mono sample to a sound file. Returns true if all of the sample was written.
+bool writeMonoSampleToFile(const TextFragment& filePath, const ml::Sample& src, const SoundFileFormat& format);
+
+}
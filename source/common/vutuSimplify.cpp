@@ -0,0 +1,135 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSimplify.h"
+#include "vutuThreads.h"
+
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+// amplitudes are compared in dB down to this floor, so that errors in very quiet
+// breakpoints don't count.
+constexpr float kMinAmp{1e-4f};
+constexpr float kMinFreq{1.f};
+constexpr float kMinTolerance{1e-6f};
+
+// tolerances converted to the form used by getSegmentErrors().
+struct SegmentTolerances
+{
+  float freqRatio;
+  float ampRatio;
+  float bandwidth;
+};
+
+// for each breakpoint strictly between i1 and i2, get the error of the linear interpolation
+// between i1 and i2, as a multiple of the tolerances. This is written without branches so
+// that the compiler can vectorize it.
+void getSegmentErrors(const VutuPartial& p, size_t i1, size_t i2, const SegmentTolerances& tol, float* errors)
+{
+  const float t1 = p.time[i1];
+  const float invDt = 1.f/std::max(p.time[i2] - t1, 1e-9f);
+  const float f1 = p.freq[i1], df = p.freq[i2] - f1;
+  const float a1 = p.amp[i1], da = p.amp[i2] - a1;
+  const float b1 = p.bandwidth[i1], db = p.bandwidth[i2] - b1;
+
+  const float* pTime = p.time.data();
+  const float* pFreq = p.freq.data();
+  const float* pAmp = p.amp.data();
+  const float* pBw = p.bandwidth.data();
+
+  for(size_t j=i1 + 1; j<i2; ++j)
+  {
+    float x = (pTime[j] - t1)*invDt;
+
+    float fInterp = std::max(f1 + x*df, kMinFreq);
+    float fRatio = fInterp/std::max(pFreq[j], kMinFreq);
+    float fError = (std::max(fRatio, 1.f/fRatio) - 1.f)/tol.freqRatio;
+
+    float aInterp = std::max(a1 + x*da, kMinAmp);
+    float aRatio = aInterp/std::max(pAmp[j], kMinAmp);
+    float aError = (std::max(aRatio, 1.f/aRatio) - 1.f)/tol.ampRatio;
+
+    float bError = std::fabs(b1 + x*db - pBw[j])/tol.bandwidth;
+
+    errors[j] = std::max(fError, std::max(aError, bError));
+  }
+}
+
+}
+
+size_t ml::simplifyPartial(VutuPartial& partial, const SimplifyTolerances& tol)
+{
+  size_t n = partial.time.size();
+  if(n <= 2) return 0;
+
+  SegmentTolerances segTol;
+  segTol.freqRatio = std::max(powf(2.f, tol.cents/1200.f) - 1.f, kMinTolerance);
+  segTol.ampRatio = std::max(powf(10.f, tol.dB/20.f) - 1.f, kMinTolerance);
+  segTol.bandwidth = std::max(tol.bandwidth, kMinTolerance);
+
+  std::vector< float > errors(n);
+  std::vector< bool > keep(n, false);
+  keep[0] = keep[n - 1] = true;
+
+  // segments still to check, as pairs of kept indices
+  std::vector< std::pair< size_t, size_t > > segments;
+  segments.push_back({0, n - 1});
+  while(!segments.empty())
+  {
+    auto seg = segments.back();
+    segments.pop_back();
+    size_t i1 = seg.first;
+    size_t i2 = seg.second;
+    if(i2 - i1 < 2) continue;
+
+    getSegmentErrors(partial, i1, i2, segTol, errors.data());
+    auto maxIt = std::max_element(errors.begin() + i1 + 1, errors.begin() + i2);
+    if(*maxIt > 1.f)
+    {
+      size_t iMax = maxIt - errors.begin();
+      keep[iMax] = true;
+      segments.push_back({i1, iMax});
+      segments.push_back({iMax, i2});
+    }
+  }
+
+  // compact the kept breakpoints in place
+  size_t nKept{0};
+  for(size_t i=0; i<n; ++i)
+  {
+    if(keep[i])
+    {
+      partial.time[nKept] = partial.time[i];
+      partial.amp[nKept] = partial.amp[i];
+      partial.freq[nKept] = partial.freq[i];
+      partial.bandwidth[nKept] = partial.bandwidth[i];
+      partial.phase[nKept] = partial.phase[i];
+      nKept++;
+    }
+  }
+  for(auto* v : {&partial.time, &partial.amp, &partial.freq, &partial.bandwidth, &partial.phase})
+  {
+    v->resize(nKept);
+    v->shrink_to_fit();
+  }
+  return n - nKept;
+}
+
+size_t ml::simplifyPartials(VutuPartialsData& partialsData, const SimplifyTolerances& tol, size_t maxThreads)
+{
+  auto& partials = partialsData.partials;
+  std::vector< size_t > removed(partials.size());
+  parallelFor(partials.size(), [&](size_t i){ removed[i] = simplifyPartial(partials[i], tol); }, maxThreads);
+
+  size_t totalRemoved{0};
+  for(auto r : removed)
+  {
+    totalRemoved += r;
+  }
+  return totalRemoved;
+}
@@ -0,0 +1,31 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "vutuPartials.h"
+
+// simplification of partials by removing breakpoints that can be recovered by linear
+// interpolation within given tolerances.
+
+namespace ml
+{
+
+struct SimplifyTolerances
+{
+  float cents{5};
+  float dB{0.5f};
+  float bandwidth{0.05f};
+};
+
+// simplify one partial using the Douglas-Peucker method: keep the endpoints, then recursively
+// keep the breakpoint with the greatest error until the linear reconstruction between kept
+// breakpoints is within the tolerances everywhere. Returns the number of breakpoints removed.
+size_t simplifyPartial(VutuPartial& partial, const SimplifyTolerances& tol);
+
+// simplify all the partials, in parallel. Stats must be recalculated afterwards.
+// Returns the number of breakpoints removed.
+size_t simplifyPartials(VutuPartialsData& partialsData, const SimplifyTolerances& tol, size_t maxThreads = 0);
+
+}
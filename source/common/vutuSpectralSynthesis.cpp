@@ -0,0 +1,316 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSpectralSynthesis.h"
+#include "vutuFFT.h"
+#include "vutuThreads.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr double kTwoPi{6.283185307179586};
+
+// frames of kFrameSize are made every kHopSize samples. Only the middle 2*kHopSize samples
+// of each frame are used.
+constexpr size_t kFrameSize{1024};
+constexpr size_t kHopSize{kSpectralHopSize};
+
+// the spectrum of the 4-term Blackman-Harris window is tabulated over its main lobe, which
+// is kKernelHalfWidth bins on each side. The sidelobes are more than 90 dB down.
+constexpr int kKernelHalfWidth{4};
+constexpr int kKernelOversample{64};
+constexpr double kBlackmanHarris[4]{0.35875, 0.48829, 0.14128, 0.01168};
+
+// bandwidth noise is spread over this distance in Hz on each side of the partial, matching
+// the oscillator bank's noise.
+constexpr float kNoiseHalfBandwidth{BandwidthNoise::kCutoff};
+
+struct SpectralKernel
+{
+  // the window's transform at offsets from -kKernelHalfWidth to kKernelHalfWidth bins.
+  std::vector< float > lobe;
+
+  // gains applied to the middle of each frame. The sinusoids are divided by the window and
+  // multiplied by a triangle, so that frames crossfade linearly. The noise is multiplied by
+  // a sine window, so that the power of independent frames sums to a constant.
+  std::vector< float > sineGain;
+  std::vector< float > noiseGain;
+};
+
+const SpectralKernel& getSpectralKernel()
+{
+  static const SpectralKernel kernel = []()
+  {
+    const int N = kFrameSize;
+    const int H = kHopSize;
+    SpectralKernel k;
+
+    // zero-phase window, centered on sample 0.
+    auto window = [&](int j)
+    {
+      double x = kTwoPi*j/N;
+      return kBlackmanHarris[0] + kBlackmanHarris[1]*std::cos(x) + kBlackmanHarris[2]*std::cos(2.*x) + kBlackmanHarris[3]*std::cos(3.*x);
+    };
+
+    // the window is symmetric, so its transform is real.
+    k.lobe.resize(2*kKernelHalfWidth*kKernelOversample + 2);
+    for(size_t i=0; i<k.lobe.size(); ++i)
+    {
+      double bin = double(i)/kKernelOversample - kKernelHalfWidth;
+      double sum{0.};
+      for(int j=-N/2; j<N/2; ++j)
+      {
+        sum += window(j)*std::cos(kTwoPi*bin*j/N);
+      }
+      k.lobe[i] = float(sum);
+    }
+
+    k.sineGain.resize(2*H);
+    k.noiseGain.resize(2*H);
+    for(int j=-H; j<H; ++j)
+    {
+      k.sineGain[j + H] = float((1. - std::abs(j)/double(H))/window(j));
+      k.noiseGain[j + H] = float(std::cos(kTwoPi*j/(4.*H)));
+    }
+    return k;
+  }();
+  return kernel;
+}
+
+inline float getLobeValue(const SpectralKernel& k, float bin)
+{
+  float x = (bin + kKernelHalfWidth)*kKernelOversample;
+  int i = int(x);
+  float frac = x - i;
+  return lerp(k.lobe[i], k.lobe[i + 1], frac);
+}
+
+// add a sinusoid with the given peak amplitude and phase at the frame center to the spectrum,
+// at a position in bins. The image at the negative frequency is added too, so the sinusoid
+// comes out in the real part of the inverse transform.
+void addSinusoid(const SpectralKernel& k, float* re, float* im, float bin, float amp, double phase)
+{
+  constexpr size_t mask = kFrameSize - 1;
+  float c = 0.5f*amp*float(std::cos(kTwoPi*phase));
+  float s = 0.5f*amp*float(std::sin(kTwoPi*phase));
+  int b0 = int(std::ceil(bin - kKernelHalfWidth));
+  int b1 = int(std::floor(bin + kKernelHalfWidth));
+  for(int b=b0; b<=b1; ++b)
+  {
+    float w = getLobeValue(k, b - bin);
+    size_t pos = size_t(b) & mask;
+    size_t neg = size_t(-b) & mask;
+    re[pos] += c*w;
+    im[pos] += s*w;
+    re[neg] += c*w;
+    im[neg] -= s*w;
+  }
+}
+
+// add a band of random-phase noise with the given power, centered on a position in bins.
+// The noise is multiplied by i, with its image, so that it comes out in the imaginary part
+// of the inverse transform. The phases come from the noise stream for the seed, at a counter
+// given by the frame and bin.
+void addNoise(float* re, float* im, float bin, float halfWidth, float power, uint32_t seed, size_t frame)
+{
+  constexpr size_t mask = kFrameSize - 1;
+  int b0 = std::max(int(std::ceil(bin - halfWidth)), 1);
+  int b1 = std::min(int(std::floor(bin + halfWidth)), int(kFrameSize/2) - 1);
+  if(b1 < b0) return;
+
+  // each bin and its image make a cosine of amplitude 2g/N and power 2g^2/N^2.
+  float g = 0.5f*kFrameSize*std::sqrt(power*2.f/(b1 - b0 + 1));
+  for(int b=b0; b<=b1; ++b)
+  {
+    uint32_t r = getNoiseHash(seed, uint32_t(frame*kFrameSize/2 + b));
+    double theta = kTwoPi*(r >> 8)*(1./16777216.);
+    float c = g*float(std::cos(theta));
+    float s = g*float(std::sin(theta));
+    size_t pos = size_t(b) & mask;
+    size_t neg = size_t(-b) & mask;
+    re[pos] -= s;
+    im[pos] += c;
+    re[neg] += s;
+    im[neg] += c;
+  }
+}
+
+struct ActivePartial
+{
+  size_t index{0};
+  size_t segment{0};
+  double phase{0}; // in cycles
+  double time{0};
+};
+
+}
+
+void ml::synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads)
+{
+  synthesizePartialsSpectral(partialsData, params, 0, out, maxThreads);
+}
+
+void ml::synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t startVector, std::vector< float >& out, size_t maxThreads)
+{
+  synthesizePartialsSpectral(partialsData, params, PartialsPipeline(), startVector, out, maxThreads);
+}
+
+void ml::synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads)
+{
+  const size_t nSamples = out.size();
+  const size_t nPartials = partialsData.partials.size();
+  if(!nSamples || !nPartials) return;
+
+  const SpectralKernel& kernel = getSpectralKernel();
+  const FFT fft(kFrameSize);
+  const double sr = params.sampleRate;
+  const float binsPerHz = kFrameSize/params.sampleRate;
+  const float nyquist = params.sampleRate*0.5f;
+  const int H = kHopSize;
+
+  // frames are made at times in the output. Each partial is read at its own time, which is
+  // the output time divided by the time scale, and its phase advances by the frequency
+  // ratio times the time scale as many cycles as the data say.
+  const double timeScale = pipeline.getTimeScale();
+  const float freqRatio = pipeline.getFreqRatio();
+  const float gain = pipeline.getGain();
+  const float phaseRatio = float(freqRatio*timeScale);
+  const float partialFadeTime = float(params.fadeTime/timeScale);
+  const float partialSampleRate = float(sr*timeScale);
+
+  // frame k is centered on sample k*kHopSize and covers the samples within kHopSize of it.
+  // out holds the samples [startSample, endSample) of the output.
+  const size_t startSample = startVector*kFloatsPerDSPVector;
+  const size_t endSample = startSample + nSamples;
+  const size_t firstFrame = startSample/kHopSize;
+  const size_t lastFrame = (endSample + kHopSize - 1)/kHopSize;
+  const size_t nFrames = lastFrame + 1 - firstFrame;
+
+  // the extents are in output time. Partials the pipeline drops get empty extents.
+  std::vector< uint8_t > kept;
+  if(pipeline.hasFilters())
+  {
+    kept = pipeline.getKeptPartials(partialsData, maxThreads);
+  }
+  std::vector< Interval > extents(nPartials);
+  std::vector< uint32_t > seeds(nPartials);
+  std::vector< size_t > startOrder(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    const VutuPartial& p = partialsData.partials[i];
+    bool sounds = p.time.size() && (kept.empty() || kept[i]);
+    extents[i] = sounds ? Interval{float(p.time.front()*timeScale) - params.fadeTime, float(p.time.back()*timeScale) + params.fadeTime} : Interval{1.f, 0.f};
+    seeds[i] = getPartialNoiseSeed(p);
+    startOrder[i] = i;
+  }
+  std::sort(startOrder.begin(), startOrder.end(), [&](size_t a, size_t b)
+  {
+    return extents[a].mX1 < extents[b].mX1;
+  });
+
+  // each chunk writes the samples from the center of its first frame to the center of the
+  // next chunk's first frame. The frame at that center is made by both chunks, and each
+  // uses the half on its own side.
+  const size_t nChunks = std::max(std::min(getWorkerThreadCount(maxThreads), nFrames/4), size_t(1));
+  parallelFor(nChunks, [&](size_t c)
+  {
+    size_t frame0 = firstFrame + c*nFrames/nChunks;
+    size_t frame1 = firstFrame + (c + 1)*nFrames/nChunks;
+    size_t sample0 = std::max(frame0*kHopSize, startSample);
+    size_t sample1 = std::min(frame1*kHopSize, endSample);
+
+    std::vector< float > re(kFrameSize), im(kFrameSize);
+    std::vector< ActivePartial > active;
+    active.reserve(partialsData.stats.maxActivePartials + 1);
+    size_t nextToStart{0};
+
+    for(size_t k=frame0; k<=std::min(frame1, lastFrame); ++k)
+    {
+      double t = double(k*kHopSize)/sr;
+      double partialTime = t/timeScale;
+
+      // update the active partials, in order of start time.
+      active.erase(std::remove_if(active.begin(), active.end(), [&](const ActivePartial& a)
+      {
+        return extents[a.index].mX2 < t;
+      }), active.end());
+      for(; (nextToStart < nPartials) && (extents[startOrder[nextToStart]].mX1 <= t); ++nextToStart)
+      {
+        size_t i = startOrder[nextToStart];
+        if(extents[i].mX2 < t) continue;
+        const VutuPartial& p = partialsData.partials[i];
+        active.push_back(ActivePartial{i, seekPartialSegment(p, 0, partialTime), getPartialPhase(p, partialTime, partialSampleRate, phaseRatio), partialTime});
+      }
+
+      std::fill(re.begin(), re.end(), 0.f);
+      std::fill(im.begin(), im.end(), 0.f);
+      bool anyNoise{false};
+      for(auto& a : active)
+      {
+        const VutuPartial& p = partialsData.partials[a.index];
+        if(partialTime > a.time)
+        {
+          // as in the oscillator bank, the phase is reset after a breakpoint with zero
+          // amplitude, so that it doesn't depend on when the partial was started.
+          bool reset{false};
+          for(size_t k=a.segment; (k + 1 < p.time.size()) && (p.time[k] <= partialTime); ++k)
+          {
+            if((p.time[k] > a.time) && (p.amp[k] == 0.f))
+            {
+              reset = true;
+              break;
+            }
+          }
+          if(reset)
+          {
+            a.phase = getPartialPhase(p, partialTime, partialSampleRate, phaseRatio);
+          }
+          else
+          {
+            a.phase += integratePartialFreq(p, a.segment, a.time, partialTime)*phaseRatio;
+            a.phase -= std::floor(a.phase);
+          }
+          a.time = partialTime;
+        }
+        a.segment = seekPartialSegment(p, a.segment, partialTime);
+        PartialEnvelope e = getPartialEnvelope(p, a.segment, partialTime, partialFadeTime);
+        e.amp *= gain;
+        e.freq *= freqRatio;
+        if((e.amp <= 0.f) || (e.freq >= nyquist)) continue;
+
+        float bw = clamp(e.bandwidth, 0.f, 1.f);
+        float bin = e.freq*binsPerHz;
+        addSinusoid(kernel, re.data(), im.data(), bin, e.amp*std::sqrt(1.f - bw), a.phase);
+        if(bw > 0.f)
+        {
+          addNoise(re.data(), im.data(), bin, kNoiseHalfBandwidth*binsPerHz, 0.5f*e.amp*e.amp*bw, seeds[a.index], k);
+          anyNoise = true;
+        }
+      }
+      if(active.empty()) continue;
+
+      fft.inverse(re.data(), im.data());
+
+      // overlap-add the middle of the frame into this chunk's samples.
+      constexpr size_t mask = kFrameSize - 1;
+      for(int j=-H; j<H; ++j)
+      {
+        int64_t n = int64_t(k*kHopSize) + j;
+        if((n < int64_t(sample0)) || (n >= int64_t(sample1))) continue;
+        size_t pos = size_t(j) & mask;
+        float y = re[pos]*kernel.sineGain[j + H];
+        if(anyNoise)
+        {
+          y += im[pos]*kernel.noiseGain[j + H];
+        }
+        out[n - startSample] += y;
+      }
+    }
+  }, nChunks);
+}
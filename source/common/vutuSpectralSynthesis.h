@@ -0,0 +1,39 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "vutuSynthesizer.h"
+
+// synthesis of partials by inverse FFT and overlap-add (FFT-1, Rodet and Depalle). Each
+// frame, every active partial adds the spectrum of a windowed sinusoid at its current
+// amplitude, frequency and phase, plus a band of random-phase noise for its bandwidth. One
+// inverse FFT per frame makes the sinusoids in the real part and the noise in the imaginary
+// part, which are windowed and overlap-added into the output. Amplitude is interpolated
+// linearly between frames, and frequency is held constant over each frame, so fast glides
+// are less exact than with the oscillator bank.
+
+namespace ml
+{
+
+// frames are made every kSpectralHopSize samples, and each one reaches this far on either
+// side of its center.
+constexpr size_t kSpectralHopSize{256};
+
+// render the partials with the spectral engine and add them to out, starting at time 0. The
+// size of out must be a multiple of kFloatsPerDSPVector. The frames are divided into one
+// contiguous chunk per thread. If maxThreads is 0, all hardware threads are used.
+void synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads = 0);
+
+// render the partials with the spectral engine as above, with out starting at DSPVector
+// startVector of the output. The frames are at fixed times, so an output rendered in
+// consecutive blocks matches one rendered at once, to within rounding.
+void synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t startVector, std::vector< float >& out, size_t maxThreads = 0);
+
+// render the partials with the spectral engine as above, played through the pipeline without
+// copying them. Partials the pipeline drops are skipped, and the transforms are applied to
+// each partial as its frames are made.
+void synthesizePartialsSpectral(const VutuPartialsData& partialsData, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads = 0);
+
+}
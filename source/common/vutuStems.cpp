@@ -0,0 +1,141 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuStems.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuThreads.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+// the mean frequency of each partial, from the summaries in the stats, or from new ones if
+// the stats don't have them.
+std::vector< float > getMeanFreqs(const VutuPartialsData& partialsData)
+{
+  if(hasPartialSummaries(partialsData)) return partialsData.stats.summaries.meanFreq;
+
+  const size_t nPartials = partialsData.partials.size();
+  PartialSummaries made;
+  made.resize(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    const VutuPartial& partial = partialsData.partials[i];
+    summarizePartial(partial, getPartialExtent(partial), made, i);
+  }
+  return made.meanFreq;
+}
+
+}
+
+StemLayout ml::makeHarmonicStems(const VutuPartialsData& partialsData, float fundamental, float toleranceCents)
+{
+  enum { kHarmonic, kInharmonic, kNoise };
+
+  StemLayout layout;
+  layout.names = {"harmonic", "inharmonic", "noise"};
+  size_t nPartials = partialsData.partials.size();
+  layout.sineStem.resize(nPartials);
+  layout.noiseStem.assign(nPartials, kNoise);
+  std::vector< float > meanFreq = getMeanFreqs(partialsData);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    bool harmonic = isNearHarmonic(meanFreq[i], fundamental, toleranceCents);
+    layout.sineStem[i] = harmonic ? kHarmonic : kInharmonic;
+  }
+  return layout;
+}
+
+StemLayout ml::makeBandStems(const VutuPartialsData& partialsData, const std::vector< float >& splits)
+{
+  std::vector< float > edges(splits);
+  std::sort(edges.begin(), edges.end());
+
+  StemLayout layout;
+  for(size_t b=0; b<=edges.size(); ++b)
+  {
+    std::string lo = (b > 0) ? std::to_string(int(edges[b - 1])) : "0";
+    std::string hi = (b < edges.size()) ? std::to_string(int(edges[b])) : "nyquist";
+    layout.names.push_back(lo + "-" + hi);
+  }
+
+  size_t nPartials = partialsData.partials.size();
+  layout.sineStem.resize(nPartials);
+  std::vector< float > meanFreq = getMeanFreqs(partialsData);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    float f = meanFreq[i];
+    layout.sineStem[i] = std::upper_bound(edges.begin(), edges.end(), f) - edges.begin();
+  }
+  layout.noiseStem = layout.sineStem;
+  return layout;
+}
+
+void ml::synthesizeStems(const VutuPartialsData& partialsData, const StemLayout& layout, const SynthesisParams& params,
+                         std::vector< std::vector< float > >& stems, size_t maxThreads)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  if(stems.size() < layout.size() || stems.empty()) return;
+  const size_t nVectors = stems[0].size()/N;
+  const size_t nPartials = partialsData.partials.size();
+  const double timePerSample = 1./params.sampleRate;
+
+  // get the vectors covered by each partial that goes to any stem.
+  std::vector< PartialVectorRange > partialVectors(nPartials);
+  std::vector< uint32_t > seeds(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    if((layout.sineStem[i] == kNoStem) && (layout.noiseStem[i] == kNoStem)) continue;
+    partialVectors[i] = getPartialVectorRange(partialsData.partials[i], params, nVectors);
+    seeds[i] = getPartialNoiseSeed(partialsData.partials[i]);
+  }
+
+  // each thread renders every partial over its own range of vectors. A partial crossing into
+  // a chunk starts there with its own phase at that time, and its noise stream is
+  // counter-based, so it continues across the chunks.
+  const size_t nChunks = std::max(std::min(getWorkerThreadCount(maxThreads), nVectors), size_t(1));
+  parallelForChunks(nVectors, nChunks, [&](size_t, size_t begin, size_t end)
+  {
+    PartialOscillator osc;
+    for(size_t i=0; i<nPartials; ++i)
+    {
+      size_t v0 = std::max(begin, partialVectors[i].begin);
+      size_t v1 = std::min(end, partialVectors[i].end);
+      if(v0 >= v1) continue;
+
+      const VutuPartial& p = partialsData.partials[i];
+      size_t sineStem = layout.sineStem[i];
+      size_t noiseStem = layout.noiseStem[i];
+      float* pSine = (sineStem != kNoStem) ? stems[sineStem].data() : nullptr;
+      float* pNoise = (noiseStem != kNoStem) ? stems[noiseStem].data() : nullptr;
+
+      osc.start(p, double(v0*N)*timePerSample, params, seeds[i]);
+      for(size_t v=v0; v<v1; ++v)
+      {
+        if(pSine == pNoise)
+        {
+          // both parts go to the same stem.
+          float* pVec = pSine + v*N;
+          DSPVector sum;
+          load(sum, pVec);
+          osc.addVector(p, timePerSample, sum);
+          store(sum, pVec);
+        }
+        else
+        {
+          DSPVector sine, noise;
+          if(pSine) load(sine, pSine + v*N);
+          if(pNoise) load(noise, pNoise + v*N);
+          osc.addVector(p, timePerSample, sine, noise);
+          if(pSine) store(sine, pSine + v*N);
+          if(pNoise) store(noise, pNoise + v*N);
+        }
+      }
+    }
+  });
+}
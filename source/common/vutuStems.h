@@ -0,0 +1,50 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <limits>
+#include <string>
+
+#include "vutuSynthesizer.h"
+
+// rendering groups of partials to separate stems in a single pass. Each partial is rendered
+// once, with its sinusoidal part and its bandwidth noise sent to stems of their own, so the
+// interpolation and oscillator work is shared however the partials are grouped.
+
+namespace ml
+{
+
+constexpr size_t kNoStem{std::numeric_limits< size_t >::max()};
+
+// for each partial, the stems that its sinusoidal part and its noise go to, or kNoStem to
+// leave that part out.
+struct StemLayout
+{
+  std::vector< std::string > names;
+  std::vector< size_t > sineStem;
+  std::vector< size_t > noiseStem;
+
+  size_t size() const { return names.size(); }
+};
+
+// The layouts read the mean frequency of each partial from the summaries in the stats, and
+// summarize the partials themselves if the stats don't have them.
+
+// three stems: the sinusoidal parts of partials within toleranceCents of a harmonic of the
+// fundamental, the sinusoidal parts of the other partials, and the noise of all partials.
+StemLayout makeHarmonicStems(const VutuPartialsData& partialsData, float fundamental, float toleranceCents = 30.f);
+
+// one stem per frequency band, split at the given frequencies in Hz, with each whole
+// partial assigned by its mean frequency.
+StemLayout makeBandStems(const VutuPartialsData& partialsData, const std::vector< float >& splits);
+
+// render the stems, starting at time 0, into stems, which must have one buffer for each stem
+// in the layout, all the same size, a multiple of kFloatsPerDSPVector. The output is added
+// to the buffers. The time is divided into one contiguous chunk per thread, so each thread
+// writes its own part of every stem. If maxThreads is 0, all hardware threads are used.
+void synthesizeStems(const VutuPartialsData& partialsData, const StemLayout& layout, const SynthesisParams& params,
+                     std::vector< std::vector< float > >& stems, size_t maxThreads = 0);
+
+}
@@ -0,0 +1,154 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSweep.h"
+#include "vutuThreads.h"
+#include "vutuSynthesizer.h"
+#include "vutuResidual.h"
+
+#include <iomanip>
+
+// Loris includes
+#include "PartialList.h"
+
+using namespace ml;
+
+std::vector< AnalysisParams > ml::makeSweepGridPoints(const AnalysisParams& base, const SweepGrid& grid)
+{
+  auto valuesOrBase = [](const std::vector< float >& v, float baseValue)
+  {
+    return v.empty() ? std::vector< float >{baseValue} : v;
+  };
+
+  std::vector< AnalysisParams > points;
+  for(float res : valuesOrBase(grid.resolution, base.resolution))
+  {
+    for(float width : valuesOrBase(grid.windowWidth, base.windowWidth))
+    {
+      for(float drift : valuesOrBase(grid.freqDrift, base.freqDrift))
+      {
+        for(float floor : valuesOrBase(grid.ampFloor, base.ampFloor))
+        {
+          for(float noiseWidth : valuesOrBase(grid.noiseWidth, base.noiseWidth))
+          {
+            AnalysisParams p = base;
+            p.resolution = res;
+            p.windowWidth = width;
+            p.freqDrift = drift;
+            p.ampFloor = floor;
+            p.noiseWidth = noiseWidth;
+            points.push_back(p);
+          }
+        }
+      }
+    }
+  }
+  return points;
+}
+
+std::vector< SweepResult > ml::runAnalysisSweep(const std::vector< double >& input, int sampleRate,
+                                                const std::vector< AnalysisParams >& points, size_t maxThreads)
+{
+  std::vector< SweepResult > results(points.size());
+  std::vector< float > source(input.begin(), input.end());
+
+  auto runPoint = [&](size_t i)
+  {
+    auto startTime = high_resolution_clock::now();
+    SweepResult& r = results[i];
+    r.params = points[i];
+
+    Loris::PartialList lorisPartials = analyzeWithLoris(input, sampleRate, r.params);
+    // the sweep points are already running in parallel, so simplify on this thread only
+    auto vutuPartials = makeVutuPartials(lorisPartials, r.params, 1);
+    r.nPartials = vutuPartials->partials.size();
+
+    // resynthesize the filtered partials at the source rate so the output lines up with the input
+    constexpr size_t N = kFloatsPerDSPVector;
+    SynthesisParams synthParams;
+    synthParams.sampleRate = sampleRate;
+    synthParams.engine = SynthesisEngine::kOscillators;
+    std::vector< float > synthesized(((input.size() + N - 1)/N)*N);
+    synthesizePartials(*vutuPartials, synthParams, synthesized, 1);
+
+    ResidualStats residual = measureResidual(source, synthesized, sampleRate);
+    r.snr = residual.snr;
+    const ResidualBand* pWorst = getWorstResidualBand(residual);
+    r.worstBandSNR = pWorst ? pWorst->snr : 0.f;
+    auto endTime = high_resolution_clock::now();
+    r.seconds = duration_cast<microseconds>(endTime - startTime).count()/1000000.f;
+  };
+
+  parallelFor(points.size(), runPoint, maxThreads);
+  return results;
+}
+
+std::vector< size_t > ml::getParetoFront(const std::vector< SweepResult >& results)
+{
+  // sort by partial count, then by descending SNR
+  std::vector< size_t > order(results.size());
+  for(size_t i=0; i<order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+  {
+    if(results[a].nPartials != results[b].nPartials)
+    {
+      return results[a].nPartials < results[b].nPartials;
+    }
+    return results[a].snr > results[b].snr;
+  });
+
+  // a result is on the front if it beats the SNR of every result with fewer partials
+  std::vector< size_t > front;
+  float bestSNR = -std::numeric_limits< float >::max();
+  for(size_t i : order)
+  {
+    if(results[i].snr > bestSNR)
+    {
+      front.push_back(i);
+      bestSNR = results[i].snr;
+    }
+  }
+  return front;
+}
+
+void ml::printSweepResults(const std::vector< SweepResult >& results, std::ostream& out)
+{
+  auto front = getParetoFront(results);
+
+  // print all results by descending SNR
+  std::vector< size_t > order(results.size());
+  for(size_t i=0; i<order.size(); ++i)
+  {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b){ return results[a].snr > results[b].snr; });
+
+  auto printRow = [&](size_t i)
+  {
+    const auto& r = results[i];
+    bool onFront = std::find(front.begin(), front.end(), i) != front.end();
+    out << (onFront ? " * " : "   ");
+    out << std::setw(10) << r.params.resolution << std::setw(10) << r.params.windowWidth;
+    out << std::setw(10) << r.params.freqDrift << std::setw(10) << r.params.ampFloor;
+    out << std::setw(10) << r.params.noiseWidth << std::setw(10) << r.nPartials;
+    out << std::setw(10) << std::setprecision(4) << r.snr << std::setw(10) << r.worstBandSNR << std::setw(10) << r.seconds << "\n";
+  };
+
+  out << "   " << std::setw(10) << "res" << std::setw(10) << "width" << std::setw(10) << "drift";
+  out << std::setw(10) << "floor" << std::setw(10) << "noise" << std::setw(10) << "partials";
+  out << std::setw(10) << "snr(dB)" << std::setw(10) << "worst(dB)" << std::setw(10) << "secs" << "\n";
+  for(size_t i : order)
+  {
+    printRow(i);
+  }
+
+  out << "\nPareto front (" << front.size() << " of " << results.size() << " points):\n";
+  for(size_t i : front)
+  {
+    printRow(i);
+  }
+}
@@ -0,0 +1,55 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "vutuAnalysis.h"
+
+// analysis parameter sweeps: analyze and resynthesize a source at many points in
+// parameter space, in parallel, and rank the results.
+
+namespace ml
+{
+
+// the values to try for each swept parameter. An empty list means use the base value.
+struct SweepGrid
+{
+  std::vector< float > resolution;
+  std::vector< float > windowWidth;
+  std::vector< float > freqDrift;
+  std::vector< float > ampFloor;
+  std::vector< float > noiseWidth;
+};
+
+struct SweepResult
+{
+  AnalysisParams params;
+  size_t nPartials{0};
+
+  // ratio of source power to residual power after resynthesis, in dB.
+  float snr{0};
+
+  // the lowest SNR of the octave bands holding a significant part of the source, in dB.
+  float worstBandSNR{0};
+
+  // wall-clock time for the analysis and resynthesis.
+  float seconds{0};
+};
+
+// return every combination of the grid values, taking unswept values from base.
+std::vector< AnalysisParams > makeSweepGridPoints(const AnalysisParams& base, const SweepGrid& grid);
+
+// analyze and resynthesize the input once for each point, using up to maxThreads threads
+// (0 = all cores). Results are returned in the same order as the points.
+std::vector< SweepResult > runAnalysisSweep(const std::vector< double >& input, int sampleRate,
+                                            const std::vector< AnalysisParams >& points, size_t maxThreads = 0);
+
+// return the indices of the results on the Pareto front of (fewer partials, higher SNR),
+// in order of increasing partial count.
+std::vector< size_t > getParetoFront(const std::vector< SweepResult >& results);
+
+// print a table of the results, marking those on the Pareto front.
+void printSweepResults(const std::vector< SweepResult >& results, std::ostream& out);
+
+}
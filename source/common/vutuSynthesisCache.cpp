@@ -0,0 +1,197 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSynthesisCache.h"
+#include "vutuThreads.h"
+
+#include <algorithm>
+#include <tuple>
+
+using namespace ml;
+
+void SynthesisCache::clear()
+{
+  _entries.clear();
+  _bytesUsed = 0;
+  _mix.clear();
+  _mixCounts.clear();
+}
+
+void SynthesisCache::addEntryToMix(const Entry& e, float sign)
+{
+  float* pMix = _mix.data() + e.beginVector*kFloatsPerDSPVector;
+  for(size_t i=0; i<e.samples.size(); ++i)
+  {
+    pMix[i] += sign*e.samples[i];
+  }
+}
+
+// remove entries until the cache fits in its budget. Entries not in the mix go first, since
+// evicting a partial in the mix means the mix must be rebuilt if that partial is removed.
+// Otherwise the least recently used entries go first.
+void SynthesisCache::evictEntries()
+{
+  if(_bytesUsed <= _maxBytes) return;
+
+  std::vector< std::tuple< bool, uint64_t, uint64_t > > byAge;
+  byAge.reserve(_entries.size());
+  for(const auto& entry : _entries)
+  {
+    byAge.push_back({_mixCounts.count(entry.first) > 0, entry.second.lastUsed, entry.first});
+  }
+  std::sort(byAge.begin(), byAge.end());
+
+  for(size_t i=0; (i < byAge.size()) && (_bytesUsed > _maxBytes); ++i)
+  {
+    auto it = _entries.find(std::get< 2 >(byAge[i]));
+    _bytesUsed -= it->second.samples.size()*sizeof(float);
+    _entries.erase(it);
+  }
+}
+
+const std::vector< float >& SynthesisCache::synthesize(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t nFrames, size_t maxThreads)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  const size_t nVectors = (nFrames + N - 1)/N;
+  const size_t nPartials = partialsData.partials.size();
+
+  // the cached renders depend on the output length and the synthesis params.
+  bool paramsChanged = (params.sampleRate != _mixParams.sampleRate) || (params.fadeTime != _mixParams.fadeTime);
+  if(paramsChanged || (_mix.size() != nVectors*N))
+  {
+    clear();
+    _mixParams = params;
+    _mix.assign(nVectors*N, 0.f);
+  }
+
+  // count the new partials by hash.
+  std::vector< uint64_t > hashes(nPartials);
+  std::unordered_map< uint64_t, size_t > newCounts;
+  newCounts.reserve(nPartials);
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    hashes[i] = getPartialHash(partialsData.partials[i]);
+    newCounts[hashes[i]]++;
+  }
+
+  // find the partials to remove from the mix. If any of them has been evicted, its
+  // contribution can't be subtracted, so start again from an empty mix.
+  std::vector< std::pair< uint64_t, size_t > > removed;
+  bool rebuild{false};
+  for(const auto& mixCount : _mixCounts)
+  {
+    auto it = newCounts.find(mixCount.first);
+    size_t newCount = (it != newCounts.end()) ? it->second : 0;
+    if(mixCount.second > newCount)
+    {
+      removed.push_back({mixCount.first, mixCount.second - newCount});
+      rebuild |= !_entries.count(mixCount.first);
+    }
+  }
+  if(rebuild)
+  {
+    std::fill(_mix.begin(), _mix.end(), 0.f);
+    _mixCounts.clear();
+    removed.clear();
+  }
+
+  std::sort(removed.begin(), removed.end());
+  size_t nRemoved{0};
+  for(const auto& r : removed)
+  {
+    Entry& e = _entries[r.first];
+    for(size_t j=0; j<r.second; ++j)
+    {
+      addEntryToMix(e, -1.f);
+    }
+    e.lastUsed = ++_useCounter;
+    _mixCounts[r.first] -= r.second;
+    if(!_mixCounts[r.first])
+    {
+      _mixCounts.erase(r.first);
+    }
+    nRemoved += r.second;
+  }
+
+  // add the cached partials that are new to the mix, in partial order, and collect the
+  // ones that need rendering.
+  std::vector< size_t > toRender;
+  std::vector< size_t > renderCounts;
+  std::unordered_map< uint64_t, size_t > toAdd;
+  for(const auto& newCount : newCounts)
+  {
+    auto it = _mixCounts.find(newCount.first);
+    size_t mixCount = (it != _mixCounts.end()) ? it->second : 0;
+    if(newCount.second > mixCount)
+    {
+      toAdd[newCount.first] = newCount.second - mixCount;
+    }
+  }
+  size_t nReused{0};
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    auto it = toAdd.find(hashes[i]);
+    if(it == toAdd.end()) continue;
+
+    auto entryIt = _entries.find(hashes[i]);
+    if(entryIt != _entries.end())
+    {
+      for(size_t j=0; j<it->second; ++j)
+      {
+        addEntryToMix(entryIt->second, 1.f);
+      }
+      entryIt->second.lastUsed = ++_useCounter;
+      nReused += it->second;
+    }
+    else
+    {
+      toRender.push_back(i);
+      renderCounts.push_back(it->second);
+    }
+    _mixCounts[hashes[i]] += it->second;
+    toAdd.erase(it);
+  }
+
+  // render the rest in batches that fit in the cache, add them to the mix and cache them.
+  for(size_t batchStart=0; batchStart < toRender.size(); )
+  {
+    size_t batchEnd = batchStart;
+    size_t batchBytes{0};
+    while(batchEnd < toRender.size())
+    {
+      auto r = getPartialVectorRange(partialsData.partials[toRender[batchEnd]], params, nVectors);
+      size_t bytes = (r.end - r.begin)*N*sizeof(float);
+      if((batchEnd > batchStart) && (batchBytes + bytes > _maxBytes)) break;
+      batchBytes += bytes;
+      batchEnd++;
+    }
+
+    std::vector< Entry > batch(batchEnd - batchStart);
+    parallelFor(batch.size(), [&](size_t j)
+    {
+      const VutuPartial& p = partialsData.partials[toRender[batchStart + j]];
+      auto r = getPartialVectorRange(p, params, nVectors);
+      batch[j].beginVector = r.begin;
+      batch[j].samples.assign((r.end - r.begin)*N, 0.f);
+      renderPartial(p, params, nVectors, batch[j].samples.data(), r.begin);
+    }, maxThreads);
+
+    for(size_t j=0; j<batch.size(); ++j)
+    {
+      uint64_t h = hashes[toRender[batchStart + j]];
+      for(size_t k=0; k<renderCounts[batchStart + j]; ++k)
+      {
+        addEntryToMix(batch[j], 1.f);
+      }
+      batch[j].lastUsed = ++_useCounter;
+      _bytesUsed += batch[j].samples.size()*sizeof(float);
+      _entries[h] = std::move(batch[j]);
+    }
+    evictEntries();
+    batchStart = batchEnd;
+  }
+
+  _lastCounts = Counts{toRender.size(), nReused, nRemoved, rebuild};
+  return _mix;
+}
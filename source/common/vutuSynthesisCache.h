@@ -0,0 +1,65 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <unordered_map>
+
+#include "vutuSynthesizer.h"
+
+// incremental synthesis. The rendered contribution of each partial is cached by a hash of its
+// contents, and when the set of partials changes, the contributions of removed partials are
+// subtracted from the mix and those of new partials added, instead of rendering everything.
+
+namespace ml
+{
+
+class SynthesisCache
+{
+public:
+  static constexpr size_t kDefaultMaxBytes{size_t(256) << 20};
+
+  explicit SynthesisCache(size_t maxBytes = kDefaultMaxBytes) : _maxBytes(maxBytes) {}
+
+  // update the mix to the sum of the partials over nFrames, rendering only the partials that
+  // are not cached, and return it. The size of the mix is a multiple of kFloatsPerDSPVector.
+  const std::vector< float >& synthesize(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t nFrames, size_t maxThreads = 0);
+
+  void clear();
+  size_t getBytesUsed() const { return _bytesUsed; }
+
+  // what the last call to synthesize() did with the partials.
+  struct Counts
+  {
+    size_t rendered{0};
+    size_t reused{0};
+    size_t removed{0};
+    bool rebuilt{false};
+  };
+  const Counts& getLastCounts() const { return _lastCounts; }
+
+private:
+  struct Entry
+  {
+    size_t beginVector{0};
+    std::vector< float > samples;
+    uint64_t lastUsed{0};
+  };
+
+  size_t _maxBytes;
+  size_t _bytesUsed{0};
+  uint64_t _useCounter{0};
+  std::unordered_map< uint64_t, Entry > _entries;
+
+  // the current mix, and how many times each partial hash is in it.
+  std::vector< float > _mix;
+  std::unordered_map< uint64_t, size_t > _mixCounts;
+  SynthesisParams _mixParams;
+  Counts _lastCounts;
+
+  void addEntryToMix(const Entry& e, float sign);
+  void evictEntries();
+};
+
+}
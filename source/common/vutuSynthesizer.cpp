@@ -0,0 +1,586 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuSynthesizer.h"
+#include "vutuSpectralSynthesis.h"
+#include "vutuThreads.h"
+
+#include <cmath>
+
+using namespace ml;
+
+namespace
+{
+
+constexpr float kTwoPi{6.283185307179586f};
+
+// playback rates below this are treated as stopped.
+constexpr double kMinRate{1e-3};
+
+// Loris starts partials at the nearest sample to their first breakpoint, so the phase in the
+// data is reached at that sample.
+inline double getPhaseAnchorTime(const VutuPartial& p, size_t k, float sampleRate)
+{
+  return std::round(double(p.time[k])*sampleRate)/sampleRate;
+}
+
+inline float getFrequencyInSegment(const VutuPartial& p, size_t c, double t)
+{
+  size_t n = p.time.size();
+  if(t < p.time[0]) return p.freq[0];
+  if(c + 1 >= n) return p.freq[n - 1];
+  double dt = p.time[c + 1] - p.time[c];
+  float x = (dt > 0.) ? float((t - p.time[c])/dt) : 0.f;
+  return lerp(p.freq[c], p.freq[c + 1], x);
+}
+
+}
+
+size_t ml::seekPartialSegment(const VutuPartial& p, size_t c, double t)
+{
+  size_t n = p.time.size();
+  if(!n) return 0;
+  c = std::min(c, n - 1);
+  while((c + 1 < n) && (p.time[c + 1] <= t))
+  {
+    c++;
+  }
+  while((c > 0) && (p.time[c] > t))
+  {
+    c--;
+  }
+  return c;
+}
+
+PartialEnvelope ml::getPartialEnvelope(const VutuPartial& p, size_t c, double t, float fadeTime)
+{
+  PartialEnvelope e;
+  size_t n = p.time.size();
+  if(!n) return e;
+
+  if(t < p.time[0])
+  {
+    // fade in
+    float x = 1.f - float(p.time[0] - t)/fadeTime;
+    e.amp = p.amp[0]*clamp(x, 0.f, 1.f);
+    e.freq = p.freq[0];
+    e.bandwidth = p.bandwidth[0];
+  }
+  else if(c + 1 >= n)
+  {
+    // fade out
+    float x = 1.f - float(t - p.time[n - 1])/fadeTime;
+    e.amp = p.amp[n - 1]*clamp(x, 0.f, 1.f);
+    e.freq = p.freq[n - 1];
+    e.bandwidth = p.bandwidth[n - 1];
+  }
+  else
+  {
+    double dt = p.time[c + 1] - p.time[c];
+    float x = (dt > 0.) ? float((t - p.time[c])/dt) : 0.f;
+    e.amp = lerp(p.amp[c], p.amp[c + 1], x);
+    e.freq = lerp(p.freq[c], p.freq[c + 1], x);
+    e.bandwidth = lerp(p.bandwidth[c], p.bandwidth[c + 1], x);
+  }
+  return e;
+}
+
+double ml::integratePartialFreq(const VutuPartial& p, size_t c, double t0, double t1)
+{
+  size_t n = p.time.size();
+  if(!n) return 0.;
+  if(t1 < t0) return -integratePartialFreq(p, c, t1, t0);
+
+  // frequency is linear within each segment and constant before and after the partial,
+  // so the trapezoid rule over each piece is exact.
+  double sum{0.};
+  double t = t0;
+  c = seekPartialSegment(p, c, t0);
+  while(t < t1)
+  {
+    double pieceEnd;
+    if(t < p.time[0])
+    {
+      pieceEnd = p.time[0];
+    }
+    else if(c + 1 < n)
+    {
+      pieceEnd = p.time[c + 1];
+    }
+    else
+    {
+      pieceEnd = t1;
+    }
+    double te = std::min(pieceEnd, t1);
+    sum += 0.5*(double(getFrequencyInSegment(p, c, t)) + double(getFrequencyInSegment(p, c, te)))*(te - t);
+
+    if((te >= pieceEnd) && (t >= p.time[0]) && (c + 1 < n))
+    {
+      c++;
+    }
+    t = te;
+  }
+  return sum;
+}
+
+double ml::getPartialPhase(const VutuPartial& p, double t, float sampleRate, float pitchRatio)
+{
+  // the phase at the first breakpoint, or at the first breakpoint after a breakpoint with
+  // zero amplitude, is the phase in the data. Loris resets phases in the same way.
+  size_t n = p.time.size();
+  if(!n) return 0.;
+  size_t anchor{0};
+  for(size_t k=1; k<n; ++k)
+  {
+    if(p.time[k - 1] > t) break;
+    if(p.amp[k - 1] == 0.f)
+    {
+      anchor = k;
+    }
+  }
+  double phase = p.phase[anchor]/kTwoPi + integratePartialFreq(p, 0, getPhaseAnchorTime(p, anchor, sampleRate), t)*pitchRatio;
+  return phase - std::floor(phase);
+}
+
+void PartialOscillator::start(const VutuPartial& p, double time, const SynthesisParams& params, uint32_t noiseSeed)
+{
+  _sampleRate = params.sampleRate;
+  _fadeTime = params.fadeTime;
+  _time = time;
+  _segment = seekPartialSegment(p, 0, time);
+  _phase = getPartialPhase(p, time, _sampleRate*_timeScale, _pitchRatio*_timeScale);
+  _noise.start(noiseSeed, time*_timeScale, _sampleRate);
+}
+
+void PartialOscillator::setTime(const VutuPartial& p, double time)
+{
+  _time = time;
+  _segment = seekPartialSegment(p, _segment, time);
+}
+
+// multiply amp by the bandwidth-enhanced modulation.
+void PartialOscillator::addNoiseModulation(DSPVector& amp, float bw0, float bw1)
+{
+  amp = amp*getBandwidthModulation(_noise, bw0, bw1);
+}
+
+bool PartialOscillator::nextVector(const VutuPartial& p, double timePerSample, DSPVector& amp, DSPVector& carrier, float& bw0, float& bw1)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  size_t n = p.time.size();
+  if(!n) return false;
+
+  double t0 = _time;
+  double t1 = t0 + timePerSample*N;
+  size_t c0 = _segment;
+  size_t c1 = seekPartialSegment(p, c0, t1);
+  PartialEnvelope e0 = getPartialEnvelope(p, c0, t0, _fadeTime);
+  PartialEnvelope e1 = getPartialEnvelope(p, c1, t1, _fadeTime);
+
+  // get the phase at the end of the vector in cycles. The phase advances by the frequency
+  // divided by the sample rate each sample no matter how fast we move through the partial.
+  double rate = timePerSample*_sampleRate;
+  double f0 = e0.freq*_pitchRatio/_sampleRate;
+  double f1 = e1.freq*_pitchRatio/_sampleRate;
+  double p1;
+  if(std::fabs(rate) > kMinRate)
+  {
+    p1 = _phase + integratePartialFreq(p, c0, t0, t1)*_pitchRatio/rate;
+
+    // moving forward past a breakpoint with zero amplitude, reset the phase to reach the
+    // phase of the next breakpoint.
+    if(t1 > t0)
+    {
+      for(size_t k=c1 + 1; k-- > c0; )
+      {
+        if((p.time[k] > t0) && (p.time[k] <= t1) && (p.amp[k] == 0.f) && (k + 1 < n))
+        {
+          p1 = p.phase[k + 1]/kTwoPi - integratePartialFreq(p, k, t1, getPhaseAnchorTime(p, k + 1, _sampleRate*_timeScale))*_pitchRatio/rate;
+          break;
+        }
+      }
+    }
+  }
+  else
+  {
+    p1 = _phase + 0.5*(f0 + f1)*N;
+  }
+
+  // phase over the vector: a quadratic from the linear frequency ramp, plus a linear
+  // correction so that it ends exactly at p1.
+  double quadratic = (f1 - f0)/(2.*N);
+  double correction = (p1 - (_phase + f0*N + quadratic*N*N))/N;
+  DSPVector idx = columnIndex();
+  DSPVector phase = DSPVector(float(_phase)) + idx*(DSPVector(float(f0 + correction)) + idx*DSPVector(float(quadratic)));
+  carrier = cos(fractionalPart(phase)*DSPVector(kTwoPi));
+
+  bool inFades = (std::min(t0, t1) < p.time[0]) || (std::max(t0, t1) > p.time[n - 1]);
+  if(inFades)
+  {
+    // the fades are short compared to a vector, so follow them exactly
+    float* pAmp = amp.getBuffer();
+    size_t c = c0;
+    for(size_t i=0; i<N; ++i)
+    {
+      double t = t0 + timePerSample*i;
+      c = seekPartialSegment(p, c, t);
+      pAmp[i] = getPartialEnvelope(p, c, t, _fadeTime).amp;
+    }
+  }
+  else
+  {
+    amp = DSPVector(e0.amp) + idx*DSPVector((e1.amp - e0.amp)/N);
+  }
+
+  // silence frequencies above Nyquist, as Loris does
+  float nyquist = _sampleRate*0.5f;
+  float g0 = (e0.freq*_pitchRatio < nyquist) ? 1.f : 0.f;
+  float g1 = (e1.freq*_pitchRatio < nyquist) ? 1.f : 0.f;
+  if((g0 < 1.f) || (g1 < 1.f))
+  {
+    amp = amp*(DSPVector(g0) + idx*DSPVector((g1 - g0)/N));
+  }
+
+  bw0 = e0.bandwidth;
+  bw1 = e1.bandwidth;
+
+  _phase = p1 - std::floor(p1);
+  _time = t1;
+  _segment = c1;
+  return true;
+}
+
+void PartialOscillator::addVector(const VutuPartial& p, double timePerSample, DSPVector& out)
+{
+  DSPVector amp, carrier;
+  float bw0, bw1;
+  if(!nextVector(p, timePerSample, amp, carrier, bw0, bw1)) return;
+
+  // the noise moves on whether or not it is used, so it depends only on the time.
+  if((bw0 > 0.f) || (bw1 > 0.f))
+  {
+    addNoiseModulation(amp, bw0, bw1);
+  }
+  else
+  {
+    _noise.skipVector();
+  }
+  out = out + amp*carrier;
+}
+
+void PartialOscillator::addVector(const VutuPartial& p, double timePerSample, DSPVector& sineOut, DSPVector& noiseOut)
+{
+  DSPVector amp, carrier;
+  float bw0, bw1;
+  if(!nextVector(p, timePerSample, amp, carrier, bw0, bw1)) return;
+
+  DSPVector partial = amp*carrier;
+  if((bw0 > 0.f) || (bw1 > 0.f))
+  {
+    DSPVector sineGain, noiseGain;
+    getBandwidthGains(_noise, bw0, bw1, sineGain, noiseGain);
+    sineOut = sineOut + partial*sineGain;
+    noiseOut = noiseOut + partial*noiseGain;
+  }
+  else
+  {
+    _noise.skipVector();
+    sineOut = sineOut + partial;
+  }
+}
+
+uint64_t ml::getPartialHash(const VutuPartial& p)
+{
+  // FNV-1a over the breakpoint data
+  uint64_t h{14695981039346656037ull};
+  auto addBytes = [&](const std::vector< float >& v)
+  {
+    const unsigned char* pBytes = reinterpret_cast< const unsigned char* >(v.data());
+    for(size_t i=0; i<v.size()*sizeof(float); ++i)
+    {
+      h = (h ^ pBytes[i])*1099511628211ull;
+    }
+    h = (h ^ v.size())*1099511628211ull;
+  };
+  addBytes(p.time);
+  addBytes(p.freq);
+  addBytes(p.amp);
+  addBytes(p.bandwidth);
+  addBytes(p.phase);
+  return h;
+}
+
+uint32_t ml::getPartialNoiseSeed(const VutuPartial& p)
+{
+  uint64_t h = getPartialHash(p);
+  return uint32_t(h ^ (h >> 32));
+}
+
+PartialVectorRange ml::getPartialVectorRange(const VutuPartial& p, const SynthesisParams& params, size_t nVectors)
+{
+  return getPartialVectorRange(p, params, PartialsPipeline(), nVectors);
+}
+
+PartialVectorRange ml::getPartialVectorRange(const VutuPartial& p, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t nVectors)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  size_t n = p.time.size();
+  if(!n) return PartialVectorRange{};
+
+  const double sr = params.sampleRate;
+  const float timeScale = pipeline.getTimeScale();
+  double startTime = std::max(p.time[0]*timeScale - params.fadeTime, 0.f);
+  double endTime = p.time[n - 1]*timeScale + params.fadeTime;
+  size_t startVector = size_t(startTime*sr)/N;
+  size_t endVector = std::min(size_t(std::ceil(endTime*sr/N)), nVectors);
+  return (startVector < endVector) ? PartialVectorRange{startVector, endVector} : PartialVectorRange{};
+}
+
+void ml::renderPartial(const VutuPartial& p, const SynthesisParams& params, size_t nVectors, float* dest, size_t destVector)
+{
+  renderPartialVectors(p, params, getPartialVectorRange(p, params, nVectors), dest, destVector);
+}
+
+void ml::renderPartialVectors(const VutuPartial& p, const SynthesisParams& params, PartialVectorRange r, float* dest, size_t destVector)
+{
+  renderPartialVectors(p, params, PartialsPipeline(), r, dest, destVector);
+}
+
+void ml::renderPartialVectors(const VutuPartial& p, const SynthesisParams& params, const PartialsPipeline& pipeline, PartialVectorRange r, float* dest, size_t destVector)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  if(r.begin >= r.end) return;
+
+  // the oscillator moves through the partial's own time, in which the fades of the output
+  // are shorter when the partial is stretched.
+  const float timeScale = pipeline.getTimeScale();
+  const float gain = pipeline.getGain();
+  const double timePerSample = 1./(double(params.sampleRate)*timeScale);
+  SynthesisParams partialParams = params;
+  partialParams.fadeTime = params.fadeTime/timeScale;
+
+  PartialOscillator osc;
+  osc.setPitchRatio(pipeline.getFreqRatio());
+  osc.setTimeScale(timeScale);
+  osc.start(p, double(r.begin*N)*timePerSample, partialParams, getPartialNoiseSeed(p));
+  for(size_t v=r.begin; v<r.end; ++v)
+  {
+    float* pVec = dest + (v - destVector)*N;
+    DSPVector sum;
+    load(sum, pVec);
+    if(gain == 1.f)
+    {
+      osc.addVector(p, timePerSample, sum);
+    }
+    else
+    {
+      DSPVector partial(0.f);
+      osc.addVector(p, timePerSample, partial);
+      sum = sum + partial*DSPVector(gain);
+    }
+    store(sum, pVec);
+  }
+}
+
+SynthesisEngine ml::getSynthesisEngine(const VutuPartialsData& partialsData, const SynthesisParams& params)
+{
+  if(params.engine != SynthesisEngine::kAuto) return params.engine;
+  return (partialsData.stats.maxActivePartials > kSpectralSynthesisMinActivePartials) ? SynthesisEngine::kSpectral : SynthesisEngine::kOscillators;
+}
+
+const char* ml::getSynthesisEngineName(SynthesisEngine e)
+{
+  switch(e)
+  {
+    case SynthesisEngine::kAuto:
+      return "auto";
+    case SynthesisEngine::kOscillators:
+      return "oscillators";
+    case SynthesisEngine::kSpectral:
+    default:
+      return "spectral";
+  }
+}
+
+void ml::synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads)
+{
+  synthesizePartials(partialsData, params, 0, out, maxThreads);
+}
+
+void ml::synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t startVector, std::vector< float >& out, size_t maxThreads)
+{
+  synthesizePartials(partialsData, params, PartialsPipeline(), startVector, out, maxThreads);
+}
+
+void ml::synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads)
+{
+  if(getSynthesisEngine(partialsData, params) == SynthesisEngine::kSpectral)
+  {
+    synthesizePartialsSpectral(partialsData, params, pipeline, startVector, out, maxThreads);
+    return;
+  }
+
+  constexpr size_t N = kFloatsPerDSPVector;
+  const size_t endVector = startVector + out.size()/N;
+  const size_t nPartials = partialsData.partials.size();
+  const size_t nChunks = std::min(getWorkerThreadCount(maxThreads), nPartials);
+
+  // get the vectors of each partial within the output. Partials the pipeline drops have none.
+  std::vector< uint8_t > kept;
+  if(pipeline.hasFilters())
+  {
+    kept = pipeline.getKeptPartials(partialsData, maxThreads);
+  }
+  std::vector< PartialVectorRange > partialVectors(nPartials);
+  size_t totalVectors{0};
+  for(size_t i=0; i<nPartials; ++i)
+  {
+    if(!kept.empty() && !kept[i]) continue;
+    PartialVectorRange r = getPartialVectorRange(partialsData.partials[i], params, pipeline, endVector);
+    r.begin = std::max(r.begin, startVector);
+    partialVectors[i] = (r.begin < r.end) ? r : PartialVectorRange{};
+    totalVectors += partialVectors[i].end - partialVectors[i].begin;
+  }
+
+  if(nChunks <= 1)
+  {
+    for(size_t i=0; i<nPartials; ++i)
+    {
+      renderPartialVectors(partialsData.partials[i], params, pipeline, partialVectors[i], out.data(), startVector);
+    }
+    return;
+  }
+
+  // divide the partials into contiguous chunks with about the same number of vectors to render.
+  std::vector< size_t > chunkStarts(nChunks + 1, nPartials);
+  chunkStarts[0] = 0;
+  size_t vectorsSoFar{0};
+  for(size_t i=0, c=1; (i<nPartials) && (c<nChunks); ++i)
+  {
+    vectorsSoFar += partialVectors[i].end - partialVectors[i].begin;
+    if(vectorsSoFar*nChunks >= totalVectors*c)
+    {
+      chunkStarts[c++] = i + 1;
+    }
+  }
+
+  // the first chunk renders into out, and the others into accumulators that only span the
+  // vectors their partials cover.
+  std::vector< std::vector< float > > accumulators(nChunks);
+  std::vector< PartialVectorRange > accumulatorVectors(nChunks);
+  auto renderChunk = [&](size_t c)
+  {
+    if(c == 0)
+    {
+      for(size_t i=chunkStarts[0]; i<chunkStarts[1]; ++i)
+      {
+        renderPartialVectors(partialsData.partials[i], params, pipeline, partialVectors[i], out.data(), startVector);
+      }
+      return;
+    }
+
+    PartialVectorRange range{endVector, 0};
+    for(size_t i=chunkStarts[c]; i<chunkStarts[c + 1]; ++i)
+    {
+      if(partialVectors[i].begin >= partialVectors[i].end) continue;
+      range.begin = std::min(range.begin, partialVectors[i].begin);
+      range.end = std::max(range.end, partialVectors[i].end);
+    }
+    if(range.begin >= range.end) return;
+
+    accumulatorVectors[c] = range;
+    accumulators[c].assign((range.end - range.begin)*N, 0.f);
+    for(size_t i=chunkStarts[c]; i<chunkStarts[c + 1]; ++i)
+    {
+      renderPartialVectors(partialsData.partials[i], params, pipeline, partialVectors[i], accumulators[c].data(), range.begin);
+    }
+  };
+  parallelFor(nChunks, renderChunk, nChunks);
+
+  // add the accumulators to out in chunk order. Every sample is summed in the same order
+  // however the merge is divided, so the output depends only on the number of chunks.
+  parallelForChunks(endVector - startVector, nChunks, [&](size_t, size_t begin, size_t end)
+  {
+    begin += startVector;
+    end += startVector;
+    for(size_t c=1; c<nChunks; ++c)
+    {
+      size_t v0 = std::max(begin, accumulatorVectors[c].begin);
+      size_t v1 = std::min(end, accumulatorVectors[c].end);
+      if(v0 >= v1) continue;
+      const float* pAcc = accumulators[c].data() + (v0 - accumulatorVectors[c].begin)*N;
+      float* pOut = out.data() + (v0 - startVector)*N;
+      for(size_t j=0; j<(v1 - v0)*N; ++j)
+      {
+        pOut[j] += pAcc[j];
+      }
+    }
+  });
+}
+
+void ml::synthesizeToSample(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t nFrames, ml::Sample& out, size_t maxThreads)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  std::vector< float > rendered(((nFrames + N - 1)/N)*N);
+  synthesizePartials(partialsData, params, rendered, maxThreads);
+  renderedToSample(rendered, params, nFrames, out);
+}
+
+void ml::renderedToSample(const std::vector< float >& rendered, const SynthesisParams& params, size_t nFrames, ml::Sample& out)
+{
+  constexpr size_t N = kFloatsPerDSPVector;
+  nFrames = std::min(nFrames, rendered.size());
+  resize(out, nFrames, 1);
+  out.sampleRate = params.sampleRate;
+  float* pOut = getFramePtr(out);
+
+  // fade the ends as the output is written, finding the peak of the faded signal in the same
+  // pass, then normalize the output in place. Only vectors in the fades need their gains.
+  size_t fadeFrames = std::min(size_t(params.fadeTime*params.sampleRate), nFrames/2);
+  const DSPVector fadeStep(1.f/float(std::max(fadeFrames, size_t(1))));
+  DSPVector peaks;
+  DSPVector v;
+  for(size_t i=0; i<nFrames; i += N)
+  {
+    const bool whole = (i + N <= nFrames);
+    if(whole)
+    {
+      load(v, rendered.data() + i);
+    }
+    else
+    {
+      v = DSPVector(0.f);
+      std::copy(rendered.data() + i, rendered.data() + nFrames, v.getBuffer());
+    }
+    if(fadeFrames && ((i < fadeFrames) || (i + N > nFrames - fadeFrames)))
+    {
+      DSPVector fromStart = columnIndex() + DSPVector(float(i));
+      DSPVector fromEnd = min(fromStart, DSPVector(float(nFrames - 1)) - fromStart);
+      v = v*max(min(fromEnd*fadeStep, DSPVector(1.f)), DSPVector(0.f));
+    }
+    peaks = max(peaks, abs(v));
+    if(whole)
+    {
+      store(v, pOut + i);
+    }
+    else
+    {
+      std::copy(v.getConstBuffer(), v.getConstBuffer() + (nFrames - i), pOut + i);
+    }
+  }
+
+  float peak = max(peaks);
+  if(peak <= 0.f) return;
+  const DSPVector scale(1.f/peak);
+  size_t nWhole = nFrames/N*N;
+  for(size_t i=0; i<nWhole; i += N)
+  {
+    load(v, pOut + i);
+    store(v*scale, pOut + i);
+  }
+  for(size_t i=nWhole; i<nFrames; ++i)
+  {
+    pOut[i] *= scale[0];
+  }
+}
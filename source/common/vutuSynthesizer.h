@@ -0,0 +1,173 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include "madronalib.h"
+#include "mldsp.h"
+#include "MLDSPSample.h"
+
+#include "vutuPartials.h"
+#include "vutuPartialsPipeline.h"
+#include "vutuNoise.h"
+
+// synthesis of partials with a bank of bandwidth-enhanced oscillators, following the
+// Loris Synthesizer. Amplitude, frequency and bandwidth are evaluated once per DSPVector
+// and interpolated linearly across it, and phase is computed in closed form for each vector
+// from the exact integral of frequency, so it doesn't drift from the Loris phase.
+
+namespace ml
+{
+
+// the oscillator bank renders every partial sample by sample. The spectral engine adds the
+// partials to short-time spectra and resynthesizes them by inverse FFT, so its cost grows
+// with the number of frames rather than the number of partials. kAuto picks the spectral
+// engine for partials with more than kSpectralSynthesisMinActivePartials active at once.
+enum class SynthesisEngine
+{
+  kAuto,
+  kOscillators,
+  kSpectral
+};
+
+constexpr size_t kSpectralSynthesisMinActivePartials{256};
+
+struct SynthesisParams
+{
+  float sampleRate{48000};
+
+  // partials fade in before their first breakpoint and out after their last over this time.
+  float fadeTime{0.001f};
+
+  SynthesisEngine engine{SynthesisEngine::kAuto};
+};
+
+// get the engine that will render the partials with the given params.
+SynthesisEngine getSynthesisEngine(const VutuPartialsData& partialsData, const SynthesisParams& params);
+
+const char* getSynthesisEngineName(SynthesisEngine e);
+
+// amplitude, frequency and bandwidth of a partial at one time.
+struct PartialEnvelope
+{
+  float amp{0};
+  float freq{0};
+  float bandwidth{0};
+};
+
+// find the segment of the partial containing time t, starting the search from segment c.
+// The result c has time[c] <= t < time[c + 1], or is 0 if t is before the first breakpoint,
+// or the last index if t is after the last breakpoint.
+size_t seekPartialSegment(const VutuPartial& p, size_t c, double t);
+
+// get the envelope of the partial at time t in segment c, including the fades before and after.
+PartialEnvelope getPartialEnvelope(const VutuPartial& p, size_t c, double t, float fadeTime);
+
+// get the integral of frequency over [t0, t1], in cycles.
+double integratePartialFreq(const VutuPartial& p, size_t c, double t0, double t1);
+
+// get the phase of the partial at time t in cycles, in [0, 1), with its frequencies multiplied
+// by pitchRatio since the last phase in the data.
+double getPartialPhase(const VutuPartial& p, double t, float sampleRate, float pitchRatio = 1.f);
+
+// renders a single partial, one DSPVector at a time.
+class PartialOscillator
+{
+public:
+  // start at the given time in the partial with the partial's own phase at that time.
+  void start(const VutuPartial& p, double time, const SynthesisParams& params, uint32_t noiseSeed);
+
+  // add one DSPVector of the partial to out, starting at the current time and moving
+  // timePerSample through the partial each sample. The pitch doesn't depend on timePerSample,
+  // so it can be used to stretch or scrub the partial.
+  void addVector(const VutuPartial& p, double timePerSample, DSPVector& out);
+
+  // add one DSPVector of the partial as above, with its sinusoidal part added to sineOut and
+  // its bandwidth noise to noiseOut. Their sum is the output of addVector().
+  void addVector(const VutuPartial& p, double timePerSample, DSPVector& sineOut, DSPVector& noiseOut);
+
+  // move to a new time without resetting the phase.
+  void setTime(const VutuPartial& p, double time);
+
+  double getTime() const { return _time; }
+
+  // multiply the frequency of the partial by ratio. The ratio is kept when restarting.
+  void setPitchRatio(float ratio) { _pitchRatio = ratio; }
+
+  // play the partial timeScale times slower than its own time, as a time-scaling pipeline
+  // does. The phase and noise found when starting then match those of a partial rendered
+  // from its beginning. The scale is kept when restarting.
+  void setTimeScale(float scale) { _timeScale = scale; }
+
+private:
+  double _time{0};
+  double _phase{0}; // in cycles
+  size_t _segment{0};
+  float _sampleRate{48000};
+  float _fadeTime{0.001f};
+  float _pitchRatio{1};
+  float _timeScale{1};
+
+  BandwidthNoise _noise;
+
+  void addNoiseModulation(DSPVector& amp, float bw0, float bw1);
+
+  // get the amplitude and carrier for the next DSPVector and the bandwidth at its ends, and
+  // move to the end of the vector. Returns false if the partial is empty.
+  bool nextVector(const VutuPartial& p, double timePerSample, DSPVector& amp, DSPVector& carrier, float& bw0, float& bw1);
+};
+
+// get a hash of the partial's breakpoint data.
+uint64_t getPartialHash(const VutuPartial& p);
+
+// the bandwidth noise of each partial is seeded from its contents, so a partial sounds the
+// same whatever other partials are rendered with it.
+uint32_t getPartialNoiseSeed(const VutuPartial& p);
+
+// the range of DSPVectors [begin, end) covering a partial and its fades, in an output of nVectors.
+struct PartialVectorRange
+{
+  size_t begin{0};
+  size_t end{0};
+};
+PartialVectorRange getPartialVectorRange(const VutuPartial& p, const SynthesisParams& params, size_t nVectors);
+
+// get the range of DSPVectors as above for the partial played through the pipeline.
+PartialVectorRange getPartialVectorRange(const VutuPartial& p, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t nVectors);
+
+// render one partial and add it to dest, which holds the output's DSPVectors starting at destVector.
+void renderPartial(const VutuPartial& p, const SynthesisParams& params, size_t nVectors, float* dest, size_t destVector);
+
+// render the DSPVectors of one partial in the range r and add them to dest as above.
+void renderPartialVectors(const VutuPartial& p, const SynthesisParams& params, PartialVectorRange r, float* dest, size_t destVector);
+
+// render the DSPVectors of one partial as above, with the transforms of the pipeline applied
+// as it is rendered. The partial itself is not changed.
+void renderPartialVectors(const VutuPartial& p, const SynthesisParams& params, const PartialsPipeline& pipeline, PartialVectorRange r, float* dest, size_t destVector);
+
+// render the partials and add them to out, starting at time 0, with the engine chosen by
+// getSynthesisEngine(). The size of out must be a multiple of kFloatsPerDSPVector. The work
+// is divided into one contiguous chunk per thread, and the chunks are summed in order, so
+// the output is the same from run to run for a given number of threads. If maxThreads is 0,
+// all hardware threads are used.
+void synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, std::vector< float >& out, size_t maxThreads = 0);
+
+// render the partials as above, with out starting at DSPVector startVector of the output.
+// Rendering an output in consecutive blocks gives the same result as rendering it at once,
+// to within rounding, so long outputs can be made without holding them in memory.
+void synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t startVector, std::vector< float >& out, size_t maxThreads = 0);
+
+// render the partials in blocks as above, played through the pipeline without copying them,
+// as PartialsPlayer does. The filters are tested on the fly, so the stats must be up to date,
+// and the transforms are applied to each partial as it is rendered. The engine is chosen from
+// the stats of all the partials.
+void synthesizePartials(const VutuPartialsData& partialsData, const SynthesisParams& params, const PartialsPipeline& pipeline, size_t startVector, std::vector< float >& out, size_t maxThreads = 0);
+
+// render nFrames of the partials into a mono sample, fading the ends and normalizing.
+void synthesizeToSample(const VutuPartialsData& partialsData, const SynthesisParams& params, size_t nFrames, ml::Sample& out, size_t maxThreads = 0);
+
+// make a mono sample from nFrames of rendered output, fading the ends and normalizing.
+void renderedToSample(const std::vector< float >& rendered, const SynthesisParams& params, size_t nFrames, ml::Sample& out);
+
+}
@@ -0,0 +1,107 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#include "vutuThreads.h"
+
+using namespace ml;
+
+WorkerPool::WorkerPool(size_t nWorkers)
+{
+  _threads.reserve(nWorkers);
+  for(size_t t=0; t<nWorkers; ++t)
+  {
+    _threads.emplace_back([this](){ workerLoop(); });
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard< std::mutex > lock(_mutex);
+    _stopping = true;
+  }
+  _jobReady.notify_all();
+  for(auto& t : _threads)
+  {
+    t.join();
+  }
+}
+
+void WorkerPool::doTasks(Job& job)
+{
+  for(size_t i = job.nextTask++; i < job.n; i = job.nextTask++)
+  {
+    (*job.pTask)(i);
+  }
+}
+
+void WorkerPool::workerLoop()
+{
+  std::unique_lock< std::mutex > lock(_mutex);
+  while(true)
+  {
+    _jobReady.wait(lock, [&](){ return _stopping || !_jobs.empty(); });
+    if(_stopping) return;
+
+    // join the oldest job, and take it off the queue once it has all the helpers it wants.
+    Job* pJob = _jobs.front();
+    pJob->activeHelpers++;
+    if(--pJob->helpersLeft == 0)
+    {
+      _jobs.pop_front();
+    }
+
+    lock.unlock();
+    doTasks(*pJob);
+    lock.lock();
+
+    pJob->activeHelpers--;
+    _helperDone.notify_all();
+  }
+}
+
+void WorkerPool::run(size_t n, size_t maxHelpers, const std::function< void(size_t) >& task)
+{
+  Job job;
+  job.pTask = &task;
+  job.n = n;
+  job.helpersLeft = std::min(maxHelpers, _threads.size());
+  if(job.helpersLeft == 0)
+  {
+    doTasks(job);
+    return;
+  }
+
+  const size_t nHelpers = job.helpersLeft;
+  {
+    std::lock_guard< std::mutex > lock(_mutex);
+    _jobs.push_back(&job);
+  }
+  if(nHelpers == 1)
+  {
+    _jobReady.notify_one();
+  }
+  else
+  {
+    _jobReady.notify_all();
+  }
+
+  doTasks(job);
+
+  // no more tasks will start. Take the job off the queue if it is still there, then wait for
+  // the helpers that joined it to finish their last tasks.
+  std::unique_lock< std::mutex > lock(_mutex);
+  auto it = std::find(_jobs.begin(), _jobs.end(), &job);
+  if(it != _jobs.end())
+  {
+    _jobs.erase(it);
+  }
+  _helperDone.wait(lock, [&](){ return job.activeHelpers == 0; });
+}
+
+WorkerPool& ml::getWorkerPool()
+{
+  static WorkerPool pool(getWorkerThreadCount() - 1);
+  return pool;
+}
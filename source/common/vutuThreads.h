@@ -0,0 +1,123 @@
+
+// vutu
+// Copyright (c) 2023 Madrona Labs LLC. http://www.madronalabs.com
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// simple helpers for running batch work on all cores. The work runs on a pool of worker
+// threads that is started once and kept for the life of the program, so a parallel call
+// costs a wakeup instead of creating and joining threads.
+
+namespace ml
+{
+
+// get the number of worker threads to use. If maxThreads is 0, use all hardware threads.
+inline size_t getWorkerThreadCount(size_t maxThreads = 0)
+{
+  size_t n = std::max(1u, std::thread::hardware_concurrency());
+  if(maxThreads > 0)
+  {
+    n = std::min(n, maxThreads);
+  }
+  return n;
+}
+
+// a fixed set of threads that help callers run their tasks. Any thread can call run(), and
+// tasks can call run() again: the caller always works on its own job, so a job finishes
+// even when every worker is busy.
+class WorkerPool
+{
+public:
+  explicit WorkerPool(size_t nWorkers);
+  ~WorkerPool();
+
+  size_t getWorkers() const { return _threads.size(); }
+
+  // call task(i) for each i in [0, n), on the calling thread and up to maxHelpers workers.
+  // Tasks are taken from a shared counter. Returns when all the tasks are done.
+  void run(size_t n, size_t maxHelpers, const std::function< void(size_t) >& task);
+
+private:
+  struct Job
+  {
+    const std::function< void(size_t) >* pTask;
+    size_t n;
+    size_t helpersLeft;
+    size_t activeHelpers{0};
+    std::atomic< size_t > nextTask{0};
+  };
+
+  void workerLoop();
+  static void doTasks(Job& job);
+
+  std::mutex _mutex;
+  std::condition_variable _jobReady;
+  std::condition_variable _helperDone;
+  std::deque< Job* > _jobs;
+  bool _stopping{false};
+  std::vector< std::thread > _threads;
+};
+
+// the pool shared by the parallel helpers below, with one worker for each hardware thread
+// besides the caller's. It is started on first use.
+WorkerPool& getWorkerPool();
+
+// get the start of chunk c when [0, n) is divided into nChunks contiguous chunks.
+inline size_t getChunkStart(size_t n, size_t nChunks, size_t c)
+{
+  return (n*c)/nChunks;
+}
+
+// call fn(chunkIndex, begin, end) for nChunks contiguous ranges covering [0, n), running
+// chunks in parallel on the worker pool. The partition depends only on n and nChunks, so
+// results that are combined in chunk order are the same from run to run.
+template< typename F >
+inline void parallelForChunks(size_t n, size_t nChunks, F fn)
+{
+  nChunks = std::max(size_t(1), std::min(nChunks, n));
+  if(nChunks == 1)
+  {
+    fn(size_t(0), size_t(0), n);
+    return;
+  }
+
+  std::function< void(size_t) > task = [&](size_t c)
+  {
+    fn(c, getChunkStart(n, nChunks, c), getChunkStart(n, nChunks, c + 1));
+  };
+  getWorkerPool().run(nChunks, nChunks - 1, task);
+}
+
+// call fn(i) for each i in [0, n) on up to maxThreads threads, including the caller's. Jobs
+// are taken from a shared counter, so this balances well when the jobs are of very
+// different sizes.
+template< typename F >
+inline void parallelFor(size_t n, F fn, size_t maxThreads = 0)
+{
+  size_t nThreads = std::min(getWorkerThreadCount(maxThreads), n);
+  if(nThreads <= 1)
+  {
+    for(size_t i=0; i<n; ++i)
+    {
+      fn(i);
+    }
+    return;
+  }
+
+  std::function< void(size_t) > task = [&](size_t i)
+  {
+    fn(i);
+  };
+  getWorkerPool().run(n, nThreads - 1, task);
+}
+
+}
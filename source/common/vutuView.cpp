@@ -77,6 +77,12 @@ void VutuView::layoutView(DrawContext dc)
   _view->_widgets["freq_drift"]->setRectProperty("bounds", alignCenterToPoint(largeDialRect, {9.5, dialsY2}));
   _view->_widgets["noise_width"]->setRectProperty("bounds", alignCenterToPoint(largeDialRect, {11, dialsY1}));
   
+  _view->_widgets["playback_rate"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {13.f, bottomY + 1.5f}));
+  _view->_widgets["max_voices"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {15.5f, bottomY + 1.5f}));
+  _view->_widgets["morph"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {15.5f, bottomY + 3.5f}));
+  _view->_widgets["simplify_cents"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {13.f, bottomY + 3.5f}));
+  _view->_widgets["simplify_db"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {13.f, bottomY + 5.5f}));
+  
   // right dials
   _view->_widgets["fundamental"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {gx - 2.f, bottomY + 1.5f}));
   _view->_widgets["test_volume"]->setRectProperty("bounds", alignCenterToPoint(mediumDialRect, {gx - 2.f, bottomY + 3.5f}));
@@ -90,7 +96,7 @@ void VutuView::layoutView(DrawContext dc)
     _view->_backgroundWidgets[labelName]->setRectProperty
     ("bounds", alignTopCenterToPoint(labelRect, dialRect.bottomCenter() - Vec2(0, 0.5)));
   };
-  for(auto dialName : {"resolution", "window_width", "amp_floor", "lo_cut", "hi_cut", "noise_width", "freq_drift", "fundamental", "test_volume", "output_volume"})
+  for(auto dialName : {"resolution", "window_width", "amp_floor", "lo_cut", "hi_cut", "noise_width", "freq_drift", "playback_rate", "max_voices", "morph", "simplify_cents", "simplify_db", "fundamental", "test_volume", "output_volume"})
   {
     positionLabelUnderDial(dialName);
   }
@@ -131,6 +137,11 @@ void VutuView::layoutView(DrawContext dc)
 
   _view->_widgets["play_synth"]->setRectProperty("bounds", alignCenterToPoint(textButtonRect, {buttonsX1, buttonsY3}));
   _view->_widgets["export_synth"]->setRectProperty("bounds", alignCenterToPoint(textButtonRect, {buttonsX2, buttonsY3}));
+  _view->_widgets["distill"]->setRectProperty("bounds", alignCenterToPoint(textButtonRect, {buttonsX3, buttonsY3}));
+
+  ml::Rect morphButtonRect(0, 0, 3, 1);
+  _view->_widgets["morph_target"]->setRectProperty("bounds", alignCenterToPoint(morphButtonRect, {15.5f, buttonsY3}));
+  _view->_widgets["play_residual"]->setRectProperty("bounds", alignCenterToPoint(morphButtonRect, {18.5f, buttonsY3}));
   
   // other labels
   ml::Rect otherLabelsRect(0, 0, 2, 1);
@@ -194,6 +205,11 @@ void VutuView::makeWidgets(const ParameterDescriptionList& pdl)
   addControlLabel("lo_cut_label", "lo cut");
   addControlLabel("hi_cut_label", "hi cut");
   addControlLabel("noise_width_label", "noise width");
+  addControlLabel("playback_rate_label", "speed");
+  addControlLabel("max_voices_label", "max. voices");
+  addControlLabel("morph_label", "morph");
+  addControlLabel("simplify_cents_label", "max. cents");
+  addControlLabel("simplify_db_label", "max. dB");
   addControlLabel("fundamental_label", "fundamental");
   addControlLabel("test_volume_label", "fund. volume");
   addControlLabel("output_volume_label", "output volume");
@@ -256,6 +272,36 @@ void VutuView::makeWidgets(const ParameterDescriptionList& pdl)
     {"param", "noise_width" }
   } );
   
+  _view->_widgets.add_unique< DialBasic >("playback_rate", WithValues{
+    {"size", mediumDialSize },
+    {"feature_scale", 2.0 },
+    {"param", "playback_rate" }
+  } );
+  
+  _view->_widgets.add_unique< DialBasic >("max_voices", WithValues{
+    {"size", mediumDialSize },
+    {"feature_scale", 2.0 },
+    {"param", "max_voices" }
+  } );
+  
+  _view->_widgets.add_unique< DialBasic >("morph", WithValues{
+    {"size", mediumDialSize },
+    {"feature_scale", 2.0 },
+    {"param", "morph" }
+  } );
+  
+  _view->_widgets.add_unique< DialBasic >("simplify_cents", WithValues{
+    {"size", mediumDialSize },
+    {"feature_scale", 2.0 },
+    {"param", "simplify_cents" }
+  } );
+  
+  _view->_widgets.add_unique< DialBasic >("simplify_db", WithValues{
+    {"size", mediumDialSize },
+    {"feature_scale", 2.0 },
+    {"param", "simplify_db" }
+  } );
+  
   _view->_widgets.add_unique< DialBasic >("fundamental", WithValues{
     {"size", mediumDialSize },
     {"feature_scale", 2.0 },
@@ -299,14 +345,26 @@ void VutuView::makeWidgets(const ParameterDescriptionList& pdl)
     {"text", "export .utu" },
     {"action", "export" }
   } );
+  _view->_widgets.add_unique< TextButtonBasic >("distill", WithValues{
+    {"text", "distill" },
+    {"action", "distill" }
+  } );
   _view->_widgets.add_unique< TextButtonBasic >("play_synth", WithValues{
     {"text", "play" },
     {"action", "toggle_play_synth" }
   } );
   _view->_widgets.add_unique< TextButtonBasic >("export_synth", WithValues{
-    {"text", "export .wav" },
+    {"text", "export audio" },
     {"action", "export_synth" }
   } );
+  _view->_widgets.add_unique< TextButtonBasic >("morph_target", WithValues{
+    {"text", "set target" },
+    {"action", "morph_target" }
+  } );
+  _view->_widgets.add_unique< TextButtonBasic >("play_residual", WithValues{
+    {"text", "residual" },
+    {"action", "toggle_play_residual" }
+  } );
 
   // info label
   _view->_widgets.add_unique< TextLabelBasic >("info", WithValues{
@@ -348,8 +406,10 @@ void VutuView::makeWidgets(const ParameterDescriptionList& pdl)
   _view->_widgets["play_source"]->setProperty("enabled", false);
   _view->_widgets["analyze"]->setProperty("enabled", false);
   _view->_widgets["export"]->setProperty("enabled", false);
+  _view->_widgets["distill"]->setProperty("enabled", false);
   _view->_widgets["play_synth"]->setProperty("enabled", false);
   _view->_widgets["export_synth"]->setProperty("enabled", false);
+  _view->_widgets["play_residual"]->setProperty("enabled", false);
 
   _setupWidgets(pdl);
 }
@@ -82,9 +82,61 @@ MessageList VutuPartialsDisplay::animate(int elapsedTimeInMs, ml::DrawContext dc
     prevFundamental = fundamental;
   }
   
+  float t = getFloatPropertyWithDefault("playback_time", 0.f);
+  if(t != _playbackTime)
+  {
+    _playbackTime = t;
+    _dirty = true;
+  }
+  
   return MessageList{};
 }
 
+Interval VutuPartialsDisplay::getTimeInterval()
+{
+  if(!_pPartials) return Interval{0.f, 0.f};
+  Interval analysisInterval = getParamValue("analysis_interval").getIntervalValue();
+  return Interval{0.f, (analysisInterval.mX2 - analysisInterval.mX1)*_pPartials->sourceDuration};
+}
+
+MessageList VutuPartialsDisplay::processGUIEvent(const GUICoordinates& gc, GUIEvent e)
+{
+  MessageList r{};
+  if(!getBoolPropertyWithDefault("enabled", true)) return r;
+  
+  bool partialsOK = _pPartials && _pPartials->stats.nPartials;
+  if(!partialsOK) return r;
+  
+  // use top left relative coords
+  Rect bounds = getBounds();
+  Vec2 gridPosition = e.position - bounds.topLeft();
+  Interval timeInterval = getTimeInterval();
+  auto xToTime = projections::linear({0.f, bounds.width()}, timeInterval);
+  float t = clamp(xToTime(gridPosition.x()), timeInterval.mX1, timeInterval.mX2);
+  
+  // scrub the real-time partials playback while dragging, and let it play on from
+  // the last position on release.
+  switch(hash(e.type))
+  {
+    case(hash("down")):
+    case(hash("drag")):
+    {
+      r.push_back(Message{"editor/do/scrub", t});
+      break;
+    }
+    case(hash("up")):
+    {
+      r.push_back(Message{"editor/do/scrub_end", t});
+      break;
+    }
+    default:
+    {
+      break;
+    }
+  }
+  return r;
+}
+
 void VutuPartialsDisplay::receiveNamedRawPointer(Path name, void* ptr)
 {
   switch(hash(head(name)))
@@ -134,11 +186,9 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     size_t nPartials = _pPartials->stats.nPartials;
     std::cout << "painting " << nPartials << " partials... \n";
     
-    Interval analysisInterval = getParamValue("analysis_interval").getIntervalValue();
-    
     Interval xRange{0.f, w - 1.f};
     Interval yRange{h - 1.f, 0.f};
-    Interval timeInterval{0.f, (analysisInterval.mX2 -  analysisInterval.mX1)*_pPartials->sourceDuration};
+    Interval timeInterval = getTimeInterval();
     
     constexpr float kMinLineLength{2.f};
     auto xToTime = projections::linear(xRange, timeInterval);
@@ -170,6 +220,16 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     nvgStroke(nvg);
 */
     
+    // cull partials outside the time interval or too quiet to draw, using only the summaries.
+    const auto& summaries = _pPartials->stats.summaries;
+    bool haveSummaries = (summaries.size() == nPartials);
+    auto visiblePartials = selectPartials(*_pPartials, [&](size_t i)
+    {
+      if(!haveSummaries) return true;
+      Interval r = _pPartials->stats.partialTimeRanges[i];
+      return (r.mX2 >= timeInterval.mX1) && (r.mX1 <= timeInterval.mX2) && (summaries.peakAmp[i] >= ampRange.mX1);
+    });
+
     // time the partials bit
     auto roughStart = high_resolution_clock::now();
     size_t totalFramesDrawn{0};
@@ -179,7 +239,7 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     auto sineColor = rgba(0, 1, 0, 0.5f);
     nvgStrokeColor(nvg, sineColor);
     nvgStrokeWidth(nvg, strokeWidth);
-    for(int p=0; p<nPartials; ++p)
+    for(size_t p : visiblePartials)
     {
       const auto& partial = _pPartials->partials[p];
       size_t framesInPartial = partial.time.size();
@@ -221,7 +281,7 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     nvgBeginPath(nvg);
     auto partialFillColor(rgba(0, 1, 0, 0.5));
     nvgFillColor(nvg, partialFillColor);
-    for(int p=0; p<nPartials; ++p)
+    for(size_t p : visiblePartials)
     {
       const auto& partial = _pPartials->partials[p];
       size_t framesInPartial = partial.time.size();
@@ -275,7 +335,7 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     nvgStrokeWidth(nvg, strokeWidth);
     nvgStrokeColor(nvg, spineColor);
     nvgBeginPath(nvg);
-    for(int p=0; p<nPartials; ++p)
+    for(size_t p : visiblePartials)
     {
       const auto& partial = _pPartials->partials[p];
       size_t framesInPartial = partial.time.size();
@@ -303,8 +363,9 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     nvgStrokeWidth(nvg, strokeWidth);
     auto xColor(rgba(0, 1, 0, 1.0));
     nvgStrokeColor(nvg, xColor);
-    for(int p=0; p<nPartials; ++p)
+    for(size_t p : visiblePartials)
     {
+      if(haveSummaries && (summaries.meanBandwidth[p] <= 0.f)) continue;
       const auto& partial = _pPartials->partials[p];
       size_t framesInPartial = partial.time.size();
       
@@ -323,6 +384,28 @@ void VutuPartialsDisplay::paintPartials(ml::DrawContext dc)
     }
     nvgStroke(nvg);
 
+    // draw the number of active partials over time as a density strip along the bottom.
+    const auto& timeline = _pPartials->stats.polyphony;
+    if(timeline.times.size() && _pPartials->stats.maxActivePartials)
+    {
+      float stripHeight = h/24.f;
+      float countScale = stripHeight/_pPartials->stats.maxActivePartials;
+      nvgBeginPath(nvg);
+      nvgFillColor(nvg, rgba(0, 1, 0, 0.35f));
+      nvgMoveTo(nvg, timeToX(timeline.times[0]), h);
+      for(size_t k=0; k<timeline.times.size(); ++k)
+      {
+        float x = timeToX(timeline.times[k]);
+        float y = h - timeline.counts[k]*countScale;
+        float prevY = h - (k ? timeline.counts[k - 1] : 0)*countScale;
+        nvgLineTo(nvg, x, prevY);
+        nvgLineTo(nvg, x, y);
+      }
+      nvgLineTo(nvg, timeToX(timeline.times.back()), h);
+      nvgClosePath(nvg);
+      nvgFill(nvg);
+    }
+
     auto roughEnd = high_resolution_clock::now();
     auto roughMillisTotal = duration_cast<milliseconds>(roughEnd - roughStart).count();
     std::cout << "partials painting time rough millis: " << roughMillisTotal << "\n";
@@ -420,6 +503,19 @@ void VutuPartialsDisplay::draw(ml::DrawContext dc)
       nvgFill(nvg);
     }
     
+    // draw playback position
+    if(_playbackTime > 0.f)
+    {
+      auto playbackTimeToX = projections::linear(getTimeInterval(), {0.f, w - 1.f});
+      float px = playbackTimeToX(_playbackTime);
+      nvgStrokeWidth(nvg, strokeWidth);
+      nvgBeginPath(nvg);
+      nvgStrokeColor(nvg, markColor);
+      nvgMoveTo(nvg, px, marginBounds.top());
+      nvgLineTo(nvg, px, marginBounds.bottom());
+      nvgStroke(nvg);
+    }
+    
     // draw fundamental line
     {
       float funY = freqToY(fundamental);
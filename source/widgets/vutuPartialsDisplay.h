@@ -22,6 +22,10 @@ class VutuPartialsDisplay : public Widget
   
   const VutuPartialsData * _pPartials{nullptr};
   
+  float _playbackTime{0};
+  
+  // time range of the partials shown across the width of the display.
+  Interval getTimeInterval();
 
   ml::DrawContext _prevDC{nullptr};
   float prevFundamental{0};
@@ -41,6 +45,7 @@ public:
   void resize(ml::DrawContext d) override;
   MessageList animate(int elapsedTimeInMs, ml::DrawContext dc) override;
   void draw(ml::DrawContext d) override;
+  MessageList processGUIEvent(const GUICoordinates& gc, GUIEvent e) override;
   void receiveNamedRawPointer(Path name, void* ptr) override;
   
   void redrawPartials();